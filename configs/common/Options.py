@@ -566,6 +566,14 @@ def addCommonOptions(parser, default_isa: Optional[ISA] = None):
         type=int,
         help="restore from checkpoint <N>",
     )
+    parser.add_argument(
+        "--pagelist-cache",
+        action="store",
+        type=str,
+        default="",
+        help="Directory for uncompressed copies of checkpoint page files, "
+        "shared between runs; restore paged checkpoints lazily from them",
+    )
     parser.add_argument(
         "--checkpoint-at-end",
         action="store_true",
@@ -201,6 +201,7 @@ system = System(
     mem_ranges=[AddrRange(args.mem_size)],
     cache_line_size=args.cacheline_size,
 )
+system.pagelist_cache = args.pagelist_cache
 
 if numThreads > 1:
     system.multi_thread = True
@@ -0,0 +1,176 @@
+"""Cluster the SLEV intervals of several binaries of the same program.
+
+Each binary's SLEV file (see src/cpu/pin/tools/slev.cc) has intervals
+delimited by instruction counts, but annotated with the range of waypoints
+they cover. The waypoints mark the same source locations in every binary,
+so they line the binaries up: the first (reference) binary's intervals
+become regions, and each interval of every binary is added to the region
+its first waypoint falls in. A region's feature vector is its vectors from
+all binaries side by side, each binary's part normalized to sum to 1.
+
+The regions are clustered once with k-means on a random projection, as in
+SimPoint. The region closest to each centroid is a checkpoint location,
+given as the waypoint count it starts at. That count is the same in every
+binary; use it with --pin-targets and --pin-target-counter=waypoint.
+
+Run as a script to cluster existing SLEV files:
+
+    python3 Cluster.py --k 10 slev.0.vec slev.1.vec > locations.json
+"""
+
+import bisect
+import json
+import random
+import re
+
+try:
+    from multibin.VecFile import VecReader
+except ImportError:
+    from VecFile import VecReader
+
+_COMMENT = re.compile(r"insts=(\d+),(\d+) progmarks=(\d+),(\d+)")
+
+
+class Interval:
+    """An SLEV interval: its vector and where it starts and ends."""
+
+    def __init__(self, vec, comment: str):
+        m = _COMMENT.search(comment)
+        if not m:
+            raise ValueError(f"bad SLEV interval comment: {comment!r}")
+        self.vec = vec
+        # The pintool reports the instruction count at the start of the
+        # previous interval and of this one, but the waypoint counts at the
+        # start and end of this one.
+        self.insts = int(m.group(2))
+        self.waypoints = (int(m.group(3)), int(m.group(4)))
+
+
+def read_intervals(path: str) -> list:
+    return [Interval(vec, comment) for vec, comment in VecReader(path)]
+
+
+def _project(key, dims: int) -> list:
+    rng = random.Random(key)
+    return [rng.uniform(-1, 1) for _ in range(dims)]
+
+
+def _distance(a: list, b: list) -> float:
+    return sum((x - y) ** 2 for x, y in zip(a, b))
+
+
+def _kmeans(points: list, k: int, rng: random.Random, iters: int) -> tuple:
+    """Return each point's cluster and the centroids, seeding with k-means++."""
+    centroids = [rng.choice(points)]
+    while len(centroids) < k:
+        dists = [min(_distance(p, c) for c in centroids) for p in points]
+        total = sum(dists)
+        if total == 0:
+            break
+        r = rng.uniform(0, total)
+        for p, d in zip(points, dists):
+            r -= d
+            if r <= 0:
+                break
+        centroids.append(p)
+
+    assignment = [None] * len(points)
+    for _ in range(iters):
+        changed = False
+        for i, p in enumerate(points):
+            c = min(range(len(centroids)),
+                    key=lambda c: _distance(p, centroids[c]))
+            if assignment[i] != c:
+                assignment[i] = c
+                changed = True
+        if not changed:
+            break
+        for c in range(len(centroids)):
+            members = [p for p, a in zip(points, assignment) if a == c]
+            if members:
+                centroids[c] = [sum(xs) / len(members) for xs in zip(*members)]
+    return assignment, centroids
+
+
+def cluster(binaries: list, k: int, dims: int = 15, seed: int = 1,
+            iters: int = 100) -> dict:
+    """Cluster the intervals of the binaries (lists of Interval, the first
+    being the reference) and return the checkpoint locations."""
+    reference = binaries[0]
+    if not reference:
+        raise ValueError("reference binary has no intervals")
+    # Reference intervals that pass no waypoint start at the same one as
+    # the next; they're one region, since targets can't tell them apart.
+    starts = sorted({interval.waypoints[0] for interval in reference})
+
+    # Line every binary's intervals up with the reference's regions.
+    regions = [[dict() for _ in binaries] for _ in starts]
+    region_insts = [[None] * len(binaries) for _ in starts]
+    for b, intervals in enumerate(binaries):
+        for interval in intervals:
+            r = max(bisect.bisect_right(starts, interval.waypoints[0]) - 1, 0)
+            counts = regions[r][b]
+            for id, count in interval.vec:
+                counts[id] = counts.get(id, 0) + count
+            if region_insts[r][b] is None:
+                region_insts[r][b] = interval.insts
+
+    projections = {}
+    points = []
+    for region in regions:
+        point = [0.0] * dims
+        for b, counts in enumerate(region):
+            total = sum(counts.values())
+            for id, count in counts.items():
+                key = (b, id)
+                if key not in projections:
+                    projections[key] = _project(f"{b}:{id}", dims)
+                weight = count / total
+                for d, x in enumerate(projections[key]):
+                    point[d] += weight * x
+        points.append(point)
+
+    rng = random.Random(seed)
+    assignment, centroids = _kmeans(points, min(k, len(points)), rng, iters)
+
+    locations = []
+    for c, centroid in enumerate(centroids):
+        members = [r for r, a in enumerate(assignment) if a == c]
+        if not members:
+            continue
+        r = min(members, key=lambda r: _distance(points[r], centroid))
+        locations.append({
+            "cluster": c,
+            "region": r,
+            "weight": len(members) / len(regions),
+            "waypoint": starts[r],
+            # Approximate: the start of the binary's first interval in the
+            # region, if it has one.
+            "insts": region_insts[r],
+        })
+    locations.sort(key=lambda location: location["waypoint"])
+    return {"regions": len(regions), "locations": locations}
+
+
+def targets(result: dict) -> str:
+    """The locations as a --pin-targets list."""
+    waypoints = sorted({location["waypoint"] for location in result["locations"]})
+    return ",".join(str(waypoint) for waypoint in waypoints)
+
+
+if __name__ == "__main__":
+    import argparse
+    import sys
+
+    parser = argparse.ArgumentParser(
+        description="Cluster SLEV files of several binaries into checkpoint locations"
+    )
+    parser.add_argument("--k", type=int, default=10, help="Number of clusters")
+    parser.add_argument("--dims", type=int, default=15, help="Dimensions to project vectors to")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("slev", nargs="+", help="SLEV files (vec format), reference binary first")
+    args = parser.parse_args()
+    result = cluster([read_intervals(path) for path in args.slev],
+                     args.k, args.dims, args.seed)
+    json.dump(result, sys.stdout, indent=2)
+    print()
@@ -0,0 +1,245 @@
+"""Chunked binary basic block vector/trace files.
+
+See src/cpu/pin/tools/vecfile.hh for the layout. The pintool writes
+uncompressed chunks (PinCRT has no zlib); the writer here compresses each
+chunk with zlib.
+
+Run as a script to convert a file to the SimPoint text format:
+
+    python3 VecFile.py bbv.vec > bbv.txt
+"""
+
+import bisect
+import struct
+import sys
+import zlib
+
+FILE_MAGIC = b"PINVEC01"
+INDEX_MAGIC = b"PINVIDX1"
+
+KIND_VECTORS = 0
+KIND_TRACE = 1
+
+CODEC_NONE = 0
+CODEC_ZLIB = 1
+
+_FILE_HEADER = struct.Struct("<8sII")
+_CHUNK_HEADER = struct.Struct("<IIQII")
+_FOOTER = struct.Struct("<Q8s")
+
+
+def _put_varint(buf: bytearray, x: int):
+    while x >= 0x80:
+        buf.append((x & 0x7F) | 0x80)
+        x >>= 7
+    buf.append(x)
+
+
+def _get_varint(buf: bytes, pos: int):
+    x = 0
+    shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        x |= (b & 0x7F) << shift
+        if b < 0x80:
+            return x, pos
+        shift += 7
+
+
+class VecWriter:
+    """Writes interval vectors, compressing a chunk at a time."""
+
+    def __init__(self, path: str, chunk_records: int = 64, level: int = 6):
+        self.f = open(path, "wb")
+        self.f.write(_FILE_HEADER.pack(FILE_MAGIC, KIND_VECTORS, 0))
+        self.chunk_records = chunk_records
+        self.level = level
+        self.records = []
+        self.first_record = 0
+        self.index = []
+
+    def add(self, vec, comment: str = ""):
+        """Add one interval's vector: an iterable of (id, count) pairs."""
+        self.records.append((sorted(vec), comment))
+        if len(self.records) >= self.chunk_records:
+            self._flush()
+
+    def _flush(self):
+        if not self.records:
+            return
+        payload = bytearray()
+        for vec, comment in self.records:
+            _put_varint(payload, len(vec))
+            prev_id = 0
+            for id, count in vec:
+                _put_varint(payload, id - prev_id)
+                _put_varint(payload, count)
+                prev_id = id
+            comment = comment.encode()
+            _put_varint(payload, len(comment))
+            payload += comment
+        stored = zlib.compress(bytes(payload), self.level)
+        self.index.append((self.first_record, self.f.tell()))
+        self.f.write(
+            _CHUNK_HEADER.pack(
+                CODEC_ZLIB,
+                len(self.records),
+                self.first_record,
+                len(payload),
+                len(stored),
+            )
+        )
+        self.f.write(stored)
+        self.first_record += len(self.records)
+        self.records = []
+
+    def close(self):
+        self._flush()
+        index_offset = self.f.tell()
+        self.f.write(struct.pack("<Q", len(self.index)))
+        for first_record, offset in self.index:
+            self.f.write(struct.pack("<QQ", first_record, offset))
+        self.f.write(_FOOTER.pack(index_offset, INDEX_MAGIC))
+        self.f.close()
+
+
+class VecReader:
+    """Reads vector and trace files, sequentially or by record number."""
+
+    def __init__(self, path: str):
+        self.f = open(path, "rb")
+        magic, self.kind, _ = _FILE_HEADER.unpack(
+            self.f.read(_FILE_HEADER.size)
+        )
+        if magic != FILE_MAGIC:
+            raise ValueError(f"{path}: not a vector file")
+        self.index = self._read_index()
+
+    def _read_index(self):
+        """Return [(first_record, offset)], scanning if there's no index."""
+        self.f.seek(0, 2)
+        size = self.f.tell()
+        if size >= _FILE_HEADER.size + _FOOTER.size:
+            self.f.seek(size - _FOOTER.size)
+            index_offset, magic = _FOOTER.unpack(self.f.read(_FOOTER.size))
+            if magic == INDEX_MAGIC:
+                self.f.seek(index_offset)
+                (n,) = struct.unpack("<Q", self.f.read(8))
+                entries = struct.iter_unpack("<QQ", self.f.read(16 * n))
+                return list(entries)
+
+        # The writer didn't finish; take every complete chunk, stopping at
+        # anything that doesn't follow on from the previous one (e.g., part
+        # of an index).
+        index = []
+        offset = _FILE_HEADER.size
+        next_record = 0
+        while offset + _CHUNK_HEADER.size <= size:
+            self.f.seek(offset)
+            codec, n, first_record, _, stored_size = _CHUNK_HEADER.unpack(
+                self.f.read(_CHUNK_HEADER.size)
+            )
+            if (
+                codec not in (CODEC_NONE, CODEC_ZLIB)
+                or first_record != next_record
+                or offset + _CHUNK_HEADER.size + stored_size > size
+            ):
+                break
+            index.append((first_record, offset))
+            offset += _CHUNK_HEADER.size + stored_size
+            next_record = first_record + n
+        return index
+
+    def _read_chunk(self, offset: int):
+        self.f.seek(offset)
+        codec, n, first_record, raw_size, stored_size = _CHUNK_HEADER.unpack(
+            self.f.read(_CHUNK_HEADER.size)
+        )
+        payload = self.f.read(stored_size)
+        if codec == CODEC_ZLIB:
+            payload = zlib.decompress(payload)
+        elif codec != CODEC_NONE:
+            raise ValueError(f"unknown codec {codec}")
+        assert len(payload) == raw_size
+        return first_record, self._decode(payload, n)
+
+    def _decode(self, payload: bytes, n: int):
+        records = []
+        pos = 0
+        if self.kind == KIND_VECTORS:
+            for _ in range(n):
+                size, pos = _get_varint(payload, pos)
+                vec = []
+                id = 0
+                for _ in range(size):
+                    delta, pos = _get_varint(payload, pos)
+                    count, pos = _get_varint(payload, pos)
+                    id += delta
+                    vec.append((id, count))
+                length, pos = _get_varint(payload, pos)
+                comment = payload[pos : pos + length].decode()
+                pos += length
+                records.append((vec, comment))
+        else:
+            hashes = []
+            for _ in range(n):
+                code, pos = _get_varint(payload, pos)
+                if code == 0:
+                    (h,) = struct.unpack_from("<I", payload, pos)
+                    pos += 4
+                    hashes.append(h)
+                else:
+                    h = hashes[code - 1]
+                records.append(h)
+        return records
+
+    def __iter__(self):
+        for _, offset in self.index:
+            yield from self._read_chunk(offset)[1]
+
+    def __getitem__(self, i: int):
+        """Record i: an interval's (vector, comment), or a trace's hash."""
+        firsts = [first_record for first_record, _ in self.index]
+        chunk = bisect.bisect_right(firsts, i) - 1
+        if chunk < 0:
+            raise IndexError(i)
+        first_record, records = self._read_chunk(self.index[chunk][1])
+        if i - first_record >= len(records):
+            raise IndexError(i)
+        return records[i - first_record]
+
+
+def to_text(records, kind: int, f):
+    """Write vectors in the SimPoint text format, and traces as hex hashes."""
+    for record in records:
+        if kind == KIND_VECTORS:
+            vec, comment = record
+            f.write("T")
+            for id, count in vec:
+                f.write(f" :{id}:{count}")
+            f.write("\n")
+            if comment:
+                f.write(f"# {comment}\n")
+        else:
+            f.write(f"{record:08x}\n")
+
+
+if __name__ == "__main__":
+    import argparse
+
+    parser = argparse.ArgumentParser(
+        description="Convert a vector file to SimPoint text format"
+    )
+    parser.add_argument("input")
+    parser.add_argument(
+        "--record",
+        type=int,
+        help="Only print this interval (or trace entry)",
+    )
+    args = parser.parse_args()
+    reader = VecReader(args.input)
+    if args.record is not None:
+        to_text([reader[args.record]], reader.kind, sys.stdout)
+    else:
+        to_text(reader, reader.kind, sys.stdout)
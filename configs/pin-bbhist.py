@@ -164,10 +164,9 @@ if exit_cause != "pin-breakpoint":
     print(f"pin-bbhist: simulation stopped with unexpected reason '{exit_cause}' (expected 'pin-breakpoint')",
           file = sys.stderr)
     exit(1)
-bbhist = cpu.executePinCommand("bbhist dump")
-
-with open(args.bbhist, "wt") as f:
-    f.write(bbhist)
+# Write the dump straight out of the pintool's result region.
+with open(args.bbhist, "wb") as f:
+    f.write(cpu.executePinCommandView("bbhist dump"))
 
 exit_cause = m5.simulate().getCause()
 if exit_cause != "exiting with last active thread context":
@@ -40,8 +40,6 @@
 #
 # "m5 test.py"
 
-# TODO: Compress bbv.txt. It's going to get huge for longer-running benchmarks.
-
 import argparse
 import collections
 import json
@@ -63,6 +61,7 @@ from multibin.Util import (
     make_parser,
     make_process,
 )
+from multibin.VecFile import VecWriter
 
 import m5
 from m5.defines import buildEnv
@@ -107,6 +106,12 @@ parser.add_argument(
     default=2,
     help="Interval tolerance factor",
 )
+parser.add_argument(
+    "--bbv-format",
+    choices=["text", "vec"],
+    default="text",
+    help="Basic block vector file format (vec: compressed binary, see multibin/VecFile.py)",
+)
 parser.add_argument(
     "--waypoints",
     type=os.path.abspath,
@@ -274,24 +279,33 @@ def block_to_id(block: str) -> int:
 
 def dump_bbhist(s: str, f, good: bool):
     # Check if this interval is of a sane length.
-    f.write("T")
     l, total_insts = parse_bbhist(s)
+    vec = []
     if total_insts <= args.interval * args.tolerance:
         for block, count in l:
             assert count > 0
             id = block_to_id(block)
             weight = count * len(block)
-            f.write(f" :{id}:{weight}")
+            vec.append((id, weight))
     else:
-        f.write(" :1:1")
-    f.write("\n")
+        vec.append((1, 1))
+    if isinstance(f, VecWriter):
+        f.add(vec)
+    else:
+        f.write("T")
+        for id, weight in vec:
+            f.write(f" :{id}:{weight}")
+        f.write("\n")
 
 # List of waypoint counts.
 warmups = [(0, 0)]
 intervals = []
 bbhists = []
 
-f_bbv = open(args.bbv, "wt")
+if args.bbv_format == "vec":
+    f_bbv = VecWriter(args.bbv)
+else:
+    f_bbv = open(args.bbv, "wt")
 
 try:
     # Prime the loop by running for <warmup> instructions
@@ -324,6 +338,8 @@ try:
 except Exit:
     pass
 
+f_bbv.close()
+
 # The workload exited cleanly.
 # Now, process the data into proper files.
 #   - bbv.txt: The basic block vector file.
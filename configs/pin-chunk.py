@@ -40,8 +40,6 @@
 #
 # "m5 test.py"
 
-# TODO: Compress bbv.txt. It's going to get huge for longer-running benchmarks.
-
 import argparse
 import collections
 import json
@@ -79,6 +77,8 @@ from gem5.isas import ISA
 parser = make_parser()
 parser.add_argument("--interval", type=int, required=True)
 parser.add_argument("--warmup", type=int, required=True)
+parser.add_argument("--dirty-tracking", action="store_true",
+                    help="Only hash the pages written since the last checkpoint (see System.pagelist_dirty_tracking)")
 args = parser.parse_args()
 assert args.interval > args.warmup
 process = make_process(args)
@@ -102,6 +102,7 @@ system = System(
 system.shared_backstore = f"physmem"
 system.auto_unlink_shared_backstore = True
 system.use_pagelist = True
+system.pagelist_dirty_tracking = args.dirty_tracking
 cpu = system.cpu[0]
 
 # Create a top-level voltage domain
@@ -0,0 +1,185 @@
+# Copyright (c) 2012-2013 ARM Limited
+# All rights reserved.
+#
+# The license below extends only to copyright in the software and shall
+# not be construed as granting a license to any other intellectual
+# property including but not limited to intellectual property relating
+# to a hardware implementation of the functionality of the software
+# licensed hereunder.  You may use the software subject to the license
+# terms below provided that you ensure that this notice is replicated
+# unmodified and in its entirety in all distributions of the software,
+# modified or unmodified, in source code or in binary form.
+#
+# Copyright (c) 2006-2008 The Regents of The University of Michigan
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are
+# met: redistributions of source code must retain the above copyright
+# notice, this list of conditions and the following disclaimer;
+# redistributions in binary form must reproduce the above copyright
+# notice, this list of conditions and the following disclaimer in the
+# documentation and/or other materials provided with the distribution;
+# neither the name of the copyright holders nor the names of its
+# contributors may be used to endorse or promote products derived from
+# this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+# A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+# OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+# THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Multi-binary region selection.
+#
+# Runs several binaries of the same program (e.g., built for different
+# ISAs or with different compilers) side by side, one Pin CPU each on its
+# own event queue, collecting SLEV intervals from each. The intervals are
+# then clustered once across all binaries (see multibin/Cluster.py) and
+# the checkpoint locations written to the output directory:
+#   - locations.json: each location's waypoint count, weight, and the
+#     approximate instruction count in each binary.
+#   - targets.txt: the waypoint counts, for --pin-targets.
+#
+# Each binary needs its own waypoints file, listing the addresses of the
+# same source locations in that binary.
+
+import json
+import os
+import sys
+
+from common import (
+    CacheConfig,
+    MemConfig,
+    ObjectList,
+    Simulation,
+)
+from common.Caches import *
+from common.FileSystemConfig import config_filesystem
+from multibin import Cluster
+from multibin.Util import (
+    make_parser,
+    make_process,
+)
+
+import m5
+from m5.objects import *
+from m5.util import fatal
+
+parser = make_parser()
+parser.add_argument(
+    "--binary",
+    action="append",
+    default=[],
+    type=os.path.abspath,
+    help="Another binary of the program, run with the same arguments (repeatable)",
+)
+parser.add_argument(
+    "--waypoints",
+    action="append",
+    required=True,
+    type=os.path.abspath,
+    help="Waypoints file for each binary, starting with cmd's (repeatable)",
+)
+parser.add_argument(
+    "--interval",
+    required=True,
+    type=int,
+    help="SLEV interval size, in number of instructions",
+)
+parser.add_argument("--k", type=int, default=10, help="Number of clusters")
+parser.add_argument("--seed", type=int, default=1, help="Clustering seed")
+parser.add_argument(
+    "--pin-sim-quantum",
+    type=int,
+    default=int(1e9),
+    help="Ticks between event queue synchronizations (default: 1ms)",
+)
+args = parser.parse_args()
+
+binaries = [os.path.abspath(args.cmd), *args.binary]
+if len(args.waypoints) != len(binaries):
+    fatal(f"need one --waypoints per binary ({len(binaries)}), got {len(args.waypoints)}")
+
+m5.options.outdir = os.path.abspath(m5.options.outdir)
+np = len(binaries)
+processes = []
+for i, binary in enumerate(binaries):
+    process = make_process(args)
+    process.pid = 100 + i
+    process.executable = binary
+    process.cmd = [binary, *args.args]
+    process.output = f"{args.stdout}.{i}"
+    process.errout = f"{args.stderr}.{i}"
+    process.pinInSE = True
+    processes.append(process)
+
+CPUClass = ObjectList.cpu_list.get("X86PinCPU")
+system = System(
+    cpu=[CPUClass(cpu_id=i) for i in range(np)],
+    mem_mode=CPUClass.memory_mode(),
+    mem_ranges=[AddrRange(args.mem_size)],
+    cache_line_size=args.cacheline_size,
+)
+system.shared_backstore = f"physmem"
+system.auto_unlink_shared_backstore = True
+
+system.voltage_domain = VoltageDomain(voltage=args.sys_voltage)
+system.clk_domain = SrcClockDomain(
+    clock=args.sys_clock, voltage_domain=system.voltage_domain
+)
+system.cpu_voltage_domain = VoltageDomain()
+system.cpu_clk_domain = SrcClockDomain(
+    clock=args.cpu_clock, voltage_domain=system.cpu_voltage_domain
+)
+
+slev_paths = [os.path.join(m5.options.outdir, f"slev.{i}.vec") for i in range(np)]
+for i, (cpu, process) in enumerate(zip(system.cpu, processes)):
+    cpu.pinToolArgs = (
+        f"-slev {slev_paths[i]} -slev-format vec -slev-interval {args.interval} "
+        f"-slev-progmark {args.waypoints[i]}"
+    )
+    cpu.clk_domain = system.cpu_clk_domain
+    # CPU i gets event queue i + 1, so the Pin processes run in parallel.
+    cpu.eventq_index = i + 1
+    cpu.workload = process
+    cpu.createThreads()
+
+system.m5ops_base = max(0xFFFF0000, Addr(args.mem_size).getValue())
+
+MemClass = Simulation.setMemClass(args)
+system.membus = SystemXBar()
+system.system_port = system.membus.cpu_side_ports
+CacheConfig.config_cache(args, system)
+MemConfig.config_mem(args, system)
+config_filesystem(system, args)
+
+system.workload = SEWorkload.init_compatible(binaries[0])
+
+root = Root(full_system=False, system=system)
+root.sim_quantum = args.pin_sim_quantum
+m5.instantiate()
+exit_event = m5.simulate()
+print(f"[*] workloads exited {exit_event.getCode()}", file=sys.stderr)
+
+# Each Pin process finishes its SLEV file when its workload exits.
+result = Cluster.cluster(
+    [Cluster.read_intervals(path) for path in slev_paths],
+    args.k,
+    seed=args.seed,
+)
+result["binaries"] = binaries
+with open(os.path.join(m5.options.outdir, "locations.json"), "w") as f:
+    json.dump(result, f, indent=2)
+with open(os.path.join(m5.options.outdir, "targets.txt"), "w") as f:
+    print(Cluster.targets(result), file=f)
+print(
+    f"[*] {len(result['locations'])} locations from {result['regions']} regions",
+    file=sys.stderr,
+)
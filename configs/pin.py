@@ -77,18 +77,68 @@ parser = make_parser()
 parser.add_argument("--pin-args", default="")
 parser.add_argument("--pin-tool-args", default="")
 parser.add_argument("--instcount", action="store_true")
+parser.add_argument("--pin-inline-instcount", action="store_true",
+                    help="Count instructions with inlined register increments")
+parser.add_argument("--inst-commit-stats", action="store_true",
+                    help="Report Pin's instruction counts in the commit stats")
+parser.add_argument("--pin-max-insts-per-run", type=int, default=0,
+                    help="Maximum instructions Pin executes before returning to gem5 (0: unlimited)")
+parser.add_argument("--pin-ipc", type=float, default=0.0,
+                    help="IPC used to advance simulated time after each Pin run (0: one cycle per run)")
+parser.add_argument("--pin-threads", type=int, default=1,
+                    help="Number of guest thread contexts (each runs in its own Pin process)")
+parser.add_argument("--pin-thread-quantum", type=int, default=100000,
+                    help="Instructions a guest thread runs before yielding to other threads")
+parser.add_argument("--pin-parallel", action="store_true",
+                    help="Run each CPU's Pin process in parallel on its own event queue")
+parser.add_argument("--pin-sim-quantum", type=int, default=int(1e9),
+                    help="Ticks between event queue synchronizations with --pin-parallel (default: 1ms)")
+parser.add_argument("--pin-transport", choices=["shm", "pipe"], default="shm")
+parser.add_argument("--pin-fast-syscalls", default="",
+                    help="Comma-separated syscalls to service inside Pin")
+parser.add_argument("--pin-check-fast-syscalls", action="store_true")
+parser.add_argument("--pin-map-policy", choices=["fault", "eager"], default="fault",
+                    help="Map each VMA into Pin on its first fault, or as soon as it's created")
+parser.add_argument("--pin-syscall-log-mode", choices=["off", "record", "replay"], default="off",
+                    help="Record syscall and CPUID results, or replay them instead of emulating syscalls")
+parser.add_argument("--pin-syscall-log", default="syscalls.log",
+                    help="Syscall log path, relative to the output directory")
+parser.add_argument("--pin-detailed-cpu", default=None,
+                    choices=ObjectList.cpu_list.get_names(),
+                    help="Alternate between Pin and this CPU type (e.g., X86O3CPU)")
+parser.add_argument("--pin-ff-insts", type=int, default=int(1e9),
+                    help="Instructions to fast-forward in Pin before each detailed window")
+parser.add_argument("--pin-detailed-insts", type=int, default=int(1e6),
+                    help="Instructions in each detailed window (stats are dumped after each one)")
+parser.add_argument("--pin-target-counter", choices=["waypoint", "inst"], default="waypoint",
+                    help="Pintool counter that --pin-targets are counts of")
+parser.add_argument("--pin-targets", default="",
+                    help="Comma-separated, increasing counts of --pin-target-counter at which to stop exactly")
+parser.add_argument("--pin-target-action", choices=["checkpoint", "switch"], default="checkpoint",
+                    help="At each target, take a checkpoint (cpt.target.N) or run a detailed window "
+                    "of --pin-detailed-insts on --pin-detailed-cpu")
 args = parser.parse_args()
-process = make_process(args)
+
+if args.pin_targets and args.pin_target_action == "switch" and not args.pin_detailed_cpu:
+    fatal("--pin-target-action=switch requires --pin-detailed-cpu")
+
+# Each CPU runs its own copy of the workload.
+np = args.num_cpus
+processes = []
+for i in range(np):
+    process = make_process(args)
+    if i != 0:
+        process.pid = 100 + i
+        process.output = f"{args.stdout}.{i}"
+        process.errout = f"{args.stderr}.{i}"
+    processes.append(process)
+process = processes[0]
 
 # NHM-FIXME: Just read the kvm cpu directly?
 # To get mem mode: CPUClass.memory_mode()
 CPUClass = ObjectList.cpu_list.get("X86PinCPU")
-assert int(CPUClass.numThreads) == 1
 assert not args.smt
-assert args.num_cpus == 1
 
-# NHM-FIXME
-np = 1
 mp0_path = process.executable
 system = System(
     cpu=[CPUClass(cpu_id=i) for i in range(np)],
@@ -123,26 +173,64 @@ if args.elastic_trace_en:
 
 
 # Set pin params.
-cpu = system.cpu[0]
-cpu.pinArgs = args.pin_args
-cpu.pinToolArgs = args.pin_tool_args
-cpu.countInsts = args.instcount
+for i, cpu in enumerate(system.cpu):
+    cpu.pinArgs = args.pin_args
+    cpu.pinToolArgs = args.pin_tool_args
+    cpu.countInsts = args.instcount or args.inst_commit_stats
+    cpu.instCommitStats = args.inst_commit_stats
+    cpu.inlineInstCount = args.pin_inline_instcount
+    cpu.maxInstsPerRun = args.pin_max_insts_per_run
+    cpu.ipc = args.pin_ipc
+    cpu.numThreads = args.pin_threads
+    cpu.threadQuantum = args.pin_thread_quantum
+    cpu.transport = args.pin_transport
+    if args.pin_fast_syscalls:
+        cpu.fastSyscalls = args.pin_fast_syscalls.split(",")
+    cpu.checkFastSyscalls = args.pin_check_fast_syscalls
+    cpu.mapPolicy = args.pin_map_policy
+    cpu.syscallLogMode = args.pin_syscall_log_mode
+    cpu.syscallLog = args.pin_syscall_log
+    cpu.targetCounter = args.pin_target_counter
+    # Targets are counts of the main thread, which is CPU 0's thread 0, so
+    # every pin-target exit is one of CPU 0's.
+    if args.pin_targets and i == 0:
+        cpu.targets = [int(target) for target in args.pin_targets.split(",")]
 
-# for cpu in system.cpu:
-#     cpu.usePerf = True
-process.pinInSE = True
+    # All cpus belong to a common cpu_clk_domain, therefore running at a
+    # common frequency.
+    cpu.clk_domain = system.cpu_clk_domain
 
-# All cpus belong to a common cpu_clk_domain, therefore running at a common
-# frequency.
-cpu.clk_domain = system.cpu_clk_domain
+    # CPU i gets event queue i + 1; everything else stays on queue 0, which
+    # is also where the CPUs service syscalls and page faults.
+    if args.pin_parallel:
+        cpu.eventq_index = i + 1
 
-system.m5ops_base = max(0xFFFF0000, Addr(args.mem_size).getValue())
+for process in processes:
+    process.pinInSE = True
+    process.maxStackSize = args.max_stack_size
 
-process.maxStackSize = args.max_stack_size
+system.m5ops_base = max(0xFFFF0000, Addr(args.mem_size).getValue())
 
 # NHM-FIXME
-cpu.workload = process
-cpu.createThreads()
+for cpu, process in zip(system.cpu, processes):
+    cpu.workload = [process] * args.pin_threads
+    cpu.createThreads()
+cpu = system.cpu[0]
+
+# Detailed CPUs that take over from the Pin CPUs for each sampling window.
+# The Pin processes are suspended, not killed, while switched out.
+if args.pin_detailed_cpu:
+    DetailedCPUClass = ObjectList.cpu_list.get(args.pin_detailed_cpu)
+    system.detailed_cpu = [
+        DetailedCPUClass(switched_out=True, cpu_id=i) for i in range(np)
+    ]
+    for pin_cpu, detailed_cpu in zip(system.cpu, system.detailed_cpu):
+        detailed_cpu.workload = pin_cpu.workload
+        detailed_cpu.clk_domain = pin_cpu.clk_domain
+        detailed_cpu.eventq_index = pin_cpu.eventq_index
+        detailed_cpu.numThreads = args.pin_threads
+        detailed_cpu.isa = pin_cpu.isa
+        detailed_cpu.createThreads()
 
 # NHM-FIXME
 MemClass = Simulation.setMemClass(args)
@@ -155,7 +243,45 @@ config_filesystem(system, args)
 system.workload = SEWorkload.init_compatible(mp0_path)
 
 root = Root(full_system=False, system=system)
+if args.pin_parallel:
+    root.sim_quantum = args.pin_sim_quantum
 m5.instantiate()
-exit_event = m5.simulate()
+if args.pin_targets:
+    # The main thread stops at each target.
+    while True:
+        exit_event = m5.simulate()
+        if exit_event.getCause() != "pin-target":
+            break
+        target = system.cpu[0].targetsReached() - 1
+        if args.pin_target_action == "checkpoint":
+            m5.checkpoint(os.path.join(m5.options.outdir, f"cpt.target.{target}"))
+            continue
+        m5.switchCpus(system, list(zip(system.cpu, system.detailed_cpu)))
+        m5.stats.reset()
+        system.detailed_cpu[0].scheduleInstStop(0, args.pin_detailed_insts, "switch cpus")
+        exit_event = m5.simulate()
+        if exit_event.getCause() != "switch cpus":
+            break
+        m5.stats.dump()
+        m5.switchCpus(system, list(zip(system.detailed_cpu, system.cpu)))
+elif args.pin_detailed_cpu:
+    cpus, other_cpus = system.cpu, system.detailed_cpu
+    detailed = False
+    while True:
+        # CPU 0's instruction count delimits the windows.
+        insts = args.pin_detailed_insts if detailed else args.pin_ff_insts
+        cpus[0].scheduleInstStop(0, insts, "switch cpus")
+        exit_event = m5.simulate()
+        if exit_event.getCause() != "switch cpus":
+            break
+        if detailed:
+            m5.stats.dump()
+        m5.switchCpus(system, list(zip(cpus, other_cpus)))
+        if not detailed:
+            m5.stats.reset()
+        cpus, other_cpus = other_cpus, cpus
+        detailed = not detailed
+else:
+    exit_event = m5.simulate()
 print(f"[*] workload exited {exit_event.getCode()}", file=sys.stderr)
 exit(exit_event.getCode())
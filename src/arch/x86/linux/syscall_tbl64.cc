@@ -60,7 +60,7 @@ SyscallDescTable<EmuLinux::SyscallABI64> EmuLinux::syscallDescs64 = {
     {   7, "poll", pollFunc<X86Linux64> },
     {   8, "lseek", lseekFunc<X86Linux64> },
     {   9, "mmap", mmapFunc<X86Linux64> },
-    {  10, "mprotect", ignoreFunc },
+    {  10, "mprotect", mprotectFunc<X86Linux64> },
     {  11, "munmap", munmapFunc<X86Linux64> },
     {  12, "brk", brkFunc },
     {  13, "rt_sigaction", ignoreWarnOnceFunc },
@@ -3,6 +3,7 @@
 #include <openssl/sha.h>
 #include <cstdint>
 #include <array>
+#include <vector>
 
 using Sha256Hash = std::array<uint8_t, SHA256_DIGEST_LENGTH>;
 
@@ -11,10 +12,8 @@ Sha256Hash
 sha256(const T *data, std::size_t len)
 {
     Sha256Hash hash;
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, data, len);
-    SHA256_Final(hash.data(), &sha256);
+    SHA256(reinterpret_cast<const unsigned char *>(data), len * sizeof(T),
+           hash.data());
     return hash;
 }
 
@@ -0,0 +1,143 @@
+#include "base/soft_dirty.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "base/logging.hh"
+
+namespace gem5
+{
+
+namespace soft_dirty
+{
+
+namespace
+{
+
+// Bit 55 of a pagemap entry (see Documentation/admin-guide/mm/pagemap.rst).
+constexpr uint64_t softDirtyBit = uint64_t(1) << 55;
+constexpr uint64_t presentBit = uint64_t(1) << 63;
+
+std::string
+procPath(pid_t pid, const char *file)
+{
+    return pid ? "/proc/" + std::to_string(pid) + "/" + file :
+        std::string("/proc/self/") + file;
+}
+
+/**
+ * Call f with the address of each page in a range whose pagemap entry
+ * has any of the bits in mask set, or, if missing is set, that isn't
+ * present.
+ */
+void
+forEachPage(pid_t pid, Addr vaddr, Addr size, Addr page_size, uint64_t mask,
+            bool missing, const std::function<void(Addr vaddr)> &f)
+{
+    const std::string path = procPath(pid, "pagemap");
+    const int fd = open(path.c_str(), O_RDONLY);
+    panic_if(fd < 0, "Can't open %s\n", path);
+
+    // One entry per page, read a batch at a time.
+    std::vector<uint64_t> entries(4096);
+    const Addr first = vaddr / page_size;
+    const Addr last = (vaddr + size + page_size - 1) / page_size;
+    for (Addr page = first; page < last; ) {
+        const std::size_t count = std::min<Addr>(entries.size(),
+                                                 last - page);
+        const ssize_t bytes = pread(fd, entries.data(),
+                                    count * sizeof(uint64_t),
+                                    page * sizeof(uint64_t));
+        panic_if(bytes <= 0, "Failed to read %s\n", path);
+        const std::size_t read = bytes / sizeof(uint64_t);
+        for (std::size_t i = 0; i != read; ++i)
+            if ((entries[i] & mask) || (missing && !(entries[i] & presentBit)))
+                f((page + i) * page_size);
+        page += read;
+    }
+    close(fd);
+}
+
+} // anonymous namespace
+
+bool
+supported()
+{
+    // A page just written is always soft-dirty if the kernel tracks them.
+    static const bool result = [] {
+        const long page_size = sysconf(_SC_PAGE_SIZE);
+        auto *page = (volatile char *)mmap(nullptr, page_size,
+                                           PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS,
+                                           -1, 0);
+        if (page == MAP_FAILED)
+            return false;
+        page[0] = 1;
+        bool dirty = false;
+        forEachDirtyPage(0, (Addr)page, page_size, page_size,
+                         [&] (Addr) { dirty = true; });
+        munmap((void *)page, page_size);
+        return dirty;
+    }();
+    return result;
+}
+
+bool
+clear(pid_t pid)
+{
+    const int fd = open(procPath(pid, "clear_refs").c_str(), O_WRONLY);
+    if (fd < 0)
+        return false;
+    const bool ok = write(fd, "4", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+void
+forEachDirtyPage(pid_t pid, Addr vaddr, Addr size, Addr page_size,
+                 const std::function<void(Addr vaddr)> &f)
+{
+    forEachPage(pid, vaddr, size, page_size, softDirtyBit, false, f);
+}
+
+void
+forEachDirtyFilePage(pid_t pid, ino_t ino, Addr vaddr, Addr size,
+                     Addr page_size,
+                     const std::function<void(Addr offset)> &f)
+{
+    const std::string path = procPath(pid, "maps");
+    FILE *maps = std::fopen(path.c_str(), "r");
+    panic_if(!maps, "Can't open %s\n", path);
+
+    const Addr end = vaddr + size;
+    char line[4096];
+    while (std::fgets(line, sizeof line, maps)) {
+        uint64_t map_start, map_end, map_offset, map_ino;
+        if (std::sscanf(line, "%" SCNx64 "-%" SCNx64 " %*s %" SCNx64
+                        " %*s %" SCNu64, &map_start, &map_end, &map_offset,
+                        &map_ino) != 4 || map_ino != ino)
+            continue;
+        const Addr start = std::max<Addr>(map_start, vaddr);
+        const Addr stop = std::min<Addr>(map_end, end);
+        if (start >= stop)
+            continue;
+        // Reclaiming a shared page drops its page table entry, and its
+        // soft-dirty bit with it, so pages that aren't there may have
+        // been written too.
+        forEachPage(pid, start, stop - start, page_size, softDirtyBit, true,
+                    [&] (Addr va) {
+                        f(map_offset + (va - map_start));
+                    });
+    }
+    std::fclose(maps);
+}
+
+} // namespace soft_dirty
+} // namespace gem5
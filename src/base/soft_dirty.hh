@@ -0,0 +1,61 @@
+#ifndef __BASE_SOFT_DIRTY_HH__
+#define __BASE_SOFT_DIRTY_HH__
+
+#include <sys/types.h>
+
+#include <functional>
+
+#include "base/types.hh"
+
+namespace gem5
+{
+
+/**
+ * Linux soft-dirty page tracking: clearing a process' soft-dirty bits
+ * write-protects its pages, and each page's bit is set again when it is
+ * next written. Used to find the pages written since a checkpoint.
+ */
+namespace soft_dirty
+{
+
+/**
+ * Whether the kernel tracks soft-dirty bits (CONFIG_MEM_SOFT_DIRTY).
+ * Without it, clearing them succeeds but no page is ever dirty.
+ */
+bool supported();
+
+/**
+ * Clear a process' soft-dirty bits.
+ *
+ * @param pid The process, or 0 for this one.
+ * @return Whether the bits could be cleared.
+ */
+bool clear(pid_t pid);
+
+/**
+ * Call f with the address of each soft-dirty page in a range of a
+ * process' address space.
+ *
+ * @param pid The process, or 0 for this one.
+ */
+void forEachDirtyPage(pid_t pid, Addr vaddr, Addr size, Addr page_size,
+                      const std::function<void(Addr vaddr)> &f);
+
+/**
+ * Call f with the file offset of each page that a range of a process'
+ * address space maps from a file and that may have been written since
+ * the process' soft-dirty bits were cleared: the soft-dirty pages, and
+ * the pages that aren't present, since the kernel drops a shared page's
+ * soft-dirty bit along with its page table entry when it reclaims it.
+ *
+ * @param pid The process, or 0 for this one.
+ * @param ino The file's inode.
+ */
+void forEachDirtyFilePage(pid_t pid, ino_t ino, Addr vaddr, Addr size,
+                          Addr page_size,
+                          const std::function<void(Addr offset)> &f);
+
+} // namespace soft_dirty
+} // namespace gem5
+
+#endif // __BASE_SOFT_DIRTY_HH__
@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "base/soft_dirty.hh"
+
+using namespace gem5;
+
+namespace
+{
+
+std::vector<Addr>
+dirtyPages(void *mem, Addr size, Addr page_size)
+{
+    std::vector<Addr> pages;
+    soft_dirty::forEachDirtyPage(0, (Addr)mem, size, page_size,
+                                 [&] (Addr vaddr) {
+                                     pages.push_back(vaddr - (Addr)mem);
+                                 });
+    return pages;
+}
+
+} // anonymous namespace
+
+TEST(SoftDirty, WrittenPagesAreDirty)
+{
+    if (!soft_dirty::supported())
+        GTEST_SKIP() << "No soft-dirty support";
+
+    const Addr page_size = sysconf(_SC_PAGE_SIZE);
+    const Addr size = 4 * page_size;
+    auto *mem = (char *)mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_NE(mem, MAP_FAILED);
+    mem[0] = 1;
+    mem[2 * page_size] = 1;
+
+    ASSERT_TRUE(soft_dirty::clear(0));
+    EXPECT_TRUE(dirtyPages(mem, size, page_size).empty());
+
+    mem[2 * page_size + 1] = 2;
+    mem[3 * page_size] = 2;
+    EXPECT_EQ(dirtyPages(mem, size, page_size),
+              (std::vector<Addr>{2 * page_size, 3 * page_size}));
+
+    munmap(mem, size);
+}
@@ -4,6 +4,15 @@ from m5.params import *
 from m5.SimObject import *
 import os
 
+class PinTransport(Enum):
+    vals = ["pipe", "shm"]
+
+class PinMapPolicy(Enum):
+    vals = ["fault", "eager"]
+
+class PinSyscallLogMode(Enum):
+    vals = ["off", "record", "replay"]
+
 class BasePinCPU(BaseCPU):
     type = "BasePinCPU"
     cxx_header = "cpu/pin/cpu.hh"
@@ -11,24 +20,62 @@ class BasePinCPU(BaseCPU):
 
     @classmethod
     def memory_mode(cls):
-        return "atomic"
+        return "atomic_noncaching"
 
     @classmethod
     def support_take_over(cls):
-        return False
+        return True
 
     @cxxMethod
     def executePinCommand(command):
         pass
 
+    # Returns a read-only memoryview of the pintool's result region, which
+    # is only valid until the next command. Use bytes() to keep it.
+    @cxxMethod
+    def executePinCommandView(command):
+        pass
+
+    # Returns the number of targets reached so far.
+    @cxxMethod
+    def targetsReached():
+        pass
+
     pinExe = Param.String(os.path.join(buildEnv["PIN_DIR"], 'pin'), "Path to Intel Pin executable")
     pinKernel = Param.String(buildEnv["PIN_KERNEL"], "Path to guest Pin kernel")
     pinTool = Param.String(buildEnv["PIN_CLIENT"], "Path to host PinTool")
     pinToolArgs = Param.String("", "Arguments to pass to PinTool")
     pinArgs = Param.String("", "Arguments to pass to Pin")
+    transport = Param.PinTransport("shm", "Transport for gem5<->Pin messages (shm: shared-memory rings, pipe: pipes)")
+    transportSpin = Param.Unsigned(1000, "Number of times to poll the shm transport before sleeping on a futex")
+    mapPolicy = Param.PinMapPolicy("fault", "When to map guest memory into Pin (fault: a whole VMA on the first page fault in it, "
+                                   "eager: also each VMA as soon as it's created by mmap, brk or mremap, and the stack as it grows)")
+    eagerMapLimit = Param.MemorySize("64MiB", "Largest region mapped eagerly; bigger ones are mapped on their first fault")
+    syscallLogMode = Param.PinSyscallLogMode("off", "Record syscall results, the memory they write, and CPUID results to "
+                                             "syscallLog, or replay them from it instead of emulating the syscalls "
+                                             "(ones that change the address space, threads or fd table are still emulated, "
+                                             "so files the guest opens must still be there)")
+    syscallLog = Param.String("syscalls.log", "Syscall log path, relative to the output directory "
+                              "(suffixed with the CPU and thread for threads other than thread 0 of CPU 0)")
+    fastSyscalls = VectorParam.String([], "Syscalls that the Pintool may service without returning to gem5 "
+                                      "(getpid, getppid, gettid, getuid, geteuid, getgid, getegid, "
+                                      "clock_gettime, gettimeofday, brk queries, write to fds 0-2)")
+    targetCounter = Param.String("waypoint", "Pintool counter that targets are counts of (inst, or waypoint with "
+                                 "'-waypointcount 1 -waypoints <file>' in pinToolArgs)")
+    targets = VectorParam.UInt64([], "Increasing counts of targetCounter at which thread 0 stops exactly and "
+                                 "the simulation exits with cause 'pin-target'")
+    checkFastSyscalls = Param.Bool(False, "Forward fast syscalls to gem5 anyway and check the Pintool's result")
 
     # FIXME: Remove.
     countInsts = Param.Bool(False, "Enable instruction counting (moderate performance penalty)")
+    inlineInstCount = Param.Bool(False, "Count instructions with inlined register increments, storing the count only "
+                                 "when Pin stops (enables countInsts; the inst counter can't be used for breakpoints or targets)")
+    instCommitStats = Param.Bool(False, "Report instructions executed by Pin in the commit stats (requires countInsts)")
+    maxInstsPerRun = Param.Counter(0, "Maximum number of instructions Pin may execute before returning to gem5 (0: unlimited; enables countInsts)")
+    ipc = Param.Float(0.0, "Instructions per cycle used to advance simulated time after each run "
+                      "(0: advance one cycle per run; otherwise enables countInsts)")
+    threadQuantum = Param.Counter(100000, "Maximum number of instructions a guest thread runs while "
+                                  "others are waiting (used when numThreads > 1)")
     traceInsts = Param.Bool(False, "Enable instruction tracing (huge performance penalty)")
     # FIXME: Remove
     enableBBV = Param.Bool(False, "Enable basic block profiling (e.g., for SimPoints)")
@@ -0,0 +1,243 @@
+#include "cpu/pin/channel.hh"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include "base/logging.hh"
+#include "cpu/pin/ring.h"
+
+long
+pin_ring_futex(uint32_t *uaddr, int op, uint32_t val, void *arg)
+{
+    return static_cast<gem5::pin::ShmChannel *>(arg)->futex(uaddr, op, val);
+}
+
+namespace gem5
+{
+
+namespace pin
+{
+
+namespace
+{
+
+// Let a Pin subprocess inherit fd when it execs Pin.
+void
+clearCloseOnExec(int fd)
+{
+    if (fcntl(fd, F_SETFD, 0) < 0)
+        panic("fcntl F_SETFD failed: %s", std::strerror(errno));
+}
+
+}
+
+PipeChannel::PipeChannel()
+{
+    // TODO: Wrap these as C FILEs, so that we don't have to worry about partial read(2)'s and write(2)'s.
+    int req_fds[2];
+    if (pipe2(req_fds, O_CLOEXEC) < 0)
+        fatal("pipe failed: %s", std::strerror(errno));
+    int resp_fds[2];
+    if (pipe2(resp_fds, O_CLOEXEC) < 0)
+        fatal("pipe failed: %s", std::strerror(errno));
+    reqFd = req_fds[1];
+    respFd = resp_fds[0];
+    remoteReqFd = req_fds[0];
+    remoteRespFd = resp_fds[1];
+}
+
+PipeChannel::~PipeChannel()
+{
+    close(reqFd);
+    close(respFd);
+}
+
+void
+PipeChannel::write(const void *data_, size_t size)
+{
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(data_);
+    while (size > 0) {
+        ssize_t bytes_written;
+        if ((bytes_written = ::write(reqFd, data, size)) < 0)
+            panic("Failed to write message!\n");
+        data += bytes_written;
+        size -= bytes_written;
+    }
+}
+
+void
+PipeChannel::read(void *data_, size_t size)
+{
+    uint8_t *data = reinterpret_cast<uint8_t *>(data_);
+    while (size > 0) {
+        ssize_t bytes_read = ::read(respFd, data, size);
+        if (bytes_read < 0) {
+            panic("read failed: %s\n", std::strerror(errno));
+        } else if (bytes_read == 0) {
+            panic("Pin closed the pipe!\n");
+        }
+        data += bytes_read;
+        size -= bytes_read;
+    }
+}
+
+std::vector<std::string>
+PipeChannel::pinToolArgs() const
+{
+    // TODO: Pass fd's directly to Pintool?
+    return {
+        "-req_path", "/dev/fd/" + std::to_string(remoteReqFd),
+        "-resp_path", "/dev/fd/" + std::to_string(remoteRespFd),
+    };
+}
+
+void
+PipeChannel::forked(pid_t pid)
+{
+    // Close the remote end of the pipes; it will remain open in the Pin subprocess.
+    close(remoteReqFd);
+    close(remoteRespFd);
+    remoteReqFd = remoteRespFd = -1;
+}
+
+void
+PipeChannel::inherit() const
+{
+    clearCloseOnExec(remoteReqFd);
+    clearCloseOnExec(remoteRespFd);
+}
+
+ShmChannel::ShmChannel(unsigned spin)
+{
+    fd = memfd_create("pin-channel", MFD_CLOEXEC);
+    if (fd < 0)
+        fatal("memfd_create failed: %s", std::strerror(errno));
+    if (ftruncate(fd, sizeof *shared) < 0)
+        fatal("ftruncate failed: %s", std::strerror(errno));
+    void *p = mmap(nullptr, sizeof *shared, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        fatal("mmap failed: %s", std::strerror(errno));
+    shared = static_cast<PinChannelShared *>(p);
+    shared->spin = spin;
+}
+
+ShmChannel::~ShmChannel()
+{
+    munmap(shared, sizeof *shared);
+    close(fd);
+}
+
+void
+ShmChannel::write(const void *data, size_t size)
+{
+    pin_ring_write(&shared->req, data, size, shared->spin, this);
+}
+
+void
+ShmChannel::read(void *data, size_t size)
+{
+    pin_ring_read(&shared->resp, data, size, shared->spin, this);
+}
+
+std::vector<std::string>
+ShmChannel::pinToolArgs() const
+{
+    return {"-chan_path", "/dev/fd/" + std::to_string(fd)};
+}
+
+void
+ShmChannel::forked(pid_t pid)
+{
+    pinPid = pid;
+}
+
+void
+ShmChannel::inherit() const
+{
+    clearCloseOnExec(fd);
+}
+
+long
+ShmChannel::futex(uint32_t *uaddr, int op, uint32_t val)
+{
+    if (op == PIN_RING_FUTEX_WAKE)
+        return syscall(SYS_futex, uaddr, FUTEX_WAKE, val, nullptr, nullptr, 0);
+
+    assert(op == PIN_RING_FUTEX_WAIT);
+    struct timespec timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = 100 * 1000 * 1000;
+    const long result = syscall(SYS_futex, uaddr, FUTEX_WAIT, val, &timeout,
+                                nullptr, 0);
+    if (result < 0 && errno == ETIMEDOUT && pinPid >= 0) {
+        // Make sure we're not waiting on a dead process.
+        int status;
+        panic_if(waitpid(pinPid, &status, WNOHANG) == pinPid,
+                 "Pin exited unexpectedly (status %#x)!\n", status);
+    }
+    return result;
+}
+
+ResultRegion::ResultRegion()
+{
+    // Close-on-exec, so that other threads' Pin processes don't inherit
+    // it; the one it's for does (see inherit()).
+    fd = memfd_create("pin-result", MFD_CLOEXEC);
+    if (fd < 0)
+        fatal("memfd_create failed: %s", std::strerror(errno));
+}
+
+ResultRegion::~ResultRegion()
+{
+    if (data)
+        munmap(data, mappedSize);
+    close(fd);
+}
+
+std::vector<std::string>
+ResultRegion::pinToolArgs() const
+{
+    return {"-result_path", "/dev/fd/" + std::to_string(fd)};
+}
+
+void
+ResultRegion::inherit() const
+{
+    clearCloseOnExec(fd);
+}
+
+std::string_view
+ResultRegion::view(size_t size)
+{
+    if (size == 0)
+        return {};
+    if (size > mappedSize) {
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+            panic("fstat failed: %s", std::strerror(errno));
+        panic_if(static_cast<size_t>(st.st_size) < size,
+                 "Pin command result (%d bytes) overruns the result region "
+                 "(%d bytes)!\n", size, st.st_size);
+        if (data)
+            munmap(data, mappedSize);
+        mappedSize = st.st_size;
+        data = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            panic("mmap failed: %s", std::strerror(errno));
+    }
+    return {static_cast<const char *>(data), size};
+}
+
+}
+}
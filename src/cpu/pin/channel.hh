@@ -0,0 +1,130 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct PinChannelShared;
+
+namespace gem5
+{
+
+namespace pin
+{
+
+struct Message;
+
+/// Sees each message sent or received over a channel (e.g., for stats).
+class ChannelObserver
+{
+  public:
+    virtual ~ChannelObserver() = default;
+
+    virtual void sent(const Message &msg) = 0;
+    virtual void received(const Message &msg) = 0;
+};
+
+/**
+ * Bidirectional byte stream between gem5 and the Pin kernel. Requests are
+ * written by gem5 and read by the kernel; responses go the other way.
+ */
+class Channel
+{
+  public:
+    virtual ~Channel() = default;
+
+    virtual void write(const void *data, size_t size) = 0;
+    virtual void read(void *data, size_t size) = 0;
+
+    /// Pintool arguments telling the kernel how to connect to this channel.
+    virtual std::vector<std::string> pinToolArgs() const = 0;
+
+    /// Called in gem5 after the Pin subprocess has been forked.
+    virtual void forked(pid_t pid) = 0;
+
+    /// Called in the Pin subprocess before it execs Pin, so that Pin
+    /// inherits the channel. Its fds are close-on-exec otherwise, so that
+    /// other Pin processes don't.
+    virtual void inherit() const = 0;
+
+    ChannelObserver *observer = nullptr;
+};
+
+/// Original transport: a pair of pipes.
+class PipeChannel final : public Channel
+{
+  public:
+    PipeChannel();
+    ~PipeChannel() override;
+
+    void write(const void *data, size_t size) override;
+    void read(void *data, size_t size) override;
+    std::vector<std::string> pinToolArgs() const override;
+    void forked(pid_t pid) override;
+    void inherit() const override;
+
+  private:
+    int reqFd = -1;
+    int respFd = -1;
+    int remoteReqFd = -1;
+    int remoteRespFd = -1;
+};
+
+/// Shared-memory SPSC request/response rings with futex wakeups.
+class ShmChannel final : public Channel
+{
+  public:
+    ShmChannel(unsigned spin);
+    ~ShmChannel() override;
+
+    void write(const void *data, size_t size) override;
+    void read(void *data, size_t size) override;
+    std::vector<std::string> pinToolArgs() const override;
+    void forked(pid_t pid) override;
+    void inherit() const override;
+
+    /// Futex wait/wake; wait times out periodically to check that Pin is
+    /// still alive.
+    long futex(uint32_t *uaddr, int op, uint32_t val);
+
+  private:
+    int fd = -1;
+    PinChannelShared *shared = nullptr;
+    pid_t pinPid = -1;
+};
+
+/**
+ * Shared-memory region that the pintool copies command results into, so
+ * that large results (e.g., plugin dumps) don't have to be streamed through
+ * the Pin kernel and the channel. Like the physmem backing store, it's a
+ * file that Pin opens by path; the pintool grows it as needed.
+ */
+class ResultRegion
+{
+  public:
+    ResultRegion();
+    ~ResultRegion();
+
+    /// Pintool arguments telling the pintool where the region is.
+    std::vector<std::string> pinToolArgs() const;
+
+    /// Called in the Pin subprocess before it execs Pin, so that Pin
+    /// inherits the region.
+    void inherit() const;
+
+    /// The first size bytes of the region, remapping it if the pintool has
+    /// grown it. Valid until the next call.
+    std::string_view view(size_t size);
+
+  private:
+    int fd = -1;
+    void *data = nullptr;
+    size_t mappedSize = 0;
+};
+
+}
+}
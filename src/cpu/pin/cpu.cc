@@ -1,17 +1,26 @@
 #include "cpu/pin/cpu.hh"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
 #include <sys/wait.h>
 #include <cerrno>
 #include <cstring>
 #include <sys/socket.h>
 #include <sys/times.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cpu/simple_thread.hh"
 #include "params/BasePinCPU.hh"
+#include "cpu/pin/channel.hh"
 #include "cpu/pin/message.hh"
+#include "cpu/pin/syscall_log.hh"
 #include "debug/Pin.hh"
 #include "sim/system.hh"
 #include "arch/x86/regs/int.hh"
@@ -21,8 +30,14 @@
 #include "arch/x86/utility.hh"
 #include "cpu/pin/regfile.h"
 #include "base/loader/symtab.hh"
+#include "base/soft_dirty.hh"
 #include "base/output.hh"
 #include "sim/sim_exit.hh"
+#include "mem/se_translating_port_proxy.hh"
+#include "sim/core.hh"
+#include "sim/cur_tick.hh"
+#include "sim/fd_entry.hh"
+#include "sim/process.hh"
 #include "arch/x86/utility.hh"
 
 namespace gem5
@@ -31,6 +46,73 @@ namespace gem5
 namespace pin
 {
 
+namespace
+{
+
+/**
+ * A thread context that can capture the physical memory writes made
+ * through it, i.e., by syscall emulation, for the syscall log.
+ */
+class LoggingThread final : public SimpleThread
+{
+  public:
+    using SimpleThread::SimpleThread;
+
+    // (paddr, data) of each write, while capturing.
+    std::vector<std::pair<Addr, std::vector<uint8_t>>> *writes = nullptr;
+
+    void
+    sendFunctional(PacketPtr pkt) override
+    {
+        if (writes && pkt->isWrite()) {
+            const uint8_t *data = pkt->getConstPtr<uint8_t>();
+            writes->emplace_back(pkt->getAddr(), std::vector<uint8_t>(
+                                     data, data + pkt->getSize()));
+        }
+        SimpleThread::sendFunctional(pkt);
+    }
+};
+
+// Syscalls that change the address space, the threads, the fd table, or
+// other state of gem5's that the guest can't see directly, so they're
+// emulated even when replaying (x86-64 numbers). Emulating the fd table
+// gives file-backed mmaps a real file.
+bool
+emulatedOnReplay(uint64_t num)
+{
+    switch (num) {
+      case 2: // open
+      case 3: // close
+      case 9: // mmap
+      case 10: // mprotect
+      case 11: // munmap
+      case 12: // brk
+      case 22: // pipe
+      case 25: // mremap
+      case 32: // dup
+      case 33: // dup2
+      case 56: // clone
+      case 57: // fork
+      case 58: // vfork
+      case 59: // execve
+      case 60: // exit
+      case 61: // wait4
+      case 158: // arch_prctl
+      case 202: // futex
+      case 218: // set_tid_address
+      case 231: // exit_group
+      case 257: // openat
+      case 292: // dup3
+      case 293: // pipe2
+      case 435: // clone3
+        return true;
+      default:
+        return false;
+    }
+}
+
+}
+
 static std::vector<std::string_view>
 split_by_spaces(std::string_view str)
 {
@@ -65,27 +147,60 @@ CPU::CPU(const BasePinCPUParams &params)
     : BaseCPU(params),
       tickEvent([this] { tick(); }, "BasePinCPU tick", false, Event::CPU_Tick_Pri),
       _status(Idle),
+      remoteEvent([this] { serviceRemoteRequests(); },
+                  "BasePinCPU remote requests"),
       dataPort(name() + ".dcache_port", this),
       instPort(name() + ".icache_port", this),
       pinExe(params.pinExe),
       pinKernel(params.pinKernel),
       pinTool(params.pinTool),
-      pinPid(-1),
+      transport(params.transport),
+      transportSpin(params.transportSpin),
+      mapPolicy(params.mapPolicy),
+      eagerMapLimit(params.eagerMapLimit),
+      syscallLogMode(params.syscallLogMode),
+      syscallLogPath(params.syscallLog),
       system(params.system),
+      fastSyscalls(params.fastSyscalls),
+      checkFastSyscalls(params.checkFastSyscalls),
+      targetCounter(params.targetCounter),
+      targets(params.targets),
       traceInsts(params.traceInsts),
+      inlineInstCount(params.inlineInstCount),
+      instCommitStats(params.instCommitStats),
+      maxInstsPerRun(params.maxInstsPerRun),
+      ipc(params.ipc),
+      threadQuantum(params.threadQuantum),
       enableBBV(params.enableBBV),
-      interval(params.interval)
+      interval(params.interval),
+      stats(this),
+      messageStats(stats)
 {
-    thread = std::make_unique<SimpleThread>(
-        this, /*thread_num*/0, params.system,
-        params.workload[0], params.mmu,
-        params.isa[0], params.decoder[0]);
-    thread->setStatus(ThreadContext::Halted);
-    tc = thread->getTC();
-    threadContexts.push_back(tc);
-
-    if (params.countInsts)
-        ctrInsts = 0;
+    // Bounding runs, timing by instructions, and time-slicing threads all
+    // need the count.
+    countInsts = params.countInsts || inlineInstCount || maxInstsPerRun ||
+        ipc > 0 || numThreads > 1 ||
+        (!targets.empty() && targetCounter == "inst");
+    fatal_if(instCommitStats && !countInsts,
+             "instCommitStats requires countInsts\n");
+    fatal_if(inlineInstCount && !targets.empty() && targetCounter == "inst",
+             "Pin: targets can't use the inst counter with inlineInstCount\n");
+    fatal_if(numThreads > 1 && threadQuantum == 0,
+             "Pin: threadQuantum must be non-zero with multiple threads\n");
+
+    threads.resize(numThreads);
+    for (ThreadID tid = 0; tid < numThreads; ++tid) {
+        PinThread &t = threads[tid];
+        t.thread = std::make_unique<LoggingThread>(
+            this, tid, params.system,
+            params.workload[tid], params.mmu,
+            params.isa[tid], params.decoder[tid]);
+        t.thread->setStatus(ThreadContext::Halted);
+        t.tc = t.thread->getTC();
+        threadContexts.push_back(t.tc);
+        if (countInsts)
+            t.ctrInsts = 0;
+    }
 
     // Parse PinTool arguments.
     for (std::string_view sv : split_by_spaces(params.pinArgs))
@@ -94,22 +209,153 @@ CPU::CPU(const BasePinCPUParams &params)
         pinToolArgs.emplace_back(sv);
 }
 
+CPU::~CPU()
+{
+}
+
+CPU::StatGroup::StatGroup(statistics::Group *parent)
+    : statistics::Group(parent, "pin"),
+    ADD_STAT(numStops, statistics::units::Count::get(),
+             "number of times Pin stopped and returned to gem5"),
+    ADD_STAT(regBytesToPin, statistics::units::Byte::get(),
+             "bytes of register state sent to Pin"),
+    ADD_STAT(regBytesFromPin, statistics::units::Byte::get(),
+             "bytes of register state received from Pin"),
+    ADD_STAT(regBytesPerStop, statistics::units::Rate<
+                statistics::units::Byte, statistics::units::Count>::get(),
+             "bytes of register state transferred per stop",
+             (regBytesToPin + regBytesFromPin) / numStops),
+    ADD_STAT(fastSyscallChecks, statistics::units::Count::get(),
+             "number of fast-path syscall results checked against gem5"),
+    ADD_STAT(pageFaults, statistics::units::Count::get(),
+             "number of page faults Pin returned to gem5"),
+    ADD_STAT(avoidedFaults, statistics::units::Count::get(),
+             "number of regions mapped eagerly, before Pin could fault on "
+             "them"),
+    ADD_STAT(eagerMappedBytes, statistics::units::Byte::get(),
+             "bytes of guest memory mapped eagerly"),
+    ADD_STAT(stopReasons, statistics::units::Count::get(),
+             "number of times Pin stopped, by reason"),
+    ADD_STAT(syscalls, statistics::units::Count::get(),
+             "syscalls Pin returned to gem5 for, by number"),
+    ADD_STAT(commands, statistics::units::Count::get(),
+             "number of pintool commands executed"),
+    ADD_STAT(pinNs, statistics::units::Count::get(),
+             "host nanoseconds spent in Pin per run"),
+    ADD_STAT(roundTripNs, statistics::units::Count::get(),
+             "host nanoseconds per request/response exchange with Pin, "
+             "other than runs"),
+    ADD_STAT(handlerNs, statistics::units::Count::get(),
+             "host nanoseconds spent in gem5 handling each stop"),
+    ADD_STAT(bytesToPin, statistics::units::Byte::get(),
+             "bytes sent to Pin, by message type"),
+    ADD_STAT(bytesFromPin, statistics::units::Byte::get(),
+             "bytes received from Pin, by message type")
+{
+    stopReasons.init(NumStopReasons);
+    stopReasons.subname(StopPageFault, "pageFault");
+    stopReasons.subname(StopSyscall, "syscall");
+    stopReasons.subname(StopCpuid, "cpuid");
+    stopReasons.subname(StopBreak, "break");
+    stopReasons.subname(StopInstBudget, "instBudget");
+    stopReasons.subname(StopOther, "other");
+    // Kept alongside stopReasons for existing scripts.
+    pageFaults = stopReasons[StopPageFault];
+
+    syscalls.init(0);
+
+    pinNs.init(32);
+    roundTripNs.init(32);
+    handlerNs.init(32);
+
+    bytesToPin.init(Message::NumTypes).flags(statistics::nozero);
+    bytesFromPin.init(Message::NumTypes).flags(statistics::nozero);
+    for (int i = 0; i < Message::NumTypes; ++i) {
+        const char *name = messageTypeName(static_cast<Message::Type>(i));
+        bytesToPin.subname(i, name);
+        bytesFromPin.subname(i, name);
+    }
+}
+
+namespace
+{
+
+uint64_t
+hostNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+void
+CPU::MessageStats::sent(const Message &msg)
+{
+    stats.bytesToPin[msg.type] += PINMSG_HEADER_SIZE + msg.size;
+    lastSentRun = msg.type == Message::Run;
+    lastSentNs = hostNs();
+}
+
+void
+CPU::MessageStats::received(const Message &msg)
+{
+    const uint64_t ns = hostNs() - lastSentNs;
+    if (lastSentRun)
+        stats.pinNs.sample(ns);
+    else
+        stats.roundTripNs.sample(ns);
+    if (msg.type < Message::NumTypes)
+        stats.bytesFromPin[msg.type] += PINMSG_HEADER_SIZE + msg.size;
+}
+
+void
+CPU::haltContext(ThreadID tid)
+{
+    // We may be called from another CPU's syscall (e.g., exit_group).
+    if (curEventQueue() != eventQueue()) {
+        requestFromOtherQueue(tid, true);
+        return;
+    }
+
+    BaseCPU::haltContext(tid);
+
+    // If we're running, tick() shuts down the thread's Pin process, since
+    // it may be in the middle of servicing a request from it.
+    PinThread &t = threads[tid];
+    if (_status == Idle && isPinRunning(t))
+        stopPin(t);
+}
+
 void
-CPU::haltContext()
+CPU::stopPin(PinThread &t)
 {
-    DPRINTF(Pin, "Halting Pin process\n");
+    DPRINTF(Pin, "Halting Pin process for thread %d\n",
+            t.tc->threadId());
     // Tell Pin to exit.
-    assert(pinPid >= 0 && reqFd >= 0 && respFd >= 0);
+    assert(isPinRunning(t));
+
+    {
+        // The physical memory's dirty pages are shared with other CPUs.
+        EventQueue::ScopedMigration migrate(serviceEventQueue());
+        collectDirtyPages(t, 0, MaxAddr);
+    }
 
     Message msg;
     msg.type = Message::Exit;
-    msg.send(reqFd);
+    msg.send(*t.chan);
     
-    close(reqFd);
-    close(respFd);
+    t.chan.reset();
+    t.results.reset();
+    t.resultBuf.clear();
 
-    if (waitpid(pinPid, nullptr, 0) < 0)
+    if (waitpid(t.pinPid, nullptr, 0) < 0)
         panic("waitpid failed!\n");
+    {
+        EventQueue::ScopedMigration migrate(serviceEventQueue());
+        t.mappingListener.reset();
+        t.pinPid = -1;
+    }
 
     // Dump times.
     struct tms tms;
@@ -156,7 +402,10 @@ CPU::wakeup(ThreadID tid)
 Counter
 CPU::totalInsts() const
 {
-    return ctrInsts ? *ctrInsts : 0;
+    Counter total = 0;
+    for (const PinThread &t : threads)
+        total += t.ctrInsts.value_or(0);
+    return total;
 }
 
 Counter
@@ -190,22 +439,6 @@ CPU::getPinTool() const
     return pinTool;
 }
 
-const char *
-CPU::getRequestPath()
-{
-    const char *req_path = std::getenv("PIN_REQ");
-    fatal_if(req_path == nullptr, "environment variable PIN_REQ not set!");
-    return req_path;
-}
-
-const char *
-CPU::getResponsePath()
-{
-    const char *resp_path = std::getenv("PIN_RESP");
-    fatal_if(resp_path == nullptr, "environment variable PIN_RESP not set!");
-    return resp_path;
-}
-
 const std::string&
 CPU::getDummyProg() const
 {
@@ -216,7 +449,6 @@ void
 CPU::init()
 {
     BaseCPU::init();
-    fatal_if(numThreads != 1, "Pin: Multithreading not supported");
     warn("Pin::CPU::init not complete\n");
 }
 
@@ -225,27 +457,89 @@ CPU::startup()
 {
     BaseCPU::startup();
 
-    // TODO: Remove this crap. unused i think.
-    tc->simcall_info.type = ThreadContext::SimcallInfo::INVALID; // TODO: This is definitely not the appropriate place for this.
-
-    // Create pipes for bidirectional communication.
-    // TODO: Wrap these as C FILEs, so that we don't have to worry about partial read(2)'s and write(2)'s.
-    int req_fds[2];
-    if (pipe(req_fds) < 0)
-        fatal("pipe failed: %s", std::strerror(errno));
-    int resp_fds[2];
-    if (pipe(resp_fds) < 0)
-        fatal("pipe failed: %s", std::strerror(errno));
-    reqFd = req_fds[1];
-    respFd = resp_fds[0];
-    const int remote_req_fd = req_fds[0];
-    const int remote_resp_fd = resp_fds[1];
-
-    // TODO: Pass fd's directly to Pintool?
-    char req_path[32];
-    std::sprintf(req_path, "/dev/fd/%d", remote_req_fd);
-    char resp_path[32];
-    std::sprintf(resp_path, "/dev/fd/%d", remote_resp_fd);
+    for (PinThread &t : threads) {
+        // TODO: Remove this crap. unused i think.
+        t.tc->simcall_info.type = ThreadContext::SimcallInfo::INVALID; // TODO: This is definitely not the appropriate place for this.
+    }
+
+    // Record the entries of guest fds 0-2, so that we can tell when the
+    // guest closes or redirects them. Host fd numbers get reused.
+    if (!fastSyscalls.empty()) {
+        auto &fds = *threads[0].tc->getProcessPtr()->fds;
+        for (int i = 0; i < PIN_SYSCALL_STATE_FDS && i < fds.getSize(); ++i)
+            if (std::dynamic_pointer_cast<HBFDEntry>(fds[i]))
+                fastSyscallFdEntries[i] = fds[i];
+    }
+
+    // Other threads get their Pin processes when they are first run, as
+    // does everything if we start out switched out.
+    if (!switchedOut())
+        startPin(threads[0]);
+}
+
+void
+CPU::startPin(PinThread &t)
+{
+    const ThreadID tid = t.tc->threadId();
+    DPRINTF(Pin, "Starting Pin process for thread %d\n", tid);
+
+    // Pin starts out with none of our state.
+    t.pinRegs = {};
+    t.pulledRegs = 0;
+    t.dirtyRegs = PINREG_ALL;
+    t.syscallStateValid = false;
+    t.pinInsts = 0;
+    {
+        // Other CPUs' syscalls notify the address space's listeners, which
+        // fill in the pending maps.
+        EventQueue::ScopedMigration migrate(serviceEventQueue());
+        t.pendingUnmaps.clear();
+        t.pendingMaps.clear();
+        t.pinMappings.clear();
+        t.mappingListener = std::make_unique<MappingListener>(
+            t.pendingUnmaps,
+            mapPolicy == enums::PinMapPolicy::eager ? &t.pendingMaps : nullptr,
+            t.tc->getProcessPtr()->memState);
+    }
+
+    memory::PhysicalMemory &physmem = system->getPhysMem();
+    if (physmem.trackingDirtyPages()) {
+        // collectDirtyPages() finds the backing store in Pin's mappings.
+        struct stat st;
+        if (fstat(physmem.getBackingStore()[0].shmFd, &st) < 0)
+            panic("fstat failed on the shared backing store\n");
+        backingStoreIno = st.st_ino;
+    }
+
+    // Create the channel for bidirectional communication.
+    switch (transport) {
+      case enums::PinTransport::pipe:
+        t.chan = std::make_unique<PipeChannel>();
+        break;
+      case enums::PinTransport::shm:
+        t.chan = std::make_unique<ShmChannel>(transportSpin);
+        break;
+      default:
+        panic("unhandled Pin transport (%d)\n", transport);
+    }
+    t.chan->observer = &messageStats;
+    std::vector<std::string> chan_args = t.chan->pinToolArgs();
+    t.results = std::make_unique<ResultRegion>();
+    for (const std::string &arg : t.results->pinToolArgs())
+        chan_args.push_back(arg);
+
+    // Thread 0 of CPU 0 keeps the unsuffixed output file names.
+    const int cpu_id = cpuId();
+    const auto out_path = [cpu_id, tid] (const std::string &base,
+                                         const std::string &ext) {
+        std::string name = base;
+        if (cpu_id != 0)
+            name += csprintf(".cpu%d", cpu_id);
+        if (tid != 0)
+            name += csprintf(".%d", tid);
+        return simout.resolve(name + "." + ext);
+    };
+
     const std::string pin_tool = getPinTool();
     const std::string pin_exe = getPinExe();
     const std::string dummy_prog = getDummyProg();
@@ -265,27 +559,39 @@ CPU::startup()
     if (fcntl(shm_fd, F_SETFD, shm_fd_flags) < 0)
         fatal("fcntl FD_SETFD failed");
 
-    pinPid = fork();
-    if (pinPid < 0) {
+    // Give Pin its own copies of the host fds backing guest fds 0-2, since
+    // it redirects its stdout and stderr below.
+    for (int i = 0; i < PIN_SYSCALL_STATE_FDS; ++i) {
+        t.fastSyscallPinFds[i] = -1;
+        auto hbfdp = std::dynamic_pointer_cast<HBFDEntry>(
+            fastSyscallFdEntries[i]);
+        if (hbfdp && (t.fastSyscallPinFds[i] = dup(hbfdp->getSimFD())) < 0)
+            fatal("dup failed: %s", std::strerror(errno));
+    }
+
+    t.pinPid = fork();
+    if (t.pinPid < 0) {
         fatal("fork: %s", std::strerror(errno));
-    } else if (pinPid == 0) {
+    } else if (t.pinPid == 0) {
         // Create log file for this fucking mess.
         // It will be for the kernel.
-        const std::string kernout_path = simout.resolve("kernout.txt");
+        const std::string kernout_path = out_path("kernout", "txt");
         const int kernout_fd = open(kernout_path.c_str(), O_WRONLY | O_APPEND | O_TRUNC | O_CREAT, 0664);
         if (kernout_fd < 0)
             panic("Failed to create kernel.log\n");
         if (dup2(kernout_fd, STDOUT_FILENO) < 0)
             panic("dup2 failed\n");
 
-        const std::string kernerr_path = simout.resolve("kernerr.txt");
+        const std::string kernerr_path = out_path("kernerr", "txt");
         const int kernerr_fd = open(kernerr_path.c_str(), O_WRONLY | O_APPEND | O_TRUNC | O_CREAT, 0664);
         if (kernerr_fd < 0)
             panic("Failed to create kernerr.txt");
         if (dup2(kernerr_fd, STDERR_FILENO) < 0)
             panic("dup2 failed\n");
 
-        
+        t.chan->inherit();
+        t.results->inherit();
+
         // This is the Pin subprocess. Execute pin.
         std::vector<std::string> args;
         auto it = std::back_inserter(args);
@@ -307,11 +613,18 @@ CPU::startup()
         *it++ = "-t"; *it++ = pin_tool;
 
         // Pintool args.
-        *it++ = "-log"; *it++ = simout.resolve("pin.log");
-        *it++ = "-req_path"; *it++ = req_path;
-        *it++ = "-resp_path"; *it++ = resp_path;
+        *it++ = "-log"; *it++ = out_path("pin", "log");
+        it = std::copy(chan_args.begin(), chan_args.end(), it);
         *it++ = "-mem_path"; *it++ = shm_path;
-        *it++ = "-instcount"; *it++ = ctrInsts ? "1" : "0";
+        *it++ = "-instcount"; *it++ = countInsts ? "1" : "0";
+        *it++ = "-instcount-inline"; *it++ = inlineInstCount ? "1" : "0";
+        if (!fastSyscalls.empty()) {
+            std::string fast_syscalls;
+            for (const std::string &name : fastSyscalls)
+                fast_syscalls += (fast_syscalls.empty() ? "" : ",") + name;
+            *it++ = "-fast_syscalls"; *it++ = fast_syscalls;
+            *it++ = "-check_fast_syscalls"; *it++ = checkFastSyscalls ? "1" : "0";
+        }
 
         // Custom Pintool args.
         it = std::copy(pinToolArgs.begin(), pinToolArgs.end(), it);
@@ -335,33 +648,73 @@ CPU::startup()
         fatal("execvp failed: %s: %s", args_c[0], std::strerror(errno));
     }
 
-    // Close the remote end of the socket; it will remain open in the Pin subprocess.
-    close(req_fds[0]); // Close read-end of request pipe.
-    close(resp_fds[1]); // Close write-end of response pipe.
+    t.chan->forked(t.pinPid);
+    for (int fd : t.fastSyscallPinFds)
+        if (fd >= 0)
+            close(fd);
     
     // Send initial ACK.
     Message msg;
     msg.type = Message::Ack;
     DPRINTF(Pin, "Sending initial ACK\n");
-    msg.send(reqFd);
+    msg.send(*t.chan);
     DPRINTF(Pin, "Receiving initial ACK\n");
-    msg.recv(respFd);
+    msg.recv(*t.chan);
     panic_if(msg.type != Message::Ack, "Received message other than ACK at pintool startup!\n");
     DPRINTF(Pin, "received ACK from pintool\n");
 
     // Copy over initial state.
-    syncStateToPin(true);
+    syncStateToPin(t);
+
+    // Map in code. Everything else, including after restoring from a
+    // checkpoint, is mapped in on demand as Pin faults on it.
+    mapCode(t);
 
-    // Map in code.
-    mapCode();
+    if (!t.pinState.empty())
+        loadPinState(t);
+
+    if (&t == &threads[0] && !targets.empty() && !targetsArmed)
+        armTargets(t);
 }
 
 void
-CPU::mapCode()
+CPU::armTargets(PinThread &t)
 {
+    targetsArmed = true;
+
+    // A checkpoint taken with targets carries the pending ones.
+    std::istringstream ss{std::string(runPinCommand(t, "targets"))};
+    uint64_t pending = 0;
+    ss >> _targetsReached >> pending;
+    if (_targetsReached || pending)
+        return;
+
+    for (uint64_t target : targets)
+        runPinCommand(t, csprintf("target %s %d", targetCounter, target));
+}
+
+bool
+CPU::reachedTarget(PinThread &t)
+{
+    if (!targetsArmed)
+        return false;
+    std::istringstream ss{std::string(runPinCommand(t, "targets"))};
+    uint64_t reached = 0;
+    ss >> reached;
+    if (reached == _targetsReached)
+        return false;
+    _targetsReached = reached;
+    return true;
+}
+
+void
+CPU::mapCode(PinThread &t)
+{
+    ThreadContext *tc = t.tc;
     const Addr min = tc->getProcessPtr()->image.minAddr();
     const Addr max = tc->getProcessPtr()->image.maxAddr();
     const TranslationGenPtr ptr = tc->getMMUPtr()->translateFunctional(min, max - min, tc, BaseMMU::Execute, 0);
+    MessageBatch batch(*t.chan);
     for (TranslationGenConstIterator it = ptr->begin(); it != ptr->end(); ++it) {
         const TranslationGen::Range &range = *it;
         if (range.fault != NoFault) {
@@ -370,47 +723,162 @@ CPU::mapCode()
         }
         DPRINTF(Pin, "Mapping in code range vaddr=%#x paddr=%#x size=%#x\n",
                 range.vaddr, range.paddr, range.size);
-        Message msg;
-        msg.type = Message::Map;
-        msg.map.vaddr = range.vaddr;
-        msg.map.paddr = range.paddr;
-        msg.map.size = range.size;
-        msg.map.prot = PROT_READ | PROT_EXEC;
-        msg.send(reqFd);
-        msg.recv(respFd);
-        panic_if(msg.type != Message::Ack, "unexpected response\n");
+        batch.map(range.vaddr, range.paddr, range.size,
+                  PROT_READ | PROT_EXEC);
+        trackPinMapping(t, range.vaddr, range.size, true);
+    }
+    batch.flush();
+}
+
+std::string
+CPU::savePinState(PinThread &t)
+{
+    Message msg;
+    msg.type = Message::SaveState;
+    msg.send(*t.chan);
+    return std::string(recvCommandResult(t));
+}
+
+std::string_view
+CPU::recvCommandResult(PinThread &t)
+{
+    Message msg;
+    msg.recv(*t.chan);
+    switch (msg.type) {
+      case Message::CommandResultShared:
+        return t.results->view(msg.command_result_size);
+      case Message::CommandResult:
+        t.resultBuf.resize(msg.command_result_size);
+        t.chan->read(t.resultBuf.data(), t.resultBuf.size());
+        stats.bytesFromPin[Message::CommandResult] += t.resultBuf.size();
+        return t.resultBuf;
+      default:
+        panic("Received message other than CommandResult!\n");
     }
 }
 
+void
+CPU::loadPinState(PinThread &t)
+{
+    DPRINTF(Pin, "Loading %d bytes of Pin state for thread %d\n",
+            t.pinState.size(), t.tc->threadId());
+    Message msg;
+    msg.type = Message::LoadState;
+    msg.state_size = t.pinState.size();
+    msg.send(*t.chan);
+    t.chan->write(t.pinState.data(), t.pinState.size());
+    stats.bytesToPin[Message::LoadState] += t.pinState.size();
+    msg.recv(*t.chan);
+    panic_if(msg.type != Message::Ack, "Got message other than ACK for LoadState!\n");
+
+    // The pintool's instruction count picks up where it left off.
+    t.pinInsts = t.pinStateInsts;
+    t.pinState.clear();
+}
+
 void
 CPU::activateContext(ThreadID tid)
 {
-    assert(tid == 0);
-    assert(thread);
+    assert(tid < numThreads);
+    assert(threads[tid].thread);
+
+    // We may be called from another CPU's syscall (e.g., futex wake).
+    if (curEventQueue() != eventQueue()) {
+        requestFromOtherQueue(tid, false);
+        return;
+    }
 
-    schedule(tickEvent, clockEdge(Cycles(0)));
-    _status = Running;
+    // If we're running, the next tick picks the thread up.
+    if (_status == Idle) {
+        schedule(tickEvent, clockEdge(Cycles(0)));
+        _status = Running;
+    }
 }
 
 void
-CPU::tick()
+CPU::requestFromOtherQueue(ThreadID tid, bool halt)
 {
-    Tick delay = 0;
+    std::lock_guard<std::mutex> lock(remoteMutex);
+    remoteRequests.emplace_back(tid, halt);
+    if (!remotePending) {
+        remotePending = true;
+        // Our queue may be up to a quantum ahead of the caller's.
+        eventQueue()->schedule(&remoteEvent, curTick() + simQuantum);
+    }
+}
 
+void
+CPU::serviceRemoteRequests()
+{
+    std::vector<std::pair<ThreadID, bool>> requests;
+    {
+        std::lock_guard<std::mutex> lock(remoteMutex);
+        std::swap(requests, remoteRequests);
+        remotePending = false;
+    }
+    for (const auto &[tid, halt] : requests) {
+        if (halt)
+            haltContext(tid);
+        else
+            activateContext(tid);
+    }
+}
+
+ThreadID
+CPU::nextActiveThread() const
+{
+    for (ThreadID i = 1; i <= numThreads; ++i) {
+        const ThreadID tid = (curThread + i) % numThreads;
+        if (threads[tid].tc->status() == ThreadContext::Active)
+            return tid;
+    }
+    return InvalidThreadID;
+}
+
+void
+CPU::tick()
+{
     assert(_status != Idle);
     assert(_status == Running);
 
-    pinRun(); // TODO: Will need to communicate how many ticks required.
+    // Round-robin between the active threads. Threads that are suspended
+    // (e.g., in futex) or halted keep their Pin process idle.
+    Cycles delay(1);
+    const ThreadID tid = nextActiveThread();
+    if (tid != InvalidThreadID) {
+        curThread = tid;
+        PinThread &t = threads[tid];
+        if (!isPinRunning(t))
+            startPin(t);
+
+        const Counter insts = pinRun(t);
+
+        // Advance time in proportion to the instructions executed.
+        if (ipc > 0)
+            delay = Cycles(std::max<Counter>(1, std::ceil(insts / ipc)));
+        baseStats.numCycles += delay;
+
+        // Service instruction-count events (e.g., max_insts). We bounded
+        // the run so that Pin stops exactly at the next one.
+        if (t.ctrInsts)
+            t.thread->comInstEventQueue.serviceEvents(
+                *t.ctrInsts - t.instEventBase);
+    }
 
-    if (tc->status() == ThreadContext::Halting ||
-        tc->status() == ThreadContext::Halted) {
-        haltContext();
+    // Shut down the Pin processes of threads that exited.
+    for (PinThread &t : threads) {
+        if (isPinRunning(t) &&
+            (t.tc->status() == ThreadContext::Halting ||
+             t.tc->status() == ThreadContext::Halted)) {
+            stopPin(t);
+        }
     }
-    
-    ++delay; // FIXME
+
+    if (nextActiveThread() == InvalidThreadID)
+        _status = Idle;
 
     if (_status != Idle) {
-        schedule(tickEvent, clockEdge(ticksToCycles(delay)));
+        schedule(tickEvent, clockEdge(delay));
     }
 }
 
@@ -436,7 +904,8 @@ CPU::tick()
     } while (0)
 
 void
-CPU::syncRegvalToPin(const char *regname, const void *data, size_t size)
+CPU::syncRegvalToPin(PinThread &t, const char *regname, const void *data,
+                     size_t size)
 {
     // Construct message.
     Message msg;
@@ -448,37 +917,36 @@ CPU::syncRegvalToPin(const char *regname, const void *data, size_t size)
 
     // Send and receive.
     DPRINTF(Pin, "Sending SET_REG for %s\n", regname);
-    msg.send(reqFd);
-    msg.recv(respFd);
+    msg.send(*t.chan);
+    msg.recv(*t.chan);
     panic_if(msg.type != Message::Ack, "received response other than ACK (%i): %s!\n", msg.type, msg);    
 }
 
 template <typename T>
 void
-CPU::syncRegvalToPin(const char *regname, T value)
+CPU::syncRegvalToPin(PinThread &t, const char *regname, T value)
 {
-    syncRegvalToPin(regname, &value, sizeof value);
+    syncRegvalToPin(t, regname, &value, sizeof value);
 }
 
 void
-CPU::syncSingleRegToPin(const char *regname, const RegId &reg)
+CPU::syncSingleRegToPin(PinThread &t, const char *regname, const RegId &reg)
 {
     // Read register value.
     std::vector<uint8_t> data(reg.regClass().regBytes());
-    tc->getReg(reg, data.data());
+    t.tc->getReg(reg, data.data());
 
-    syncRegvalToPin(regname, data.data(), data.size());
+    syncRegvalToPin(t, regname, data.data(), data.size());
 }
 
 void
-CPU::syncStateToPin(bool full)
+CPU::getRegsFromTC(const PinThread &t, PinRegFile &rf) const
 {
     using namespace X86ISA;
-    Message msg;
-    msg.type = Message::SetRegs;
-    PinRegFile &rf = msg.regfile;
+    ThreadContext *tc = t.tc;
+    std::memset(&rf, 0, sizeof rf);
 
-    // Set integer registers.
+    // Get integer registers.
     rf.rax = tc->getReg(int_reg::Rax);
     rf.rbx = tc->getReg(int_reg::Rbx);
     rf.rcx = tc->getReg(int_reg::Rcx);
@@ -497,7 +965,7 @@ CPU::syncStateToPin(bool full)
     rf.r15 = tc->getReg(int_reg::R15);
     rf.rip = tc->pcState().instAddr();
 
-    // Set floating-point registers.
+    // Get floating-point registers.
     for (int i = 0; i < 8; ++i) {
         const double value64 = bitsToFloat64(tc->getReg(float_reg::fpr(i)));
         storeFloat80(&rf.fprs[i][0], value64);
@@ -516,15 +984,104 @@ CPU::syncStateToPin(bool full)
     rf.gs = tc->readMiscRegNoEffect(misc_reg::Gs);
     rf.fs_base = tc->readMiscRegNoEffect(misc_reg::FsBase);
     rf.gs_base = tc->readMiscRegNoEffect(misc_reg::GsBase);
+}
+
+void
+CPU::setRegsInTC(PinThread &t, const PinRegFile &rf, uint32_t mask)
+{
+    using namespace X86ISA;
+    ThreadContext *tc = t.tc;
+
+    // Copy integer registers.
+    static const RegId gprs[] = {
+        int_reg::Rax, int_reg::Rbx, int_reg::Rcx, int_reg::Rdx,
+        int_reg::Rsi, int_reg::Rdi, int_reg::Rsp, int_reg::Rbp,
+        int_reg::R8, int_reg::R9, int_reg::R10, int_reg::R11,
+        int_reg::R12, int_reg::R13, int_reg::R14, int_reg::R15,
+    };
+    static_assert(std::size(gprs) == PINREG_GROUP_R15 + 1);
+    for (int i = 0; i <= PINREG_GROUP_R15; ++i) {
+        if (mask & (1 << i)) {
+            uint64_t value;
+            std::memcpy(&value, reinterpret_cast<const uint8_t *>(&rf) +
+                        pinreg_fields[i].offset, sizeof value);
+            tc->setReg(gprs[i], value);
+        }
+    }
+    if (mask & PINREG(RIP))
+        tc->pcState(rf.rip);
+
+    // Floating-point registers.
+    if (mask & PINREG(X87)) {
+        for (int i = 0; i < 8; ++i) {
+            const double value64 = loadFloat80(rf.fprs[i]);
+            const uint64_t bits64 = floatToBits64(value64);
+            tc->setReg(float_reg::fpr(i), bits64);
+        }
+    }
+    if (mask & PINREG(XMM)) {
+        for (int i = 0; i < 16; ++i) {
+            tc->setReg(float_reg::xmmLow(i), rf.xmms[i][0]);
+            tc->setReg(float_reg::xmmHigh(i), rf.xmms[i][1]);
+        }
+    }
+    if (mask & PINREG(FPCTRL)) {
+        tc->setMiscRegNoEffect(misc_reg::Fcw, rf.fcw);
+        tc->setMiscRegNoEffect(misc_reg::Fsw, rf.fsw);
+        tc->setMiscRegNoEffect(misc_reg::Ftag, rf.ftag);
+        tc->setMiscRegNoEffect(misc_reg::Ftw, rf.ftag); // TODO: Not sure if this is right, but it's what KVM does.
+    }
+
+    // Misc registers.
+    if (mask & PINREG(RFLAGS))
+        setRFlags(tc, rf.rflags);
+    if (mask & PINREG(SEG)) {
+        tc->setMiscRegNoEffect(misc_reg::Fs, rf.fs);
+        tc->setMiscRegNoEffect(misc_reg::Gs, rf.gs);
+    }
+    if (mask & PINREG(FS_BASE))
+        tc->setMiscRegNoEffect(misc_reg::FsBase, rf.fs_base);
+    if (mask & PINREG(GS_BASE))
+        tc->setMiscRegNoEffect(misc_reg::GsBase, rf.gs_base);
+}
+
+void
+CPU::markRegsDirty(PinThread &t, uint32_t mask)
+{
+    t.dirtyRegs |= mask;
+}
+
+void
+CPU::syncStateToPin(PinThread &t)
+{
+    // Only send register groups that were explicitly marked dirty or that
+    // differ from what we last exchanged with Pin. Registers we haven't
+    // pulled since the last run still hold their old values in the thread
+    // context, so they won't show up as changed.
+    PinRegFile rf;
+    getRegsFromTC(t, rf);
+    const uint32_t mask = t.dirtyRegs | pinregs_diff(&rf, &t.pinRegs);
+    t.pinRegs = rf;
+    t.dirtyRegs = 0;
+    if (mask == 0)
+        return;
+
+    Message msg;
+    msg.type = Message::SetRegs;
+    msg.regs.mask = mask;
+    pinregs_pack(&rf, mask, msg.regs.data);
+    DPRINTF(Pin, "Sending SetRegs mask=%#x\n", mask);
 
     // Send message.
-    msg.send(reqFd);
-    msg.recv(respFd);
+    msg.send(*t.chan);
+    stats.regBytesToPin += PINMSG_HEADER_SIZE + msg.size;
+    msg.recv(*t.chan);
     panic_if(msg.type != Message::Ack, "Got message other than ACK for SetRegs!\n");
 }
 
 void
-CPU::syncRegvalFromPin(const char *regname, void *data, size_t size)
+CPU::syncRegvalFromPin(PinThread &t, const char *regname, void *data,
+                       size_t size)
 {
     // Construct message.
     Message msg;
@@ -534,8 +1091,8 @@ CPU::syncRegvalFromPin(const char *regname, void *data, size_t size)
 
     // Send and receive.
     DPRINTF(Pin, "Sending GET_REG for %s\n", regname);
-    msg.send(reqFd);
-    msg.recv(respFd);
+    msg.send(*t.chan);
+    msg.recv(*t.chan);
     panic_if(msg.type != Message::SetReg, "received response other than SET_REG (%i): %s\n", msg.type, msg);
 
     // Set register.
@@ -546,233 +1103,270 @@ CPU::syncRegvalFromPin(const char *regname, void *data, size_t size)
 
 template <typename T>
 T
-CPU::syncRegvalFromPin(const char *name)
+CPU::syncRegvalFromPin(PinThread &t, const char *name)
 {
     T value;
-    syncRegvalFromPin(name, &value, sizeof value);
+    syncRegvalFromPin(t, name, &value, sizeof value);
     return value;
 }
 
 void
-CPU::syncRegFromPin(const char *regname, const RegId &reg)
+CPU::syncRegFromPin(PinThread &t, const char *regname, const RegId &reg)
 {
     std::vector<uint8_t> buf(reg.regClass().regBytes());
-    syncRegvalFromPin(regname, buf.data(), buf.size());
+    syncRegvalFromPin(t, regname, buf.data(), buf.size());
 
     if (buf.size() == 8)
         DPRINTF(Pin, "GET_REG: %s %x\n", regname, * (const uint64_t *) buf.data());
     
-    tc->setReg(reg, buf.data());
+    t.tc->setReg(reg, buf.data());
 }
 
 void
-CPU::syncStateFromPin(bool full)
+CPU::syncStateFromPin(PinThread &t, uint32_t mask)
 {
-    using namespace X86ISA;
-    
+    // Don't clobber anything that's already up to date or that a handler
+    // has overwritten.
+    mask &= ~(t.pulledRegs | t.dirtyRegs);
+    if (mask == 0)
+        return;
+
     Message msg;
     msg.type = Message::GetRegs;
-    msg.send(reqFd);
-    msg.recv(respFd);
+    msg.regs.mask = mask;
+    DPRINTF(Pin, "Sending GetRegs mask=%#x\n", mask);
+    msg.send(*t.chan);
+    msg.recv(*t.chan);
+    stats.regBytesFromPin += PINMSG_HEADER_SIZE + msg.size;
     panic_if(msg.type != Message::SetRegs, "Got response other than SetRegs in response to GetRegs!\n");
-    const PinRegFile &rf = msg.regfile;
-
-    // Copy all integer registers.
-    tc->setReg(int_reg::Rax, rf.rax);
-    tc->setReg(int_reg::Rbx, rf.rbx);
-    tc->setReg(int_reg::Rcx, rf.rcx);
-    tc->setReg(int_reg::Rdx, rf.rdx);
-    tc->setReg(int_reg::Rdi, rf.rdi);
-    tc->setReg(int_reg::Rsi, rf.rsi);
-    tc->setReg(int_reg::Rbp, rf.rbp);
-    tc->setReg(int_reg::Rsp, rf.rsp);
-    tc->setReg(int_reg::R8, rf.r8);
-    tc->setReg(int_reg::R9, rf.r9);
-    tc->setReg(int_reg::R10, rf.r10);
-    tc->setReg(int_reg::R11, rf.r11);
-    tc->setReg(int_reg::R12, rf.r12);
-    tc->setReg(int_reg::R13, rf.r13);
-    tc->setReg(int_reg::R14, rf.r14);
-    tc->setReg(int_reg::R15, rf.r15);
-    tc->pcState(rf.rip);
-
-    // Floating-point registers.
-    for (int i = 0; i < 8; ++i) {
-        const double value64 = loadFloat80(rf.fprs[i]);
-        const uint64_t bits64 = floatToBits64(value64);
-        tc->setReg(float_reg::fpr(i), bits64);
-    }
-    for (int i = 0; i < 16; ++i) {
-        tc->setReg(float_reg::xmmLow(i), rf.xmms[i][0]);
-        tc->setReg(float_reg::xmmHigh(i), rf.xmms[i][1]);
-    }
-    tc->setMiscRegNoEffect(misc_reg::Fcw, rf.fcw);
-    tc->setMiscRegNoEffect(misc_reg::Fsw, rf.fsw);
-    tc->setMiscRegNoEffect(misc_reg::Ftag, rf.ftag);
-    tc->setMiscRegNoEffect(misc_reg::Ftw, rf.ftag); // TODO: Not sure if this is right, but it's what KVM does.
-    
-    // Misc registers.
-    setRFlags(tc, rf.rflags);
-    tc->setMiscRegNoEffect(misc_reg::Fs, rf.fs);
-    tc->setMiscRegNoEffect(misc_reg::Gs, rf.gs);
-    tc->setMiscRegNoEffect(misc_reg::FsBase, rf.fs_base);
-    tc->setMiscRegNoEffect(misc_reg::GsBase, rf.gs_base);    
+    panic_if(msg.regs.mask != mask, "Got SetRegs with wrong mask\n");
+    PinRegFile rf;
+    pinregs_unpack(&rf, mask, msg.regs.data);
+    setRegsInTC(t, rf, mask);
+
+    // Remember the values as the thread context sees them, since converting
+    // (e.g. x87 registers) may be lossy.
+    PinRegFile cur;
+    getRegsFromTC(t, cur);
+    pinregs_copy(&t.pinRegs, &cur, mask);
+    t.pulledRegs |= mask;
 }
 
-void
-CPU::pinRun()
+Counter
+CPU::pinRun(PinThread &t)
 {
-    syncStateToPin(false);
+    syncStateToPin(t);
+    {
+        EventQueue::ScopedMigration migrate(serviceEventQueue());
+        syncSyscallStateToPin(t);
+        flushMappingChanges(t);
+    }
 
     // Tell it to run.
     Message msg;
     msg.type = Message::Run;
-    msg.send(reqFd);
-    msg.recv(respFd);
-    if (ctrInsts) {
-        const std::string instcount_s = executePinCommand("instcount");
-        const auto new_instcount = std::stoull(instcount_s);
-        assert(*ctrInsts <= new_instcount);
-        ctrInsts = new_instcount;
+    msg.run.time_ns = curTick() / sim_clock::as_int::ns;
+    msg.run.max_insts = maxInstsPerRun;
+    // The same model tick() advances time by once the run ends.
+    msg.run.ps_per_inst = ipc > 0 ?
+        std::llround(clockPeriod() / ipc / sim_clock::as_int::ps) : 0;
+    const auto bound_insts = [&msg] (Counter n) {
+        if (msg.run.max_insts == 0 || n < msg.run.max_insts)
+            msg.run.max_insts = n;
+    };
+    if (t.ctrInsts && !t.thread->comInstEventQueue.empty()) {
+        // Stop at the next instruction-count event.
+        const Tick next = t.thread->comInstEventQueue.nextTick();
+        const Counter count = *t.ctrInsts - t.instEventBase;
+        bound_insts(next > count ? next - count : 1);
+    }
+    if (numThreads > 1) {
+        // Give other active threads a turn.
+        for (const PinThread &other : threads) {
+            if (&other != &t &&
+                other.tc->status() == ThreadContext::Active) {
+                bound_insts(threadQuantum);
+                break;
+            }
+        }
+    }
+    {
+        // Don't hold our queue while Pin runs; other CPUs may want it,
+        // e.g., to schedule events on it.
+        EventQueue::ScopedRelease release(curEventQueue());
+        msg.send(*t.chan);
+        msg.recv(*t.chan);
+    }
+    t.pulledRegs = 0;
+    ++stats.numStops;
+    Counter delta = 0;
+    if (t.ctrInsts) {
+        // The kernel fills in the instruction count on every stop. It
+        // starts from zero whenever we start a new Pin process.
+        panic_if(msg.inst_count < t.pinInsts,
+                 "Pin instruction count went backwards (%d -> %d)\n",
+                 t.pinInsts, msg.inst_count);
+        delta = msg.inst_count - t.pinInsts;
+        t.pinInsts = msg.inst_count;
+        *t.ctrInsts += delta;
+        if (instCommitStats) {
+            // Pin doesn't crack instructions, so count each as one op.
+            const ThreadID tid = t.tc->threadId();
+            commitStats[tid]->numInsts += delta;
+            commitStats[tid]->numOps += delta;
+            baseStats.numInsts += delta;
+            baseStats.numOps += delta;
+        }
     }
 
+    EventQueue::ScopedMigration migrate(serviceEventQueue());
+    const uint64_t handler_start_ns = hostNs();
     switch (msg.type) {
       case Message::PageFault:
-        handlePageFault(msg.faultaddr);
+        ++stats.stopReasons[StopPageFault];
+        handlePageFault(t, msg.faultaddr);
         break;
 
       case Message::Syscall:
-        handleSyscall();
+        ++stats.stopReasons[StopSyscall];
+        handleSyscall(t, msg.syscall_check);
         break;
 
       case Message::Cpuid:
-        handleCPUID();
+        ++stats.stopReasons[StopCpuid];
+        handleCPUID(t);
         break;
 
       case Message::Break:
-        syncStateFromPin(false);
-        exitSimLoopNow("pin-breakpoint");
+        ++stats.stopReasons[StopBreak];
+        syncStateFromPin(t, PINREG_ALL);
+        if (reachedTarget(t)) {
+            DPRINTF(Pin, "Reached target %d\n", _targetsReached);
+            exitSimLoopNow("pin-target");
+        } else {
+            exitSimLoopNow("pin-breakpoint");
+        }
+        break;
+
+      case Message::InstBudget:
+        ++stats.stopReasons[StopInstBudget];
+        DPRINTF(Pin, "Instruction budget expired at %d\n", *t.ctrInsts);
         break;
 
       case Message::Ack:
+        ++stats.stopReasons[StopOther];
         break;
         
       default:
         panic("unhandled run response type (%d)\n", msg.type);
     }
+    stats.handlerNs.sample(hostNs() - handler_start_ns);
+
+    return delta;
 }
 
 void
-CPU::handlePageFault(Addr vaddr)
+CPU::handlePageFault(PinThread &t, Addr vaddr)
 {
-    syncStateFromPin(false);
-  
+    ThreadContext *tc = t.tc;
     DPRINTF(Pin, "vaddr=%x\n", vaddr);
     assert(vaddr);
     vaddr &= ~ (Addr) 0xfff;
 
-    // New approach:
-    // Just start grabbing mappings until they aren't mergeable.
-    struct Entry {
-        Addr vaddr;
-        Addr paddr;
-        size_t size;
-        int prot;
-    };
-    std::list<Entry> mappings;
+    // Map the whole VMA, so that Pin doesn't fault on each page of it.
     MemState& mem_state = *tc->getProcessPtr()->memState;
-    size_t size = 0x1000;
+    Addr start = vaddr;
+    Addr size = 0x1000;
     if (VMA *vma = mem_state.getVMA(vaddr)) {
-        vaddr = vma->start();
+        start = vma->start();
         size = vma->size();
         DPRINTF(Pin, "VMA: %#x %#x %s\n", vma->start(), vma->end(), vma->getName());
+    } else if (mapPolicy == enums::PinMapPolicy::eager) {
+        // The stack isn't a VMA; map all of it as it grows.
+        if (!tc->getProcessPtr()->pTable->lookup(vaddr))
+            mem_state.fixupFault(vaddr);
+        const Addr stack_min = mem_state.getStackMin();
+        const Addr stack_base = mem_state.getStackBase();
+        if (vaddr >= stack_min && vaddr < stack_base &&
+            stack_base - stack_min <= eagerMapLimit) {
+            start = stack_min;
+            size = stack_base - stack_min;
+        }
     }
     DPRINTF(Pin, "Preparing to map starting at vaddr=%#x size=%#x\n",
-            vaddr, size);
+            start, size);
 
-#if 1
-    // Collect list of page mappings with permissions.
-    const auto translate_with_mode = [&] (BaseMMU::Mode mode) -> TranslationGenPtr {
-        return tc->getMMUPtr()->translateFunctional(vaddr, size, tc, mode, 0);
+    MessageBatch batch(*t.chan);
+    mapRange(t, batch, start, size);
+    batch.flush();
+    panic_if(!tc->getProcessPtr()->pTable->lookup(vaddr),
+             "Page fault: vaddr=%#x\n", vaddr);
+}
+
+Addr
+CPU::mapRange(PinThread &t, MessageBatch &batch, Addr vaddr, Addr size)
+{
+    // One walk over the page table gets each page's frame and permissions;
+    // pages that haven't been touched yet are allocated, as they would be
+    // by a functional read. Pages that are still unmapped are skipped.
+    Process &process = *t.tc->getProcessPtr();
+    EmulationPageTable &pt = *process.pTable;
+    const Addr page_size = pt.pageSize();
+    const Addr end = vaddr + size;
+    Addr mapped = 0;
+
+    // Mapping replaces whatever Pin already has there.
+    collectDirtyPages(t, vaddr, size);
+
+    Addr run_vaddr = 0, run_paddr = 0, run_size = 0;
+    int run_prot = 0;
+    const auto flush_run = [&] {
+        if (run_size == 0)
+            return;
+        DPRINTF(Pin, "Mapping vaddr=%#x paddr=%#x size=%#x prot=%#x\n",
+                run_vaddr, run_paddr, run_size, run_prot);
+        batch.map(run_vaddr, run_paddr, run_size, run_prot);
+        trackPinMapping(t, run_vaddr, run_size, true);
+        mapped += run_size;
+        run_size = 0;
     };
-    const auto r = translate_with_mode(BaseMMU::Read);
-    const auto w = translate_with_mode(BaseMMU::Write);
-    const auto x = translate_with_mode(BaseMMU::Execute);
-    for (auto r_it = r->begin(), w_it = w->begin(), x_it = x->begin();
-         r_it != r->end();
-         ++r_it, ++w_it, ++x_it) {
-        assert(w_it != w->end());
-        assert(x_it != x->end());
-        panic_if(r_it->fault != NoFault, "Page fault: vaddr=%#x fault=%s\n", r_it->vaddr, r_it->fault->name());
-        Entry entry;
-        entry.vaddr = r_it->vaddr;
-        entry.paddr = r_it->paddr;
-        entry.size = r_it->size;
-        entry.prot = PROT_READ;
-        if (w_it->fault == NoFault)
-            entry.prot |= PROT_WRITE;
-        if (x_it->fault == NoFault)
-            entry.prot |= PROT_EXEC;
-        mappings.push_back(entry);
-    }
-#else
-    const auto ptr = tc->getMMUPtr()->translateFunctional(vaddr, size, tc, BaseMMU::Read, 0);
-    const auto exec_ptr = tc->getMMUPtr()->translateFunctional(vaddr, size, tc, BaseMMU::Execute, 0);
-    for (const TranslationGen::Range& range : *ptr) {
-        panic_if(range.fault != NoFault, "Page fault: vaddr=%#x fault=%s\n", range.vaddr, range.fault->name());
-        Entry entry;
-        entry.vaddr = range.vaddr;
-        entry.paddr = range.paddr;
-        entry.size = range.size;
-        mappings.push_back(entry);
-    }
-
-#endif
-
-    // Combine into ranges.
-    assert(!mappings.empty());
-    for (auto it1 = mappings.begin(); std::next(it1) != mappings.end(); ) {
-        const auto it2 = std::next(it1);
-
-        // Can we combine the entries pointed to by it1 and it2?
-        Entry& e1 = *it1;
-        Entry& e2 = *it2;
-        assert(e1.vaddr + e1.size == e2.vaddr);
-        if (e1.prot == e2.prot && e1.paddr + e1.size == e2.paddr) {
-            // Yes, can combine!
-            e1.size += e2.size;
-            mappings.erase(it2);
+
+    for (Addr va = pt.pageAlign(vaddr); va < end; va += page_size) {
+        const EmulationPageTable::Entry *pte = pt.lookup(va);
+        if (!pte && process.memState->fixupFault(va))
+            pte = pt.lookup(va);
+        if (!pte) {
+            flush_run();
+            continue;
+        }
+        int prot = PROT_READ | PROT_EXEC;
+        if (!(pte->flags & EmulationPageTable::ReadOnly))
+            prot |= PROT_WRITE;
+        if (run_size != 0 && prot == run_prot &&
+            run_vaddr + run_size == va && run_paddr + run_size == pte->paddr) {
+            run_size += page_size;
         } else {
-            // No, we can't combine, so advance.
-            ++it1;
+            flush_run();
+            run_vaddr = va;
+            run_paddr = pte->paddr;
+            run_size = page_size;
+            run_prot = prot;
         }
     }
-
-    // Send ranges over.
-    for (const Entry &e : mappings) {
-        DPRINTF(Pin, "Mapping vaddr=%#x paddr=%#x size=%#x prot=%#x\n",
-                e.vaddr, e.paddr, e.size, e.prot);
-        Message msg;
-        msg.type = Message::Map;
-        msg.map.vaddr = e.vaddr;
-        msg.map.paddr = e.paddr;
-        msg.map.size = e.size;
-        msg.map.prot = e.prot;
-        msg.send(reqFd);
-        msg.recv(respFd);
-        panic_if(msg.type != Message::Ack, "unexpected response\n");        
-    }
+    flush_run();
+    return mapped;
 }
 
 Tick
-CPU::doMMIOAccess(Addr paddr, void *data, int size, bool write)
+CPU::doMMIOAccess(PinThread &t, Addr paddr, void *data, int size, bool write)
 {
+    ThreadContext *tc = t.tc;
     // TODO: Remove this entirely.
     fatal("delete this bloody function\n");
     
     // NOTE: Might need to stutterPC like in KVM:
     // pc.as<X86ISA::PCState>().setNPC(pc.instAddr()); 
-    syncStateFromPin(false);
+    syncStateFromPin(t, PINREG_ALL);
 
     RequestPtr mmio_req = std::make_shared<Request>(
         paddr, size, Request::UNCACHEABLE, dataRequestorId());
@@ -794,40 +1388,349 @@ CPU::doMMIOAccess(Addr paddr, void *data, int size, bool write)
 }
 
 void
-CPU::handleSyscall()
+CPU::syncSyscallStateToPin(PinThread &t)
 {
-    syncStateFromPin(false);
+    if (fastSyscalls.empty())
+        return;
+
+    Process *process = t.tc->getProcessPtr();
+    PinSyscallState state;
+    std::memset(&state, 0, sizeof state);
+    state.pid = process->tgid();
+    state.ppid = process->ppid();
+    state.tid = process->pid();
+    state.uid = process->uid();
+    state.euid = process->euid();
+    state.gid = process->gid();
+    state.egid = process->egid();
+    state.brk = process->memState->getBrkPoint();
+
+    // Pin may only write to guest fds that still have the entry whose
+    // host fd it inherited; closing one and opening another can reuse the
+    // host fd number.
+    auto &fds = *process->fds;
+    for (int i = 0; i < PIN_SYSCALL_STATE_FDS; ++i) {
+        state.fds[i] = -1;
+        if (t.fastSyscallPinFds[i] >= 0 &&
+            fds[i] == fastSyscallFdEntries[i])
+            state.fds[i] = t.fastSyscallPinFds[i];
+    }
 
+    if (t.syscallStateValid &&
+        std::memcmp(&state, &t.syscallState, sizeof state) == 0)
+        return;
+    t.syscallState = state;
+    t.syscallStateValid = true;
+
+    Message msg;
+    msg.type = Message::SetSyscallState;
+    msg.syscall_state = state;
+    msg.send(*t.chan);
+    msg.recv(*t.chan);
+    panic_if(msg.type != Message::Ack, "Got message other than ACK for SetSyscallState!\n");
+}
+
+void
+CPU::handleSyscall(PinThread &t, const PinSyscallCheck &check)
+{
+    ThreadContext *tc = t.tc;
+
+    // The syscall emulator may read or write any register.
+    syncStateFromPin(t, PINREG_ALL);
+    stats.syscalls.sample(tc->getReg(X86ISA::int_reg::Rax));
+
+    if (SyscallLog *log = getSyscallLog(t)) {
+        if (log->mode() == SyscallLog::Record)
+            recordSyscall(t, *log);
+        else
+            replaySyscall(t, *log);
+    } else {
+        tc->getSystemPtr()->workload->syscall(tc);
+    }
+
+    // Check the Pintool's fast-path result, if it gave one.
+    if (check.valid) {
+        const uint64_t result = tc->getReg(X86ISA::int_reg::Rax);
+        panic_if(result != check.result,
+                 "Fast syscall result mismatch: pin=%#x gem5=%#x\n",
+                 check.result, result);
+        if (check.data_size != 0) {
+            assert(check.data_size <= sizeof check.data);
+            uint8_t data[sizeof check.data];
+            SETranslatingPortProxy(tc).readBlob(check.data_addr, data,
+                                                check.data_size);
+            panic_if(std::memcmp(data, check.data, check.data_size) != 0,
+                     "Fast syscall output mismatch at vaddr %#x\n",
+                     check.data_addr);
+        }
+        ++stats.fastSyscallChecks;
+    }
+
+    // FIXME: Need to cleanly exit. 
+}
+
+SyscallLog *
+CPU::getSyscallLog(PinThread &t)
+{
+    if (syscallLogMode == enums::PinSyscallLogMode::off)
+        return nullptr;
+    if (!t.syscallLog) {
+        // Thread 0 of CPU 0 keeps the unsuffixed name.
+        std::string path = syscallLogPath;
+        if (cpuId() != 0)
+            path += csprintf(".cpu%d", cpuId());
+        if (t.tc->threadId() != 0)
+            path += csprintf(".%d", t.tc->threadId());
+        t.syscallLog = std::make_unique<SyscallLog>(
+            simout.resolve(path),
+            syscallLogMode == enums::PinSyscallLogMode::record ?
+            SyscallLog::Record : SyscallLog::Replay);
+    }
+    return t.syscallLog.get();
+}
+
+void
+CPU::recordSyscall(PinThread &t, SyscallLog &log)
+{
+    ThreadContext *tc = t.tc;
+    SyscallLog::Syscall syscall;
+    syscall.num = tc->getReg(X86ISA::int_reg::Rax);
+
+    // Replay emulates some syscalls again, so it doesn't need their
+    // writes (which may not even be to this address space).
+    std::vector<std::pair<Addr, std::vector<uint8_t>>> writes;
+    LoggingThread &thread = static_cast<LoggingThread &>(*t.thread);
+    if (!emulatedOnReplay(syscall.num))
+        thread.writes = &writes;
     tc->getSystemPtr()->workload->syscall(tc);
+    thread.writes = nullptr;
+    syscall.result = tc->getReg(X86ISA::int_reg::Rax);
+
+    // Writes come a page (or less) at a time; merge the contiguous ones.
+    for (auto &[paddr, data] : writes) {
+        const Addr vaddr = frameToVaddr(t, paddr);
+        if (!syscall.writes.empty()) {
+            SyscallLog::Write &last = syscall.writes.back();
+            if (last.vaddr + last.data.size() == vaddr) {
+                last.data.insert(last.data.end(), data.begin(), data.end());
+                continue;
+            }
+        }
+        syscall.writes.push_back({vaddr, std::move(data)});
+    }
+    log.putSyscall(syscall);
+}
+
+void
+CPU::replaySyscall(PinThread &t, SyscallLog &log)
+{
+    ThreadContext *tc = t.tc;
+    const uint64_t num = tc->getReg(X86ISA::int_reg::Rax);
+    const uint64_t pos = log.position();
+    const SyscallLog::Syscall syscall = log.getSyscall();
+    fatal_if(syscall.num != num,
+             "Replay diverged: record %d of syscall log %s is syscall %d, "
+             "but the guest is doing syscall %d\n", pos, log.path(),
+             syscall.num, num);
+
+    if (emulatedOnReplay(num)) {
+        tc->getSystemPtr()->workload->syscall(tc);
+        const uint64_t result = tc->getReg(X86ISA::int_reg::Rax);
+        fatal_if(result != syscall.result,
+                 "Replay diverged: syscall %d (record %d of syscall log %s) "
+                 "returned %#x, but recorded %#x\n", num, pos, log.path(),
+                 result, syscall.result);
+        return;
+    }
+
+    DPRINTF(Pin, "Replaying syscall %d: result=%#x, %d writes\n", num,
+            syscall.result, syscall.writes.size());
+    SETranslatingPortProxy proxy(tc);
+    for (const SyscallLog::Write &write : syscall.writes)
+        proxy.writeBlob(write.vaddr, write.data.data(), write.data.size());
+    tc->setReg(X86ISA::int_reg::Rax, syscall.result);
+}
+
+Addr
+CPU::frameToVaddr(PinThread &t, Addr paddr)
+{
+    EmulationPageTable &pt = *t.tc->getProcessPtr()->pTable;
+    const Addr frame = pt.pageAlign(paddr);
+    const auto valid = [&] (Addr vpage) {
+        const EmulationPageTable::Entry *pte = pt.lookup(vpage);
+        return pte && pte->paddr == frame;
+    };
+
+    auto it = t.framePages.find(frame);
+    if (it == t.framePages.end() || !valid(it->second)) {
+        // The page is new or has moved since we last looked.
+        std::vector<std::pair<Addr, Addr>> mappings;
+        pt.getMappings(&mappings);
+        t.framePages.clear();
+        for (const auto &[vpage, ppage] : mappings)
+            t.framePages[ppage] = vpage;
+        it = t.framePages.find(frame);
+        panic_if(it == t.framePages.end(),
+                 "Syscall wrote paddr %#x, which isn't mapped\n", paddr);
+    }
+    return it->second + pt.pageOffset(paddr);
+}
+
+namespace
+{
+
+// Append a range, merging it into the last one if they're adjacent, as
+// consecutive munmaps and brk calls tend to be.
+void
+queueRange(std::vector<std::pair<Addr, Addr>> &ranges, Addr start,
+           Addr length)
+{
+    if (!ranges.empty() &&
+        ranges.back().first + ranges.back().second == start) {
+        ranges.back().second += length;
+        return;
+    }
+    ranges.emplace_back(start, length);
+}
+
+} // anonymous namespace
+
+CPU::MappingListener::MappingListener(
+        std::vector<std::pair<Addr, Addr>> &unmaps,
+        std::vector<std::pair<Addr, Addr>> *maps,
+        std::shared_ptr<MemState> mem_state)
+    : unmaps(unmaps), maps(maps), memState(std::move(mem_state))
+{
+    memState->subscribe(this);
+}
+
+CPU::MappingListener::~MappingListener()
+{
+    memState->unsubscribe(this);
+}
+
+void
+CPU::MappingListener::mapped(Addr start, Addr length)
+{
+    if (maps)
+        queueRange(*maps, start, length);
+}
+
+void
+CPU::MappingListener::unmapped(Addr start, Addr length)
+{
+    queueRange(unmaps, start, length);
+}
+
+void
+CPU::MappingListener::remapped(Addr start, Addr new_start, Addr length)
+{
+    unmapped(start, length);
+    mapped(new_start, length);
+}
+
+void
+CPU::MappingListener::protectionChanged(Addr start, Addr length, int prot)
+{
+    // Pin's mappings take their permissions from the page table when they
+    // are (re)made, so drop the range and let it fault back in. Unmapping
+    // also makes Pin discard code it translated from the range, which
+    // matters for JITs that write code and then mprotect it executable.
+    unmapped(start, length);
+    mapped(start, length);
+}
 
-    // If we unmapped any pages, then tell pin that here.
-    auto& unmapped = tc->getProcessPtr()->memState->unmapped;
-    auto unmapped_it = unmapped.begin();
-    while (unmapped_it != unmapped.end()) {
-        const Addr vbase = *unmapped_it;
-        Addr vsize = 0x1000;
-        for (++unmapped_it;
-             unmapped_it != unmapped.end() && *unmapped_it == vbase + vsize;
-             ++unmapped_it, vsize += 0x1000)
-            ;
+void
+CPU::flushMappingChanges(PinThread &t)
+{
+    if (t.pendingUnmaps.empty() && t.pendingMaps.empty())
+        return;
+    MessageBatch batch(*t.chan);
+    for (const auto &[vbase, vsize] : t.pendingUnmaps) {
         DPRINTF(Pin, "Pin: unmapping vaddr %#x-%#x\n", vbase, vbase + vsize);
-        Message msg;
-        msg.type = Message::Unmap;
-        msg.map.vaddr = vbase;
-        msg.map.size = vsize;
-        msg.send(reqFd);
-        msg.recv(respFd);
-        panic_if(msg.type != Message::Ack, "unexpected response\n");
+        collectDirtyPages(t, vbase, vsize);
+        batch.unmap(vbase, vsize);
+        trackPinMapping(t, vbase, vsize, false);
     }
-    unmapped.clear();
+    // Unmaps go first, since a region may have been unmapped and then
+    // mapped again. Regions that have since gone away just aren't in the
+    // page table any more, so mapRange() skips them.
+    for (const auto &[vbase, vsize] : t.pendingMaps) {
+        if (vsize > eagerMapLimit) {
+            DPRINTF(Pin, "Pin: leaving vaddr %#x-%#x to fault in\n",
+                    vbase, vbase + vsize);
+            continue;
+        }
+        DPRINTF(Pin, "Pin: eagerly mapping vaddr %#x-%#x\n",
+                vbase, vbase + vsize);
+        if (const Addr bytes = mapRange(t, batch, vbase, vsize)) {
+            ++stats.avoidedFaults;
+            stats.eagerMappedBytes += bytes;
+        }
+    }
+    batch.flush();
+    t.pendingUnmaps.clear();
+    t.pendingMaps.clear();
+}
 
-    // FIXME: Need to cleanly exit. 
+void
+CPU::collectDirtyPages(PinThread &t, Addr vaddr, Addr size)
+{
+    memory::PhysicalMemory &physmem = system->getPhysMem();
+    if (!physmem.trackingDirtyPages())
+        return;
+
+    // Only look where Pin has something mapped; reading its page map is
+    // slow, and this runs whenever Pin maps anything.
+    const Addr end = vaddr + std::min(size, MaxAddr - vaddr);
+    auto first = t.pinMappings.upper_bound(vaddr);
+    if (first != t.pinMappings.begin() && std::prev(first)->second > vaddr)
+        --first;
+    const auto last = t.pinMappings.lower_bound(end);
+    if (first == last)
+        return;
+    const Addr start = std::max(vaddr, first->first);
+    const Addr stop = std::min(end, std::prev(last)->second);
+
+    // Pin maps the backing store at offset paddr.
+    const Addr page_size = t.tc->getProcessPtr()->pTable->pageSize();
+    soft_dirty::forEachDirtyFilePage(t.pinPid, backingStoreIno, start,
+                                     stop - start, page_size,
+                                     [&] (Addr paddr) {
+                                         physmem.markDirty(paddr, page_size);
+                                     });
+}
+
+void
+CPU::trackPinMapping(PinThread &t, Addr vaddr, Addr size, bool mapped)
+{
+    if (!system->getPhysMem().trackingDirtyPages())
+        return;
+
+    // Cut the range out of the mappings it overlaps, keeping the parts
+    // on either side.
+    std::map<Addr, Addr> &mappings = t.pinMappings;
+    const Addr end = vaddr + size;
+    auto it = mappings.upper_bound(vaddr);
+    if (it != mappings.begin() && std::prev(it)->second > vaddr)
+        --it;
+    while (it != mappings.end() && it->first < end) {
+        const auto [map_start, map_end] = *it;
+        it = mappings.erase(it);
+        if (map_start < vaddr)
+            mappings.emplace(map_start, vaddr);
+        if (map_end > end)
+            it = mappings.emplace(end, map_end).first;
+    }
+    if (mapped)
+        mappings.emplace(vaddr, end);
 }
 
 void
-CPU::handleCPUID()
+CPU::handleCPUID(PinThread &t)
 {
-    syncStateFromPin(false);
+    ThreadContext *tc = t.tc;
+    syncStateFromPin(t, PINREG(RAX) | PINREG(RCX));
 
     // Get function (EAX).
     const uint32_t func = tc->getReg(X86ISA::int_reg::Rax);
@@ -838,57 +1741,236 @@ CPU::handleCPUID()
     DPRINTF(Pin, "CPUID: EAX=0x%x ECX=0x%x\n", func, index);
     
     // Do CPUID.
-    X86ISA::ISA *isa = dynamic_cast<X86ISA::ISA *>(tc->getIsaPtr());
     X86ISA::CpuidResult result;
-    isa->cpuid->doCpuid(tc, func, index, result);
+    SyscallLog *log = getSyscallLog(t);
+    if (log && log->mode() == SyscallLog::Replay) {
+        const uint64_t pos = log->position();
+        const SyscallLog::Cpuid cpuid = log->getCpuid();
+        fatal_if(cpuid.func != func || cpuid.index != index,
+                 "Replay diverged: record %d of syscall log %s is CPUID "
+                 "%#x/%#x, but the guest is doing CPUID %#x/%#x\n", pos,
+                 log->path(), cpuid.func, cpuid.index, func, index);
+        result = X86ISA::CpuidResult(cpuid.rax, cpuid.rbx, cpuid.rdx,
+                                     cpuid.rcx);
+    } else {
+        X86ISA::ISA *isa = dynamic_cast<X86ISA::ISA *>(tc->getIsaPtr());
+        isa->cpuid->doCpuid(tc, func, index, result);
+        if (log)
+            log->putCpuid({func, index, result.rax, result.rbx, result.rcx,
+                           result.rdx});
+    }
 
     // Set RAX, RBX, RCX, RDX.
     tc->setReg(X86ISA::int_reg::Rax, result.rax);
     tc->setReg(X86ISA::int_reg::Rbx, result.rbx);
     tc->setReg(X86ISA::int_reg::Rdx, result.rdx);
     tc->setReg(X86ISA::int_reg::Rcx, result.rcx);
+    markRegsDirty(t, PINREG(RAX) | PINREG(RBX) | PINREG(RCX) | PINREG(RDX));
+}
+
+DrainState
+CPU::drain()
+{
+    if (switchedOut())
+        return DrainState::Drained;
+
+    // Apply any wakes and halts that other CPUs asked for. Their event
+    // may not have made it into our queue yet (see asyncInsert()), and
+    // can only be descheduled once it has.
+    {
+        EventQueue::ScopedMigration migrate(eventQueue());
+        eventQueue()->handleAsyncInsertions();
+        if (remoteEvent.scheduled())
+            deschedule(remoteEvent);
+        serviceRemoteRequests();
+    }
+
+    if (tickEvent.scheduled())
+        deschedule(tickEvent);
+    _status = Idle;
+
+    // Make sure the thread contexts are complete, since we only pull the
+    // registers that each stop needs.
+    for (PinThread &t : threads) {
+        if (isPinRunning(t)) {
+            syncStateFromPin(t, PINREG_ALL);
+            // Hand the physical memory the pages Pin wrote, and start
+            // over, in case this is for a checkpoint.
+            if (system->getPhysMem().trackingDirtyPages()) {
+                collectDirtyPages(t, 0, MaxAddr);
+                if (!soft_dirty::clear(t.pinPid))
+                    panic("Failed to clear Pin's soft-dirty bits\n");
+            }
+        }
+    }
+    return DrainState::Drained;
+}
+
+void
+CPU::drainResume()
+{
+    if (switchedOut())
+        return;
+
+    verifyMemoryMode();
+
+    // The tick event is descheduled while draining, and after restoring
+    // from a checkpoint, nothing has activated our threads.
+    if (nextActiveThread() != InvalidThreadID) {
+        schedule(tickEvent, clockEdge(Cycles(0)));
+        _status = Running;
+    }
+}
+
+void
+CPU::switchOut()
+{
+    BaseCPU::switchOut();
+
+    // We drained first, so the thread contexts are complete. The Pin
+    // processes stay around, waiting for their next request, so that we
+    // can pick up where we left off if we're switched back in.
+    assert(!tickEvent.scheduled());
+    assert(_status == Idle);
+}
+
+void
+CPU::takeOverFrom(BaseCPU *cpu)
+{
+    BaseCPU::takeOverFrom(cpu);
+
+    assert(!tickEvent.scheduled());
+    assert(_status == Idle);
+
+    // Guest memory lives in the shared backing store, so Pin already sees
+    // the other CPU's stores. Everything else it may have changed has to be
+    // resent: registers and syscall state. Mapping changes were queued as
+    // they happened.
+    for (PinThread &t : threads) {
+        if (!isPinRunning(t))
+            continue;
+        if (t.tc->status() == ThreadContext::Halted ||
+            t.tc->status() == ThreadContext::Halting) {
+            stopPin(t);
+            continue;
+        }
+        t.pulledRegs = 0;
+        markRegsDirty(t, PINREG_ALL);
+        t.syscallStateValid = false;
+    }
+}
+
+void
+CPU::verifyMemoryMode() const
+{
+    // Pin accesses the backing store directly.
+    fatal_if(!system->bypassCaches(),
+             "The Pin CPU requires the memory system to be in the "
+             "'atomic_noncaching' mode.\n");
 }
 
 void
 CPU::serializeThread(CheckpointOut &cp, ThreadID tid) const
 {
-    assert(tid == 0);
-    thread->serialize(cp);
+    assert(tid < numThreads);
+    const PinThread &t = threads[tid];
+    t.thread->serialize(cp);
+
+    if (t.ctrInsts)
+        paramOut(cp, "ctrInsts", *t.ctrInsts);
+
+    // A running Pin process has its plugins' state; it's only fetched
+    // here, since most drains aren't for checkpoints.
+    std::string running_state;
+    const std::string *pin_state = &t.pinState;
+    Counter pin_state_insts = t.pinStateInsts;
+    if (isPinRunning(t)) {
+        CPU &self = const_cast<CPU &>(*this);
+        running_state = self.savePinState(self.threads[tid]);
+        pin_state = &running_state;
+        pin_state_insts = t.pinInsts;
+    }
+
+    // Plugin state can be large, so it goes in its own file.
+    if (!pin_state->empty()) {
+        const std::string pin_state_file =
+            csprintf("%s.%d.pinstate", name(), tid);
+        const std::string path = CheckpointIn::dir() + "/" + pin_state_file;
+        std::ofstream os(path, std::ios::binary);
+        fatal_if(!os, "Failed to create Pin state file %s\n", path);
+        os.write(pin_state->data(), pin_state->size());
+        fatal_if(!os, "Failed to write Pin state file %s\n", path);
+        paramOut(cp, "pinStateFile", pin_state_file);
+        paramOut(cp, "pinStateInsts", pin_state_insts);
+    }
+}
+
+void
+CPU::unserializeThread(CheckpointIn &cp, ThreadID tid)
+{
+    assert(tid < numThreads);
+    PinThread &t = threads[tid];
+    t.thread->unserialize(cp);
+
+    if (t.ctrInsts && optParamIn(cp, "ctrInsts", *t.ctrInsts))
+        t.instEventBase = *t.ctrInsts;
+
+    std::string pin_state_file;
+    if (optParamIn(cp, "pinStateFile", pin_state_file)) {
+        const std::string path = cp.getCptDir() + "/" + pin_state_file;
+        std::ifstream is(path, std::ios::binary);
+        fatal_if(!is, "Failed to open Pin state file %s\n", path);
+        t.pinState.assign(std::istreambuf_iterator<char>(is),
+                          std::istreambuf_iterator<char>());
+        paramIn(cp, "pinStateInsts", t.pinStateInsts);
+    }
 }
 
-std::string
-CPU::executePinCommand(const std::string &command)
+std::string_view
+CPU::runPinCommand(PinThread &t, const std::string &command)
 {
-    fatal_if(!isPinRunning(), "PinCPU has not been started up yet!\n");
+    ++stats.commands;
     Message msg;
     msg.type = Message::ExecCommand;
     fatal_if(command.size() >= sizeof msg.command, "Command too long!\n");
     std::strcpy(msg.command, command.c_str());
-    msg.send(reqFd);
-    msg.recv(respFd);
-    panic_if(msg.type != Message::CommandResult, "Received message other than CommandResult!\n");
-    
-    size_t rem = msg.command_result_size;
-    std::string s;
-    while (rem > 0) {
-        char buf[1024];
-        const ssize_t bytes = read(respFd, buf, std::min(rem, sizeof buf));
-        if (bytes <= 0)
-            panic("read failed: rem=%u\n", rem);
-        s.insert(s.end(), &buf[0], &buf[bytes]);
-        rem -= bytes;
-    }
-    assert(s.size() == msg.command_result_size);
-    return s;
+    msg.send(*t.chan);
+    return recvCommandResult(t);
+}
+
+std::string_view
+CPU::runPinCommand(const std::string &command)
+{
+    // Pintool state is per Pin process; commands go to the first thread
+    // that has one.
+    auto t_it = std::find_if(threads.begin(), threads.end(),
+                             [this] (const PinThread &t) {
+                                 return isPinRunning(t);
+                             });
+    fatal_if(t_it == threads.end(), "PinCPU has not been started up yet!\n");
+    return runPinCommand(*t_it, command);
+}
+
+std::string
+CPU::executePinCommand(const std::string &command)
+{
+    return std::string(runPinCommand(command));
+}
+
+pybind11::memoryview
+CPU::executePinCommandView(const std::string &command)
+{
+    const std::string_view result = runPinCommand(command);
+    return pybind11::memoryview::from_memory(
+        result.empty() ? "" : result.data(), result.size());
 }
 
 bool
-CPU::isPinRunning() const
+CPU::isPinRunning(const PinThread &t) const
 {
-    if (pinPid < 0)
+    if (t.pinPid < 0)
         return false;
-    assert(reqFd >= 0);
-    assert(respFd >= 0);
+    assert(t.chan);
     return true;
 }
 
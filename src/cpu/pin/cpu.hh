@@ -1,15 +1,32 @@
 #pragma once
 
+#include <sys/types.h>
+
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
+#include <string_view>
+#include <unordered_map>
+
+#include "pybind11/pybind11.h"
 
+#include "base/statistics.hh"
 #include "cpu/base.hh"
+#include "cpu/pin/channel.hh"
+#include "cpu/pin/regfile.h"
+#include "cpu/pin/shared.h"
+#include "enums/PinMapPolicy.hh"
+#include "enums/PinSyscallLogMode.hh"
+#include "enums/PinTransport.hh"
+#include "sim/mem_state.hh"
 
 namespace gem5
 {
 
 // Forward declarations.
+class FDEntry;
 class SimpleThread;
 class BasePinCPUParams;
 class System;
@@ -17,17 +34,31 @@ class System;
 namespace pin
 {
 
+class MessageBatch;
+class ResultRegion;
+class SyscallLog;
+
 class CPU final : public BaseCPU
 {
   public:
     CPU(const BasePinCPUParams &params);
+    ~CPU() override;
 
     void init() override;
     void startup() override;
 
     void serializeThread(CheckpointOut &cp, ThreadID tid) const override;
+    void unserializeThread(CheckpointIn &cp, ThreadID tid) override;
+
+    DrainState drain() override;
+    void drainResume() override;
+
+    void switchOut() override;
+    void takeOverFrom(BaseCPU *cpu) override;
+    void verifyMemoryMode() const override;
     
     void activateContext(ThreadID tid = 0) override;
+    void haltContext(ThreadID tid) override;
 
     class PinRequestPort final : public RequestPort
     {
@@ -58,11 +89,117 @@ class CPU final : public BaseCPU
         Running,
     };
 
-  private:    
-    std::unique_ptr<SimpleThread> thread;
-    ThreadContext *tc;
+  private:
+    /**
+     * Queues changes to the address space of a thread whose Pin process
+     * is running, since that process has its own copy of the mappings.
+     * Every thread that shares the address space has one, whatever CPU
+     * it's on, so a change made by one reaches all of them.
+     */
+    class MappingListener : public MemState::Listener
+    {
+      public:
+        MappingListener(std::vector<std::pair<Addr, Addr>> &unmaps,
+                        std::vector<std::pair<Addr, Addr>> *maps,
+                        std::shared_ptr<MemState> mem_state);
+        ~MappingListener();
+
+        void mapped(Addr start, Addr length) override;
+        void unmapped(Addr start, Addr length) override;
+        void remapped(Addr start, Addr new_start, Addr length) override;
+        void protectionChanged(Addr start, Addr length, int prot) override;
+
+      private:
+        std::vector<std::pair<Addr, Addr>> &unmaps;
+        // Null unless regions are mapped eagerly.
+        std::vector<std::pair<Addr, Addr>> *maps;
+        std::shared_ptr<MemState> memState;
+    };
+
+    /**
+     * A guest thread. Each one runs in its own Pin process; the processes
+     * map the same backing store, so they share guest memory just like
+     * threads do.
+     */
+    struct PinThread
+    {
+        std::unique_ptr<SimpleThread> thread;
+        ThreadContext *tc = nullptr;
+
+        pid_t pinPid = -1;
+        std::unique_ptr<Channel> chan;
+        // Where the pintool puts command results; resultBuf holds results
+        // that came over the channel instead (see recvCommandResult()).
+        std::unique_ptr<ResultRegion> results;
+        std::string resultBuf;
+
+        /**
+         * Register state shared with Pin. pinRegs is what we believe Pin's
+         * registers hold, as read back from the thread context. pulledRegs
+         * are the groups copied from Pin into the thread context since the
+         * last run; dirtyRegs are groups that must be sent to Pin
+         * regardless of whether they appear to have changed.
+         */
+        PinRegFile pinRegs = {};
+        uint32_t pulledRegs = 0;
+        uint32_t dirtyRegs = PINREG_ALL;
+
+        PinSyscallState syscallState; // As last sent to Pin.
+        bool syscallStateValid = false;
+        // Duplicates of the host fds of fastSyscallFdEntries that this Pin
+        // process inherited.
+        int fastSyscallPinFds[PIN_SYSCALL_STATE_FDS];
+
+        std::optional<Counter> ctrInsts;
+        // ctrInsts when the thread's comInstEventQueue started counting.
+        // Like other CPUs' counts, it starts from zero on a restore, since
+        // init() schedules max_insts and friends from there.
+        Counter instEventBase = 0;
+        Counter pinInsts = 0; // Last count reported by the Pin process.
+
+        // Ranges (vaddr, size) unmapped by any thread that shares the
+        // address space, to send to Pin before the next run. Guarded by
+        // serviceEventQueue().
+        std::vector<std::pair<Addr, Addr>> pendingUnmaps;
+        // Likewise, regions to map before the next run (eager mapping).
+        std::vector<std::pair<Addr, Addr>> pendingMaps;
+        // Fills in the above while the Pin process runs.
+        std::unique_ptr<MappingListener> mappingListener;
+        // Guest memory [start, end) that the Pin process has mapped, by
+        // start. Only kept while the physical memory tracks dirty pages.
+        std::map<Addr, Addr> pinMappings;
+
+        // Pintool plugin state, as read from a checkpoint, along with
+        // Pin's instruction count at that point. Loaded into the next Pin
+        // process started for the thread.
+        std::string pinState;
+        Counter pinStateInsts = 0;
+
+        // Syscall/CPUID record or replay log (see syscallLogMode), opened
+        // on first use.
+        std::unique_ptr<SyscallLog> syscallLog;
+        // Guest page of each physical frame, for recording syscall writes
+        // by virtual address. Rebuilt from the page table on a miss.
+        std::unordered_map<Addr, Addr> framePages;
+    };
+
+    std::vector<PinThread> threads;
+    ThreadID curThread = InvalidThreadID; // The last thread we ran.
     EventFunctionWrapper tickEvent;
     Status _status;
+
+    /**
+     * Wakes and halts of our threads requested by other CPUs' syscalls
+     * (futex wake, exit_group), which run on the service queue. They are
+     * applied by remoteEvent on our own queue, so the caller keeps the
+     * service queue locked. Guarded by remoteMutex.
+     */
+    EventFunctionWrapper remoteEvent;
+    std::mutex remoteMutex;
+    std::vector<std::pair<ThreadID, bool>> remoteRequests; // (tid, halt)
+    bool remotePending = false;
+    void requestFromOtherQueue(ThreadID tid, bool halt);
+    void serviceRemoteRequests();
     PinRequestPort dataPort;
     PinRequestPort instPort;
 
@@ -73,13 +210,60 @@ class CPU final : public BaseCPU
     std::vector<std::string> pinArgs;
     std::vector<std::string> pinToolArgs;
     
-    // TODO: Consider abstracting the Pin process into its own class.
-    pid_t pinPid = -1;
-    int reqFd = -1;
-    int respFd = -1;
+    enums::PinTransport transport;
+    unsigned transportSpin;
+    enums::PinMapPolicy mapPolicy;
+    /// Largest region mapped eagerly; bigger ones are left to fault in.
+    Addr eagerMapLimit;
+    enums::PinSyscallLogMode syscallLogMode;
+    std::string syscallLogPath;
     System *system;
-    std::optional<Counter> ctrInsts;
+
+    // Syscall fast path (see the Pintool's fastsyscall plugin).
+    std::vector<std::string> fastSyscalls;
+    bool checkFastSyscalls;
+    // For each of guest fds 0-2: its entry at startup, if it was a host
+    // file. Holding it keeps the entry's address from being reused.
+    std::shared_ptr<FDEntry> fastSyscallFdEntries[PIN_SYSCALL_STATE_FDS];
+
+    /// Counter that targets are counts of, and the counts.
+    std::string targetCounter;
+    std::vector<uint64_t> targets;
+
+    void syncSyscallStateToPin(PinThread &t);
+    void flushMappingChanges(PinThread &t);
+    /**
+     * If the physical memory tracks dirty pages, tell it about the ones
+     * the thread's Pin process wrote in a range of its address space.
+     * Pin writes guest memory through its own mappings, where gem5 can't
+     * see them, and a page's soft-dirty bit goes away with its mapping,
+     * so this runs before Pin unmaps or replaces anything.
+     */
+    void collectDirtyPages(PinThread &t, Addr vaddr, Addr size);
+    /** Record that a thread's Pin process mapped or unmapped a range. */
+    void trackPinMapping(PinThread &t, Addr vaddr, Addr size, bool mapped);
+    // The inode of the backing store that Pin maps guest memory from.
+    ino_t backingStoreIno = 0;
+
+    /**
+     * Servicing syscalls and page faults touches state shared with other
+     * CPUs (the process, its page table, ...), so it happens on the
+     * system's event queue. Pin itself runs without holding any queue, so
+     * CPUs on different event queues run their Pin processes in parallel.
+     */
+    EventQueue *serviceEventQueue() const { return system->eventQueue(); }
+    bool countInsts;
     bool traceInsts;
+    /// Keep the pintool's instruction count in a register while Pin runs.
+    bool inlineInstCount;
+    /// Add each stop's instruction delta to the commit stats.
+    bool instCommitStats;
+    /// Instruction budget for each run (0: unlimited).
+    Counter maxInstsPerRun;
+    /// Instructions per cycle for advancing time (0: one cycle per run).
+    double ipc;
+    /// Instruction budget for each run while other threads are waiting.
+    Counter threadQuantum;
 
     // Basic block profiling
     bool enableBBV;
@@ -89,41 +273,151 @@ class CPU final : public BaseCPU
     const std::string& getPinTool() const;
     const std::string& getPinExe() const;
     const std::string& getDummyProg() const;
-    static const char *getRequestPath();
-    static const char *getResponsePath();
 
-    void pinRun();
+    /// Returns the number of instructions executed (0 if not counting).
+    Counter pinRun(PinThread &t);
+
+    /// Next active thread after curThread, or InvalidThreadID.
+    ThreadID nextActiveThread() const;
+
+    void getRegsFromTC(const PinThread &t, PinRegFile &rf) const;
+    void setRegsInTC(PinThread &t, const PinRegFile &rf, uint32_t mask);
+    void markRegsDirty(PinThread &t, uint32_t mask);
 
-    void syncStateToPin(bool full);
-    void syncStateFromPin(bool full);
+    /// Send all register groups that changed since the last exchange.
+    void syncStateToPin(PinThread &t);
+    /// Copy the register groups in mask (PINREG_*) into the thread context.
+    void syncStateFromPin(PinThread &t, uint32_t mask);
 
-    void syncSingleRegToPin(const char *name, const RegId &reg);
-    void syncRegvalToPin(const char *name, const void *data, size_t size);
+    void syncSingleRegToPin(PinThread &t, const char *name,
+                            const RegId &reg);
+    void syncRegvalToPin(PinThread &t, const char *name, const void *data,
+                         size_t size);
 
     template <typename T>
-    void syncRegvalToPin(const char *name, T value);
+    void syncRegvalToPin(PinThread &t, const char *name, T value);
 
-    void syncRegvalFromPin(const char *name, void *data, size_t size);
+    void syncRegvalFromPin(PinThread &t, const char *name, void *data,
+                           size_t size);
     template <typename T>
-    T syncRegvalFromPin(const char *name);
-    void syncRegFromPin(const char *name, const RegId &reg);
+    T syncRegvalFromPin(PinThread &t, const char *name);
+    void syncRegFromPin(PinThread &t, const char *name, const RegId &reg);
     
 
-    void handlePageFault(Addr vaddr);
-    void handleSyscall();
+    void handlePageFault(PinThread &t, Addr vaddr);
+    /// Map the pages of [vaddr, vaddr + size) that are in the page table,
+    /// allocating any that are in a VMA. Returns the bytes mapped.
+    Addr mapRange(PinThread &t, MessageBatch &batch, Addr vaddr, Addr size);
+    void handleSyscall(PinThread &t, const PinSyscallCheck &check);
 
-    Tick doMMIOAccess(Addr paddr, void *data, int size, bool write);
+    Tick doMMIOAccess(PinThread &t, Addr paddr, void *data, int size,
+                      bool write);
 
-    void handleCPUID();
+    void handleCPUID(PinThread &t);
 
-    void haltContext();
+    /// The thread's syscall log, or null if we're not recording or
+    /// replaying.
+    SyscallLog *getSyscallLog(PinThread &t);
+    void recordSyscall(PinThread &t, SyscallLog &log);
+    void replaySyscall(PinThread &t, SyscallLog &log);
+    /// Guest virtual address of paddr in the thread's address space.
+    Addr frameToVaddr(PinThread &t, Addr paddr);
 
-    bool isPinRunning() const;
+    /// Fork a Pin process for the thread and copy its state over.
+    void startPin(PinThread &t);
+    /// Tell the thread's Pin process to exit and reap it.
+    void stopPin(PinThread &t);
 
-    void mapCode();
+    /// Get the pintool plugins' state (see Plugin::serialize).
+    std::string savePinState(PinThread &t);
+    /// Load t.pinState into the pintool plugins.
+    void loadPinState(PinThread &t);
+    /// Receive the result of a command or state save. The view is valid
+    /// until the thread's next command.
+    std::string_view recvCommandResult(PinThread &t);
+    /// Run a pintool command in the thread's Pin process.
+    std::string_view runPinCommand(PinThread &t, const std::string &command);
+    /// Run a pintool command in the first thread with a Pin process.
+    std::string_view runPinCommand(const std::string &command);
+
+    /// Whether thread 0's pintool has been given the targets.
+    bool targetsArmed = false;
+    /// Number of targets reached, as of the last break.
+    uint64_t _targetsReached = 0;
+
+    /// Give the targets to the thread's pintool unless it already has them
+    /// (e.g., from a checkpoint).
+    void armTargets(PinThread &t);
+    /// Check whether a break was for a target.
+    bool reachedTarget(PinThread &t);
+
+    bool isPinRunning(const PinThread &t) const;
+
+    void mapCode(PinThread &t);
 
   public:
     std::string executePinCommand(const std::string &command);
+    /// Like executePinCommand(), but without copying the result. The view
+    /// is only valid until the next command.
+    pybind11::memoryview executePinCommandView(const std::string &command);
+    uint64_t targetsReached() const { return _targetsReached; }
+
+  private:
+    /// Why Pin returned to gem5 (see StatGroup::stopReasons).
+    enum StopReason
+    {
+        StopPageFault,
+        StopSyscall,
+        StopCpuid,
+        StopBreak,
+        StopInstBudget,
+        StopOther,
+        NumStopReasons
+    };
+
+    struct StatGroup : public statistics::Group
+    {
+        StatGroup(statistics::Group *parent);
+        statistics::Scalar numStops;
+        statistics::Scalar regBytesToPin;
+        statistics::Scalar regBytesFromPin;
+        statistics::Formula regBytesPerStop;
+        statistics::Scalar fastSyscallChecks;
+        statistics::Formula pageFaults;
+        statistics::Scalar avoidedFaults;
+        statistics::Scalar eagerMappedBytes;
+
+        statistics::Vector stopReasons;
+        statistics::SparseHistogram syscalls;
+        statistics::Scalar commands;
+        // Host time, in nanoseconds.
+        statistics::Histogram pinNs;
+        statistics::Histogram roundTripNs;
+        statistics::Histogram handlerNs;
+        // Indexed by message type, including any data streamed after the
+        // message.
+        statistics::Vector bytesToPin;
+        statistics::Vector bytesFromPin;
+    } stats;
+
+    /**
+     * Counts the bytes in each message and times each exchange: the time
+     * from sending a Run request to its response is time spent in Pin;
+     * for any other request, it's the round-trip latency.
+     */
+    class MessageStats final : public ChannelObserver
+    {
+      public:
+        MessageStats(StatGroup &stats) : stats(stats) {}
+
+        void sent(const Message &msg) override;
+        void received(const Message &msg) override;
+
+      private:
+        StatGroup &stats;
+        bool lastSentRun = false;
+        uint64_t lastSentNs = 0;
+    } messageStats;
 };
 
 }
@@ -1,9 +1,10 @@
 #include "cpu/pin/message.hh"
 
+#include <cassert>
 #include <cstdlib>
-#include <unistd.h>
 
 #include "base/logging.hh"
+#include "cpu/pin/channel.hh"
 #include "debug/Pin.hh"
 
 namespace gem5
@@ -13,37 +14,58 @@ namespace pin
 {
 
 void
-Message::send(int fd) const
+Message::send(Channel &chan)
 {
-    const uint8_t *data = reinterpret_cast<const uint8_t *>(this);
-    size_t size = sizeof *this;
-    while (size > 0) {
-        ssize_t bytes_written;
-        if ((bytes_written = write(fd, data, size)) < 0)
-            panic("Failed to write message!\n");
-        data += bytes_written;
-        size -= bytes_written;
-    }
+    size = pinmsg_payload_size(this);
+    assert(size <= PINMSG_PAYLOAD_MAX);
+    chan.write(this, PINMSG_HEADER_SIZE + size);
+    if (chan.observer)
+        chan.observer->sent(*this);
 }
 
 void
-Message::recv(int fd)
+Message::recv(Channel &chan)
 {
-    // inform("receiving message\n");
     type = (Type) -1;
-    uint8_t *data = reinterpret_cast<uint8_t *>(this);
-    size_t size = sizeof *this;
-    while (size > 0) {
-        ssize_t bytes_read = read(fd, data, size);
-        if (bytes_read < 0) {
-            panic("read failed: %s\n", std::strerror(errno));
-        } else if (bytes_read == 0) {
-            panic("Pin closed the pipe!\n");
-        }
-        data += bytes_read;
-        size -= bytes_read;
-    }
-    // inform("received message (type=%i)\n", type);
+    chan.read(this, PINMSG_HEADER_SIZE);
+    panic_if(size > PINMSG_PAYLOAD_MAX,
+             "Received message with bad payload size (%u)!\n", size);
+    chan.read(&map, size);
+    if (chan.observer)
+        chan.observer->received(*this);
+}
+
+const char *
+messageTypeName(Message::Type type)
+{
+    static const char *const names[] = {
+        "invalid",
+        "ack",
+        "map",
+        "setReg",
+        "abort",
+        "run",
+        "pageFault",
+        "syscall",
+        "getReg",
+        "cpuid",
+        "exit",
+        "getRegs",
+        "setRegs",
+        "unmap",
+        "addSymbol",
+        "execCommand",
+        "commandResult",
+        "break",
+        "batch",
+        "setSyscallState",
+        "instBudget",
+        "saveState",
+        "loadState",
+        "commandResultShared",
+    };
+    static_assert(sizeof names / sizeof names[0] == Message::NumTypes);
+    return type < Message::NumTypes ? names[type] : "unknown";
 }
 
 std::ostream &
@@ -62,6 +84,9 @@ operator<<(std::ostream &os, const Message &msg)
             os << buf;
         }
         break;
+      case Message::Batch:
+        os << "BATCH, .count=" << msg.batch.count;
+        break;
       default:
         panic("unhandled message type!\n");
     }
@@ -69,5 +94,53 @@ operator<<(std::ostream &os, const Message &msg)
     return os;
 }
 
+MessageBatch::MessageBatch(Channel &chan)
+    : chan(chan)
+{
+    msg.type = Message::Batch;
+    msg.batch.count = 0;
+}
+
+MessageBatch::~MessageBatch()
+{
+    assert(msg.batch.count == 0);
+}
+
+void
+MessageBatch::add(Message::Type type, const PinMapping &map)
+{
+    if (msg.batch.count == PINMSG_BATCH_MAX)
+        flush();
+    PinBatchEntry &entry = msg.batch.entries[msg.batch.count++];
+    entry.type = type;
+    entry.map = map;
+}
+
+void
+MessageBatch::map(uint64_t vaddr, uint64_t paddr, uint64_t size,
+                  uint64_t prot)
+{
+    add(Message::Map, PinMapping{vaddr, paddr, size, prot});
+}
+
+void
+MessageBatch::unmap(uint64_t vaddr, uint64_t size)
+{
+    add(Message::Unmap, PinMapping{vaddr, 0, size, 0});
+}
+
+void
+MessageBatch::flush()
+{
+    if (msg.batch.count == 0)
+        return;
+    msg.send(chan);
+
+    Message resp;
+    resp.recv(chan);
+    panic_if(resp.type != Message::Ack, "unexpected response\n");
+    msg.batch.count = 0;
+}
+
 }
 }
@@ -1,13 +1,16 @@
 #pragma once
 
 #ifdef __cplusplus
+# include <cstddef>
 # include <cstdint>
 # include <ostream>
 #else
+# include <stddef.h>
 # include <stdint.h>
 #endif
 
 #include "regfile.h"
+#include "shared.h"
 
 #ifdef __cplusplus
 
@@ -17,9 +20,35 @@ namespace gem5
 namespace pin
 {
 
+class Channel;
+
+# define PINMSG_TYPE(t) Message::t
+#else
+# define PINMSG_TYPE(t) t
 #endif
 
+/// Maximum number of map/unmap operations carried by one Batch message.
+#define PINMSG_BATCH_MAX 64
+
+struct PinMapping
+{
+    // TODO: Use gem5 Addr.
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t size;
+    uint64_t prot;
+};
+
+struct PinBatchEntry
+{
+    uint64_t type; // Map or Unmap.
+    struct PinMapping map;
+};
+
 // TODO: Split up into separate requests and respones.
+// Messages are framed on the wire: a fixed header (type, size, inst_count)
+// followed by `size` bytes of payload. Only the union member used by the
+// message's type is sent; see pinmsg_payload_size().
 struct Message
 {
     enum Type
@@ -42,18 +71,28 @@ struct Message
         ExecCommand,
         CommandResult,
         Break,
+        Batch,
+        SetSyscallState,
+        InstBudget, // Run response: the instruction budget expired.
+        SaveState, // Response: CommandResult followed by the state.
+        LoadState, // Followed by state_size bytes of state. Response: Ack.
+        // Like CommandResult, but the result is in the shared result region
+        // rather than following the message.
+        CommandResultShared,
         NumTypes
     } type;
+    uint32_t size; // Payload size in bytes; filled in by send.
+    uint64_t inst_count; // Valid for all responses to RUN requests.
+
     union
     {
+        struct PinMapping map; // For Type::Map, Type::Unmap
+
         struct
         {
-            // TODO: Use gem5 Addr.
-            uint64_t vaddr;
-            uint64_t paddr;
-            uint64_t size;
-            uint64_t prot;
-        } map; // For Type::Map
+            uint32_t count;
+            struct PinBatchEntry entries[PINMSG_BATCH_MAX];
+        } batch; // For Type::Batch
 
         struct
         {
@@ -64,7 +103,17 @@ struct Message
 
         uint64_t faultaddr; // for PageFault
 
-        struct PinRegFile regfile; // Valid for GetRegs, SetRegs.
+        struct PinRunArgs run; // For Run
+
+        struct PinSyscallCheck syscall_check; // For Syscall
+
+        struct PinSyscallState syscall_state; // For SetSyscallState
+
+        struct
+        {
+            uint32_t mask; // PINREG_* groups requested or present in data.
+            uint8_t data[sizeof(struct PinRegFile)]; // See pinregs_pack().
+        } regs; // For GetRegs (mask only), SetRegs.
 
         struct {
             char name[64];
@@ -73,19 +122,88 @@ struct Message
 
         char command[64];
         uint64_t command_result_size;
+        uint64_t state_size; // For LoadState
     };
 
-    uint64_t inst_count; // Valid for all responses to RUN requests.
-    
 #ifdef __cplusplus
     // TODO: Make these members of the pin::CPU class or the PinProcess class.
-    void send(int sockfd) const;
-    void recv(int sockfd);
+    void send(Channel &chan);
+    void recv(Channel &chan);
 #endif
 };
 
+#define PINMSG_HEADER_SIZE offsetof(struct Message, map)
+#define PINMSG_PAYLOAD_MAX (sizeof(struct Message) - PINMSG_HEADER_SIZE)
+
+/// Number of payload bytes that follow the header for this message.
+static inline size_t
+pinmsg_payload_size(const struct Message *msg)
+{
+    switch (msg->type) {
+      case PINMSG_TYPE(Map):
+      case PINMSG_TYPE(Unmap):
+        return sizeof msg->map;
+      case PINMSG_TYPE(SetReg):
+      case PINMSG_TYPE(GetReg):
+        return sizeof msg->reg;
+      case PINMSG_TYPE(PageFault):
+        return sizeof msg->faultaddr;
+      case PINMSG_TYPE(Run):
+        return sizeof msg->run;
+      case PINMSG_TYPE(Syscall):
+        return sizeof msg->syscall_check;
+      case PINMSG_TYPE(SetSyscallState):
+        return sizeof msg->syscall_state;
+      case PINMSG_TYPE(GetRegs):
+        return sizeof msg->regs.mask;
+      case PINMSG_TYPE(SetRegs):
+        return offsetof(struct Message, regs.data) - PINMSG_HEADER_SIZE +
+            pinregs_size(msg->regs.mask);
+      case PINMSG_TYPE(AddSymbol):
+        return sizeof msg->symbol;
+      case PINMSG_TYPE(ExecCommand):
+        return sizeof msg->command;
+      case PINMSG_TYPE(CommandResult):
+      case PINMSG_TYPE(CommandResultShared):
+        return sizeof msg->command_result_size;
+      case PINMSG_TYPE(LoadState):
+        return sizeof msg->state_size;
+      case PINMSG_TYPE(Batch):
+        return offsetof(struct Message, batch.entries) - PINMSG_HEADER_SIZE +
+            msg->batch.count * sizeof msg->batch.entries[0];
+      default:
+        return 0;
+    }
+}
+
 #ifdef __cplusplus
 std::ostream &operator<<(std::ostream &os, const Message &msg);
+
+/// Name of a message type, e.g. for stats.
+const char *messageTypeName(Message::Type type);
+
+/**
+ * Accumulates map/unmap operations and sends them to Pin in as few Batch
+ * messages as possible.
+ */
+class MessageBatch
+{
+  public:
+    MessageBatch(Channel &chan);
+    ~MessageBatch();
+
+    void map(uint64_t vaddr, uint64_t paddr, uint64_t size, uint64_t prot);
+    void unmap(uint64_t vaddr, uint64_t size);
+
+    /// Send any pending operations and wait for Pin to acknowledge them.
+    void flush();
+
+  private:
+    void add(Message::Type type, const PinMapping &map);
+
+    Channel &chan;
+    Message msg;
+};
 #endif
 
 #ifdef __cplusplus
@@ -1,8 +1,10 @@
 #pragma once
 
 #ifdef __cplusplus
+# include <cstddef>
 # include <cstdint>
 #else
+# include <stddef.h>
 # include <stdint.h>
 #endif
 
@@ -23,3 +25,159 @@ struct PinRegFile
     uint16_t fs, gs;
     uint64_t fs_base, gs_base;
 };
+
+// Register groups, used to transfer only part of the register file. Each
+// group is a contiguous range of PinRegFile.
+enum PinRegGroup
+{
+    PINREG_GROUP_RAX,
+    PINREG_GROUP_RBX,
+    PINREG_GROUP_RCX,
+    PINREG_GROUP_RDX,
+    PINREG_GROUP_RSI,
+    PINREG_GROUP_RDI,
+    PINREG_GROUP_RSP,
+    PINREG_GROUP_RBP,
+    PINREG_GROUP_R8,
+    PINREG_GROUP_R9,
+    PINREG_GROUP_R10,
+    PINREG_GROUP_R11,
+    PINREG_GROUP_R12,
+    PINREG_GROUP_R13,
+    PINREG_GROUP_R14,
+    PINREG_GROUP_R15,
+    PINREG_GROUP_RIP,
+    PINREG_GROUP_X87, // fprs
+    PINREG_GROUP_XMM, // xmms
+    PINREG_GROUP_FPCTRL, // fcw, fsw, ftag
+    PINREG_GROUP_RFLAGS,
+    PINREG_GROUP_SEG, // fs, gs
+    PINREG_GROUP_FS_BASE,
+    PINREG_GROUP_GS_BASE,
+    PINREG_NUM_GROUPS
+};
+
+#define PINREG(group) ((uint32_t) 1 << PINREG_GROUP_##group)
+#define PINREG_ALL (((uint32_t) 1 << PINREG_NUM_GROUPS) - 1)
+
+struct PinRegField
+{
+    uint16_t offset;
+    uint16_t size;
+};
+
+#define PINREG_FIELD(first, last)                                       \
+    { offsetof(struct PinRegFile, first),                               \
+      offsetof(struct PinRegFile, last) + sizeof(((struct PinRegFile *) 0)->last) - \
+      offsetof(struct PinRegFile, first) }
+
+static const struct PinRegField pinreg_fields[PINREG_NUM_GROUPS] = {
+    PINREG_FIELD(rax, rax),
+    PINREG_FIELD(rbx, rbx),
+    PINREG_FIELD(rcx, rcx),
+    PINREG_FIELD(rdx, rdx),
+    PINREG_FIELD(rsi, rsi),
+    PINREG_FIELD(rdi, rdi),
+    PINREG_FIELD(rsp, rsp),
+    PINREG_FIELD(rbp, rbp),
+    PINREG_FIELD(r8, r8),
+    PINREG_FIELD(r9, r9),
+    PINREG_FIELD(r10, r10),
+    PINREG_FIELD(r11, r11),
+    PINREG_FIELD(r12, r12),
+    PINREG_FIELD(r13, r13),
+    PINREG_FIELD(r14, r14),
+    PINREG_FIELD(r15, r15),
+    PINREG_FIELD(rip, rip),
+    PINREG_FIELD(fprs, fprs),
+    PINREG_FIELD(xmms, xmms),
+    PINREG_FIELD(fcw, ftag),
+    PINREG_FIELD(rflags, rflags),
+    PINREG_FIELD(fs, gs),
+    PINREG_FIELD(fs_base, fs_base),
+    PINREG_FIELD(gs_base, gs_base),
+};
+
+#undef PINREG_FIELD
+
+// NOTE: These are shared with the freestanding kernel, so they can't call
+// into libc.
+
+/// Number of bytes that pinregs_pack() produces for this mask.
+static inline size_t
+pinregs_size(uint32_t mask)
+{
+    size_t size = 0;
+    for (int i = 0; i < PINREG_NUM_GROUPS; ++i)
+        if (mask & ((uint32_t) 1 << i))
+            size += pinreg_fields[i].size;
+    return size;
+}
+
+/// Copy the groups in mask out of rf into buf. Returns the number of bytes
+/// written.
+static inline size_t
+pinregs_pack(const struct PinRegFile *rf, uint32_t mask, uint8_t *buf)
+{
+    const uint8_t *src = (const uint8_t *) rf;
+    size_t size = 0;
+    for (int i = 0; i < PINREG_NUM_GROUPS; ++i) {
+        if (!(mask & ((uint32_t) 1 << i)))
+            continue;
+        const struct PinRegField *f = &pinreg_fields[i];
+        for (uint16_t j = 0; j < f->size; ++j)
+            buf[size++] = src[f->offset + j];
+    }
+    return size;
+}
+
+/// Inverse of pinregs_pack(). Groups not in mask are left untouched.
+static inline size_t
+pinregs_unpack(struct PinRegFile *rf, uint32_t mask, const uint8_t *buf)
+{
+    uint8_t *dst = (uint8_t *) rf;
+    size_t size = 0;
+    for (int i = 0; i < PINREG_NUM_GROUPS; ++i) {
+        if (!(mask & ((uint32_t) 1 << i)))
+            continue;
+        const struct PinRegField *f = &pinreg_fields[i];
+        for (uint16_t j = 0; j < f->size; ++j)
+            dst[f->offset + j] = buf[size++];
+    }
+    return size;
+}
+
+/// Returns the mask of groups whose contents differ between a and b.
+static inline uint32_t
+pinregs_diff(const struct PinRegFile *a, const struct PinRegFile *b)
+{
+    const uint8_t *pa = (const uint8_t *) a;
+    const uint8_t *pb = (const uint8_t *) b;
+    uint32_t mask = 0;
+    for (int i = 0; i < PINREG_NUM_GROUPS; ++i) {
+        const struct PinRegField *f = &pinreg_fields[i];
+        for (uint16_t j = 0; j < f->size; ++j) {
+            if (pa[f->offset + j] != pb[f->offset + j]) {
+                mask |= (uint32_t) 1 << i;
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+/// Copy the groups in mask from src to dst.
+static inline void
+pinregs_copy(struct PinRegFile *dst, const struct PinRegFile *src,
+             uint32_t mask)
+{
+    uint8_t *pd = (uint8_t *) dst;
+    const uint8_t *ps = (const uint8_t *) src;
+    for (int i = 0; i < PINREG_NUM_GROUPS; ++i) {
+        if (!(mask & ((uint32_t) 1 << i)))
+            continue;
+        const struct PinRegField *f = &pinreg_fields[i];
+        for (uint16_t j = 0; j < f->size; ++j)
+            pd[f->offset + j] = ps[f->offset + j];
+    }
+}
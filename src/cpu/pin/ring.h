@@ -0,0 +1,168 @@
+#pragma once
+
+// Single-producer single-consumer byte ring shared between gem5 and the Pin
+// kernel. Used by the shared-memory transport in place of the request and
+// response pipes. Both sides spin for a configurable number of iterations
+// and then sleep on a futex.
+//
+// This header is included by both gem5 (C++) and the Pin kernel (freestanding
+// C), so it must not depend on any library functions. Each side provides its
+// own pin_ring_futex().
+
+#ifdef __cplusplus
+# include <cstddef>
+# include <cstdint>
+#else
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+#endif
+
+#define PIN_RING_SIZE ((uint64_t) 1 << 16)
+#define PIN_RING_MASK (PIN_RING_SIZE - 1)
+
+#define PIN_RING_FUTEX_WAIT 0
+#define PIN_RING_FUTEX_WAKE 1
+
+struct PinRing
+{
+    // Producer-owned.
+    uint64_t head __attribute__((aligned(64)));
+    uint32_t data_seq; // Futex word: bumped after each publish.
+    uint32_t producer_waiting;
+
+    // Consumer-owned.
+    uint64_t tail __attribute__((aligned(64)));
+    uint32_t space_seq; // Futex word: bumped after each consume.
+    uint32_t consumer_waiting;
+
+    uint8_t data[PIN_RING_SIZE] __attribute__((aligned(64)));
+};
+
+struct PinChannelShared
+{
+    uint64_t spin; // Polling iterations before sleeping on the futex.
+    struct PinRing req; // gem5 -> kernel
+    struct PinRing resp; // kernel -> gem5
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Returns a negative value if the wait timed out or was interrupted; the
+/// ring functions simply retry in that case. `arg` is passed through
+/// unmodified from pin_ring_read() and pin_ring_write().
+long pin_ring_futex(uint32_t *uaddr, int op, uint32_t val, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline void
+pin_ring_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline uint64_t
+pin_ring_load(const uint64_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+/// Wait until *word != value. `seq` is the futex word that the other side
+/// bumps whenever *word changes.
+static inline void
+pin_ring_wait(const uint64_t *word, uint64_t value, uint32_t *seq,
+              uint32_t *waiting, uint64_t spin, void *arg)
+{
+    for (uint64_t i = 0; i < spin; ++i) {
+        if (pin_ring_load(word) != value)
+            return;
+        pin_ring_relax();
+    }
+
+    while (true) {
+        const uint32_t cur_seq = __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (pin_ring_load(word) != value)
+            break;
+        pin_ring_futex(seq, PIN_RING_FUTEX_WAIT, cur_seq, arg);
+        if (pin_ring_load(word) != value)
+            break;
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+pin_ring_notify(uint32_t *seq, uint32_t *waiting, void *arg)
+{
+    __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+        pin_ring_futex(seq, PIN_RING_FUTEX_WAKE, 1, arg);
+}
+
+static inline void
+pin_ring_write(struct PinRing *ring, const void *data_, size_t size,
+               uint64_t spin, void *arg)
+{
+    const uint8_t *data = (const uint8_t *) data_;
+    uint64_t head = ring->head;
+    while (size > 0) {
+        const uint64_t tail = pin_ring_load(&ring->tail);
+        const uint64_t space = PIN_RING_SIZE - (head - tail);
+        if (space == 0) {
+            pin_ring_wait(&ring->tail, tail, &ring->space_seq,
+                          &ring->producer_waiting, spin, arg);
+            continue;
+        }
+
+        uint64_t chunk = size < space ? size : space;
+        const uint64_t contig = PIN_RING_SIZE - (head & PIN_RING_MASK);
+        if (chunk > contig)
+            chunk = contig;
+        uint8_t *dst = &ring->data[head & PIN_RING_MASK];
+        for (uint64_t i = 0; i < chunk; ++i)
+            dst[i] = data[i];
+
+        data += chunk;
+        size -= chunk;
+        head += chunk;
+        __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+        pin_ring_notify(&ring->data_seq, &ring->consumer_waiting, arg);
+    }
+}
+
+static inline void
+pin_ring_read(struct PinRing *ring, void *data_, size_t size, uint64_t spin,
+              void *arg)
+{
+    uint8_t *data = (uint8_t *) data_;
+    uint64_t tail = ring->tail;
+    while (size > 0) {
+        const uint64_t head = pin_ring_load(&ring->head);
+        const uint64_t avail = head - tail;
+        if (avail == 0) {
+            pin_ring_wait(&ring->head, head, &ring->data_seq,
+                          &ring->consumer_waiting, spin, arg);
+            continue;
+        }
+
+        uint64_t chunk = size < avail ? size : avail;
+        const uint64_t contig = PIN_RING_SIZE - (tail & PIN_RING_MASK);
+        if (chunk > contig)
+            chunk = contig;
+        const uint8_t *src = &ring->data[tail & PIN_RING_MASK];
+        for (uint64_t i = 0; i < chunk; ++i)
+            data[i] = src[i];
+
+        data += chunk;
+        size -= chunk;
+        tail += chunk;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+        pin_ring_notify(&ring->space_seq, &ring->producer_waiting, arg);
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+// Structures shared between gem5, the Pin kernel, and the pintool.
+
+#ifdef __cplusplus
+# include <cstdint>
+#else
+# include <stdint.h>
+#endif
+
+/// Arguments passed along with each Run request.
+struct PinRunArgs
+{
+    uint64_t time_ns; // Simulated time (curTick() in ns) for time syscalls.
+    uint64_t max_insts; // Instruction budget for this run (0: unlimited).
+    // Simulated picoseconds per instruction, to advance time_ns during the
+    // run (0: time only advances between runs).
+    uint64_t ps_per_inst;
+};
+
+#define PIN_SYSCALL_STATE_FDS 3
+
+/**
+ * Process state that the pintool needs to service syscalls on the fast
+ * path (see the pintool's -fast_syscalls option). gem5 resends it whenever
+ * it changes.
+ */
+struct PinSyscallState
+{
+    uint64_t pid;
+    uint64_t ppid;
+    uint64_t tid;
+    uint64_t uid;
+    uint64_t euid;
+    uint64_t gid;
+    uint64_t egid;
+    uint64_t brk;
+
+    // Host fd that Pin may write to directly for guest fds 0-2, or -1.
+    int32_t fds[PIN_SYSCALL_STATE_FDS];
+    int32_t pad;
+};
+
+#define PIN_SYSCALL_CHECK_DATA_MAX 16
+
+/**
+ * In fast syscall check mode, the pintool forwards fast-path syscalls to
+ * gem5 along with the result it would have produced, so that gem5 can
+ * check it against its own.
+ */
+struct PinSyscallCheck
+{
+    uint64_t valid;
+    uint64_t result; // Expected RAX.
+    uint64_t data_addr; // Expected guest memory contents, if data_size != 0.
+    uint64_t data_size;
+    uint8_t data[PIN_SYSCALL_CHECK_DATA_MAX];
+};
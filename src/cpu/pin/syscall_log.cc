@@ -0,0 +1,121 @@
+#include "cpu/pin/syscall_log.hh"
+
+#include <cassert>
+#include <cstring>
+
+#include "base/logging.hh"
+
+namespace gem5
+{
+
+namespace pin
+{
+
+namespace
+{
+
+const char magic[8] = {'P', 'I', 'N', 'S', 'Y', 'S', '0', '1'};
+
+}
+
+SyscallLog::SyscallLog(const std::string &path, Mode mode)
+    : _path(path), _mode(mode)
+{
+    if (mode == Record) {
+        file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        fatal_if(!file, "Failed to create syscall log %s\n", path);
+        put(magic, sizeof magic);
+    } else {
+        file.open(path, std::ios::in | std::ios::binary);
+        fatal_if(!file, "Failed to open syscall log %s\n", path);
+        char buf[sizeof magic];
+        get(buf, sizeof buf);
+        fatal_if(std::memcmp(buf, magic, sizeof magic) != 0,
+                 "%s is not a syscall log\n", path);
+    }
+}
+
+void
+SyscallLog::put(const void *data, size_t size)
+{
+    file.write(static_cast<const char *>(data), size);
+    fatal_if(!file, "Failed to write syscall log %s\n", _path);
+}
+
+void
+SyscallLog::get(void *data, size_t size)
+{
+    file.read(static_cast<char *>(data), size);
+    fatal_if(!file, "Syscall log %s ended after %d records\n", _path,
+             _position);
+}
+
+void
+SyscallLog::putSyscall(const Syscall &syscall)
+{
+    assert(_mode == Record);
+    put<uint8_t>(SyscallRecord);
+    put<uint64_t>(syscall.num);
+    put<uint64_t>(syscall.result);
+    put<uint32_t>(syscall.writes.size());
+    for (const Write &write : syscall.writes) {
+        put<uint64_t>(write.vaddr);
+        put<uint32_t>(write.data.size());
+        put(write.data.data(), write.data.size());
+    }
+    // Runs that record a log often end in a crash or a kill; keep every
+    // syscall up to that point.
+    file.flush();
+    fatal_if(!file, "Failed to write syscall log %s\n", _path);
+    ++_position;
+}
+
+void
+SyscallLog::putCpuid(const Cpuid &cpuid)
+{
+    assert(_mode == Record);
+    put<uint8_t>(CpuidRecord);
+    put(cpuid);
+    ++_position;
+}
+
+void
+SyscallLog::expect(RecordType type)
+{
+    assert(_mode == Replay);
+    const uint8_t got = get<uint8_t>();
+    fatal_if(got != type,
+             "Replay diverged: record %d of syscall log %s is a %s, "
+             "but the guest is doing a %s\n", _position, _path,
+             got == SyscallRecord ? "syscall" : "CPUID",
+             type == SyscallRecord ? "syscall" : "CPUID");
+}
+
+SyscallLog::Syscall
+SyscallLog::getSyscall()
+{
+    expect(SyscallRecord);
+    Syscall syscall;
+    syscall.num = get<uint64_t>();
+    syscall.result = get<uint64_t>();
+    syscall.writes.resize(get<uint32_t>());
+    for (Write &write : syscall.writes) {
+        write.vaddr = get<uint64_t>();
+        write.data.resize(get<uint32_t>());
+        get(write.data.data(), write.data.size());
+    }
+    ++_position;
+    return syscall;
+}
+
+SyscallLog::Cpuid
+SyscallLog::getCpuid()
+{
+    expect(CpuidRecord);
+    const Cpuid cpuid = get<Cpuid>();
+    ++_position;
+    return cpuid;
+}
+
+}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "base/types.hh"
+
+namespace gem5
+{
+
+namespace pin
+{
+
+/**
+ * Log of the answers gem5 gave a guest thread: each syscall's result and
+ * the guest memory it wrote, and each CPUID's result. A run recorded with
+ * one can be replayed without emulating those syscalls again.
+ *
+ * The file starts with a magic number and is followed by records, each a
+ * type byte and a fixed header; syscall records are followed by their
+ * writes (vaddr, size, data). Integers are in host byte order.
+ */
+class SyscallLog
+{
+  public:
+    enum Mode
+    {
+        Record,
+        Replay,
+    };
+
+    struct Write
+    {
+        Addr vaddr;
+        std::vector<uint8_t> data;
+    };
+
+    struct Syscall
+    {
+        uint64_t num;
+        uint64_t result;
+        std::vector<Write> writes;
+    };
+
+    struct Cpuid
+    {
+        uint32_t func;
+        uint32_t index;
+        uint64_t rax, rbx, rcx, rdx;
+    };
+
+    SyscallLog(const std::string &path, Mode mode);
+
+    Mode mode() const { return _mode; }
+    const std::string &path() const { return _path; }
+    /// Number of records written or read so far.
+    uint64_t position() const { return _position; }
+
+    void putSyscall(const Syscall &syscall);
+    void putCpuid(const Cpuid &cpuid);
+
+    /// Read the next record, which must be of the given type.
+    Syscall getSyscall();
+    Cpuid getCpuid();
+
+  private:
+    enum RecordType : uint8_t
+    {
+        SyscallRecord = 1,
+        CpuidRecord = 2,
+    };
+
+    void expect(RecordType type);
+    void put(const void *data, size_t size);
+    void get(void *data, size_t size);
+
+    template <typename T>
+    void put(T x) { put(&x, sizeof x); }
+
+    template <typename T>
+    T
+    get()
+    {
+        T x;
+        get(&x, sizeof x);
+        return x;
+    }
+
+    std::string _path;
+    Mode _mode;
+    std::fstream file;
+    uint64_t _position = 0;
+};
+
+}
+}
@@ -79,6 +79,9 @@ struct AddressCountPlugin final : Plugin
         result = std::to_string(addrcount);
         return true;
     }
+
+    void serialize(std::ostream &os) const override { os << addrcount; }
+    void unserialize(std::istream &is) override { is >> addrcount; }
 } plugin;
 
 }
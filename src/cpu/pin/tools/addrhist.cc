@@ -87,6 +87,23 @@ struct AddressHistogramPlugin final : Plugin
         Dump(result);
         return true;
     }
+
+    void
+    serialize(std::ostream &os) const override
+    {
+        for (std::size_t addr = 0; addr < max_addr; ++addr)
+            if (const uint32_t count = hist[addr])
+                os << addr << ' ' << count << '\n';
+    }
+
+    void
+    unserialize(std::istream &is) override
+    {
+        std::size_t addr;
+        uint32_t count;
+        while (is >> addr >> count)
+            hist.at(addr) = count;
+    }
     
 } plugin;
 
@@ -1,9 +1,12 @@
 #include <pin.H>
+#include <algorithm>
+#include <chrono>
 #include <vector>
 #include <iostream>
-#include <map>
+#include <string>
 
 #include "client.hh"
+#include "flattable.hh"
 #include "plugin.hh"
 
 namespace
@@ -23,7 +26,35 @@ getInstVec(BBL bbl)
 }
 #endif
 
-std::map<ADDRINT, std::map<ADDRINT, uint64_t>> count;
+struct Edge
+{
+    ADDRINT src;
+    ADDRINT dst;
+
+    bool operator==(const Edge &o) const { return src == o.src && dst == o.dst; }
+    bool operator<(const Edge &o) const { return src != o.src ? src < o.src : dst < o.dst; }
+};
+
+struct EdgeHash
+{
+    uint64_t
+    operator()(const Edge &e) const
+    {
+        return mixHash(e.src ^ mixHash(e.dst));
+    }
+};
+
+FlatTable<Edge, uint64_t, EdgeHash> count;
+
+// Instrumentation-time cost (see 'bbehist stats').
+uint64_t num_instrumented = 0;
+uint64_t instrument_ns = 0;
+
+uint64_t *
+getCounter(ADDRINT src, ADDRINT dst)
+{
+    return &count.emplace(Edge{src, dst}, 0).first->value;
+}
 
 void
 increment(uint64_t *counter)
@@ -36,12 +67,14 @@ InstrumentTRACE(TRACE trace, void *)
 {
     if (IsKernelCode(trace))
         return;
+    const auto start = std::chrono::steady_clock::now();
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        ++num_instrumented;
         INS tail = BBL_InsTail(bbl);
         if (INS_IsDirectControlFlow(tail)) {
             const ADDRINT src = INS_Address(tail);
             const ADDRINT taken_target = INS_DirectControlFlowTargetAddress(tail);
-            uint64_t *taken_count = &count[src][taken_target];
+            uint64_t *taken_count = getCounter(src, taken_target);
             // Taken path.
             INS_InsertCall(tail, IPOINT_TAKEN_BRANCH, (AFUNPTR) increment,
                            IARG_PTR, taken_count,
@@ -49,7 +82,7 @@ InstrumentTRACE(TRACE trace, void *)
             // Not-taken path.
             if (INS_HasFallThrough(tail)) {
                 const ADDRINT nottaken_target = INS_NextAddress(tail);
-                uint64_t *nottaken_count = &count[src][nottaken_target];
+                uint64_t *nottaken_count = getCounter(src, nottaken_target);
                 INS_InsertCall(tail, IPOINT_AFTER, (AFUNPTR) increment,
                                IARG_PTR, nottaken_count,
                                IARG_END);
@@ -58,6 +91,8 @@ InstrumentTRACE(TRACE trace, void *)
             // TODO
         }
     }
+    instrument_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
 }
 
     
@@ -91,12 +126,38 @@ struct BasicBlockEdgeHistogramPlugin final : Plugin
             std::cerr << "TODO\n";
             std::abort();
             return true;
+        } else if (args.at(0) == "stats") {
+            result += "edges " + std::to_string(count.size()) + '\n';
+            result += "instrumented " + std::to_string(num_instrumented) + '\n';
+            result += "instrument_ns " + std::to_string(instrument_ns) + '\n';
+            return true;
         }
 
         std::cerr << name() << ": error: bad usage\n";
-        std::cerr << "usage: " << name() << " dump\n";
+        std::cerr << "usage: " << name() << " (dump|stats)\n";
         std::abort();
     }
+
+    void
+    serialize(std::ostream &os) const override
+    {
+        std::vector<std::pair<Edge, uint64_t>> edges;
+        for (const auto &entry : count)
+            if (entry.value)
+                edges.emplace_back(entry.key, entry.value);
+        std::sort(edges.begin(), edges.end());
+        for (const auto &[edge, n] : edges)
+            os << edge.src << ' ' << edge.dst << ' ' << n << '\n';
+    }
+
+    void
+    unserialize(std::istream &is) override
+    {
+        ADDRINT src, dst;
+        uint64_t n;
+        while (is >> src >> dst >> n)
+            *getCounter(src, dst) = n;
+    }
 } plugin;
 
 }
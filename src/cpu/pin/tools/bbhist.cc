@@ -1,45 +1,105 @@
 #include <vector>
-#include <map>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <string>
+#include <sstream>
 #include <pin.H>
 
 #include "plugin.hh"
 #include "client.hh"
-#include "util.hh"
+#include "flattable.hh"
+#include "xxhash.hh"
 
 namespace {
 
 KNOB<bool> enable(KNOB_MODE_WRITEONCE, "pintool", "bbhist", "0", "Enable basic block histogram collection");
 
-std::vector<ADDRINT>
-getInstVec(BBL bbl)
+// Blocks are identified by their start address and the sizes of their
+// instructions, i.e., by the addresses of their instructions. The sizes are
+// only kept (in inst_sizes) for naming blocks when they're dumped; the key
+// just holds a hash of them, which is only ambiguous if two blocks at the
+// same address with the same number of instructions collide.
+struct BlockKey
 {
-    std::vector<ADDRINT> insts;
-    for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
-        insts.push_back(INS_Address(ins));
-    return insts;
-}
+    ADDRINT pc;
+    uint32_t num_insts;
+    uint32_t layout; // Hash of the instruction sizes.
+
+    bool
+    operator==(const BlockKey &o) const
+    {
+        return pc == o.pc && num_insts == o.num_insts && layout == o.layout;
+    }
+};
+
+struct BlockKeyHash
+{
+    uint64_t
+    operator()(const BlockKey &key) const
+    {
+        return mixHash(key.pc ^ mixHash((uint64_t) key.num_insts << 32 | key.layout));
+    }
+};
 
 struct BlockData
 {
     ADDRINT hits;
-    std::string name;
+    size_t sizes; // Offset of the block's instruction sizes in inst_sizes.
 
-    BlockData(BBL bbl)
-        : hits(0)
+    BlockData(size_t sizes, ADDRINT hits = 0)
+        : hits(hits), sizes(sizes)
     {
-        name = getBlockName(bbl);
     }
 };
 
-std::map<std::vector<ADDRINT>, BlockData> blocks;
+using BlockTable = FlatTable<BlockKey, BlockData, BlockKeyHash>;
+BlockTable blocks;
+std::vector<uint8_t> inst_sizes;
+
+// Instrumentation-time cost (see 'bbhist stats').
+uint64_t num_instrumented = 0;
+uint64_t instrument_ns = 0;
+
+uint32_t
+layoutHash(const uint8_t *sizes, size_t n)
+{
+    return XXHash32::hash(sizes, n, 0);
+}
 
 BlockData &
 getBlockData(BBL bbl)
 {
-    return blocks.emplace(getInstVec(bbl), bbl).first->second;
+    // Instrumentation is serialized, so reuse the buffer.
+    static std::vector<uint8_t> sizes;
+    sizes.clear();
+    for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+        sizes.push_back(INS_Size(ins));
+
+    const BlockKey key{BBL_Address(bbl), (uint32_t) sizes.size(),
+                       layoutHash(sizes.data(), sizes.size())};
+    const auto [entry, inserted] = blocks.emplace(key, inst_sizes.size());
+    if (inserted)
+        inst_sizes.insert(inst_sizes.end(), sizes.begin(), sizes.end());
+    return entry->value;
+}
+
+// The block's instruction addresses, e.g. "401000,401004,401007".
+std::string
+getBlockName(const BlockTable::Entry &block)
+{
+    std::string name;
+    ADDRINT addr = block.key.pc;
+    const uint8_t *sizes = &inst_sizes[block.value.sizes];
+    for (uint32_t i = 0; i < block.key.num_insts; ++i) {
+        char buf[32];
+        std::sprintf(buf, "%s%lx", i ? "," : "", addr);
+        name += buf;
+        addr += sizes[i];
+    }
+    return name;
 }
 
 void
@@ -62,23 +122,92 @@ InstrumentTRACE(TRACE trace, void *)
 {
     if (IsKernelCode(trace))
         return;
-    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    const auto start = std::chrono::steady_clock::now();
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
         InstrumentBBL(bbl);
+        ++num_instrumented;
+    }
+    instrument_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Blocks with hits, ordered by their instruction addresses.
+std::vector<const BlockTable::Entry *>
+getHitBlocks()
+{
+    std::vector<const BlockTable::Entry *> hit;
+    for (const auto &block : blocks)
+        if (block.value.hits)
+            hit.push_back(&block);
+    std::sort(hit.begin(), hit.end(), [] (const auto *a, const auto *b) {
+        if (a->key.pc != b->key.pc)
+            return a->key.pc < b->key.pc;
+        const uint8_t *a_sizes = &inst_sizes[a->value.sizes];
+        const uint8_t *b_sizes = &inst_sizes[b->value.sizes];
+        return std::lexicographical_compare(a_sizes, a_sizes + a->key.num_insts,
+                                            b_sizes, b_sizes + b->key.num_insts);
+    });
+    return hit;
 }
 
 void
 Dump(std::string &s)
 {
-    for (const auto &[insts, block] : blocks)
-        if (block.hits)
-            s += std::to_string(block.hits) + ' ' + block.name + '\n';
+    for (const auto *block : getHitBlocks())
+        s += std::to_string(block->value.hits) + ' ' + getBlockName(*block) + '\n';
+}
+
+void
+Stats(std::string &s)
+{
+    s += "blocks " + std::to_string(blocks.size()) + '\n';
+    s += "instrumented " + std::to_string(num_instrumented) + '\n';
+    s += "instrument_ns " + std::to_string(instrument_ns) + '\n';
+}
+
+// Blocks are saved by their start address and instruction sizes, i.e., by
+// their full key.
+void
+Serialize(std::ostream &os)
+{
+    for (const auto *block : getHitBlocks()) {
+        os << block->value.hits << ' ' << block->key.pc << ' ';
+        const uint8_t *sizes = &inst_sizes[block->value.sizes];
+        for (uint32_t i = 0; i < block->key.num_insts; ++i)
+            os << (i ? "," : "") << (unsigned) sizes[i];
+        os << '\n';
+    }
+}
+
+void
+Unserialize(std::istream &is)
+{
+    ADDRINT hits, pc;
+    std::string sizes_str;
+    while (is >> hits >> pc >> sizes_str) {
+        std::vector<uint8_t> sizes;
+        std::istringstream ss(sizes_str);
+        unsigned size;
+        while (ss >> size) {
+            sizes.push_back(size);
+            ss.ignore(1, ',');
+        }
+        const BlockKey key{pc, (uint32_t) sizes.size(),
+                           layoutHash(sizes.data(), sizes.size())};
+        const auto [entry, inserted] =
+            blocks.emplace(key, inst_sizes.size(), hits);
+        if (inserted)
+            inst_sizes.insert(inst_sizes.end(), sizes.begin(), sizes.end());
+        else
+            entry->value.hits = hits;
+    }
 }
 
 void
 Reset()
 {
-    for (auto &[insts, block] : blocks)
-        block.hits = 0;
+    for (auto &block : blocks)
+        block.value.hits = 0;
 }
 
 struct BasicBlockHistogramPlugin final : Plugin
@@ -112,12 +241,18 @@ struct BasicBlockHistogramPlugin final : Plugin
         } else if (args.at(0) == "reset") {
             Reset();
             return true;
+        } else if (args.at(0) == "stats") {
+            Stats(result);
+            return true;
         }
 
         std::cerr << "bbhist: error: bad usage\n";
-        std::cerr << "usage: bbhist (dump|reset)\n";
+        std::cerr << "usage: bbhist (dump|reset|stats)\n";
         std::abort();
     }
+
+    void serialize(std::ostream &os) const override { Serialize(os); }
+    void unserialize(std::istream &is) override { Unserialize(is); }
 } plugin;
 
 }
@@ -7,12 +7,17 @@
 #include "client.hh"
 #include "xxhash.hh"
 #include "util.hh"
+#include "vecfile.hh"
 
 namespace {
 
 // TODO: Should make these enabled by the gem5 configuration script.
 KNOB<std::string> path(KNOB_MODE_WRITEONCE, "pintool", "bbtrace", "", "Write basic block trace to path");
+KNOB<std::string> format(KNOB_MODE_WRITEONCE, "pintool", "bbtrace-format", "raw",
+                         "Basic block trace format (raw: uint32 hashes, vec: see vecfile.hh)");
 std::ofstream os;
+VecWriter vec_os(1 << 16); // Blocks per chunk.
+bool use_vec = false;
 BUFFER_ID buffer;
 
 uint64_t fill_counter = 0;
@@ -55,18 +60,24 @@ trace_callback(BUFFER_ID, THREADID, const CONTEXT *, void *buf_, uint64_t nitems
         if (nitems)
             std::cerr << "[!] bbtrace: warning: detected falsely empty buffer, including elements past end\n";
     }
-    os.write((const char *) buf, nitems * sizeof(uint32_t));
+    if (use_vec)
+        vec_os.addTrace(buf, nitems);
+    else
+        os.write((const char *) buf, nitems * sizeof(uint32_t));
     std::fill_n(buf, nitems, 0);
     flush_counter += nitems;
-    std::cerr << "[*] bbtrace: flushing buffer with " << std::dec << nitems << "\n";
     return buf;
 }
 
 static void
 finish(int32_t code, void *)
 {
-    os.flush();
-    os.close();
+    if (use_vec) {
+        vec_os.close();
+    } else {
+        os.flush();
+        os.close();
+    }
     std::cerr << "bbtrace-fills " << std::dec << fill_counter << "\n";
     std::cerr << "bbtrace-flushes " << std::dec << flush_counter << "\n";
 }
@@ -88,13 +99,25 @@ struct BBTracePlugin final : Plugin
     {
         TRACE_AddInstrumentFunction(InstrumentTRACE, nullptr);
         buffer = PIN_DefineTraceBuffer(sizeof(UINT32), 32, trace_callback, nullptr);
-        os.open(path.Value(), os.binary);
-        if (!os) {
+        if (format.Value() == "vec") {
+            use_vec = true;
+        } else if (format.Value() != "raw") {
+            std::cerr << "[!] error: bbtrace: -bbtrace-format: must be raw or vec\n";
+            return false;
+        }
+        bool opened;
+        if (use_vec) {
+            opened = vec_os.open(path.Value(), VecWriter::Trace);
+        } else {
+            os.open(path.Value(), os.binary);
+            opened = static_cast<bool>(os);
+        }
+        if (!opened) {
             std::cerr << "[!] error: bbtrace: failed to open file: " << path.Value() << "\n";
             return false;
         }
         PIN_AddFiniFunction(finish, nullptr);
-        return static_cast<bool>(os);
+        return true;
     }
         
 } plugin;
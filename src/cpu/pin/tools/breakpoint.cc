@@ -1,16 +1,39 @@
 #include "breakpoint.hh"
 
+#include <deque>
+#include <limits>
 #include <list>
 #include <iostream>
+#include <sstream>
 #include <pin.H>
 
 #include "ops.hh"
 #include "client.hh"
 #include "plugin.hh"
 
-static std::map<std::string, const ADDRINT *> counters;
+struct Counter
+{
+    ADDRINT *value;
+    CounterUnits units;
+};
+
+static std::map<std::string, Counter> counters;
 static std::map<const ADDRINT *, ADDRINT> breakpoints;
 
+// Targets are increasing values of a single counter at which to stop, one
+// after the other. For counters with per-instruction units, we stop exactly
+// when the counter reaches the target, before its next unit executes.
+static std::string target_name;
+static const Counter *target_counter = nullptr;
+static std::deque<ADDRINT> targets;
+static ADDRINT next_target = std::numeric_limits<ADDRINT>::max();
+static ADDRINT targets_reached = 0;
+
+// When a target falls in the middle of a basic block, we re-instrument that
+// block to stop before the instruction with its stop_units'th unit.
+static ADDRINT stop_bbl = 0;
+static ADDRINT stop_units = 0;
+
 static void
 SetBreakpoint(const ADDRINT *counter, ADDRINT target)
 {
@@ -43,6 +66,144 @@ AnalyzeThen(CONTEXT *ctx, const ADDRINT *counter)
     PIN_ExecuteAt(ctx);
 }
 
+static void
+AddTarget(const std::string &name, const Counter &counter, ADDRINT target)
+{
+    if (target_counter && target_counter != &counter) {
+        std::cerr << "breakpoint: error: targets already set on counter "
+                  << target_name << ", not " << name << "\n";
+        std::abort();
+    }
+    if (!targets.empty() && target <= targets.back()) {
+        std::cerr << "breakpoint: error: targets must be increasing: "
+                  << target << " after " << targets.back() << "\n";
+        std::abort();
+    }
+    if (target <= *counter.value) {
+        std::cerr << "breakpoint: error: target " << target << " already "
+                  << "passed: " << name << " is " << *counter.value << "\n";
+        std::abort();
+    }
+
+    // Instrument for targets if this is the first one pending.
+    if (targets.empty())
+        PIN_RemoveInstrumentation();
+    target_name = name;
+    target_counter = &counter;
+    targets.push_back(target);
+    next_target = targets.front();
+}
+
+[[noreturn]] static void
+ReachTarget(CONTEXT *ctx)
+{
+    ++targets_reached;
+    targets.pop_front();
+    next_target = targets.empty() ? std::numeric_limits<ADDRINT>::max() : targets.front();
+    stop_bbl = 0;
+
+    RunResult result;
+    result.result = result.RUNRESULT_BREAK;
+    ContextSwitchToKernel(ctx, result);
+    PIN_ExecuteAt(ctx);
+    std::abort(); // TODO: Unreachable
+}
+
+static ADDRINT
+TargetIf()
+{
+    return *target_counter->value > next_target;
+}
+
+static void
+TargetThen(CONTEXT *ctx, ADDRINT bbl_addr, ADDRINT bbl_size, ADDRINT n,
+           ADDRINT first_unit_index)
+{
+    // The target is reached in this block.
+    ADDRINT &counter = *target_counter->value;
+    counter -= n;
+    const ADDRINT k = next_target - counter;
+    if (k == 0 && first_unit_index == 0)
+        ReachTarget(ctx);
+
+    if (stop_bbl == bbl_addr) {
+        // Already instrumented to stop partway through.
+        counter += n;
+        return;
+    }
+
+    stop_bbl = bbl_addr;
+    stop_units = k;
+    PIN_RemoveInstrumentationInRange(bbl_addr, bbl_addr + bbl_size - 1);
+    PIN_ExecuteAt(ctx);
+}
+
+static ADDRINT
+StopIf(ADDRINT bbl_addr)
+{
+    return stop_bbl == bbl_addr;
+}
+
+static void
+StopThen(CONTEXT *ctx)
+{
+    // The counter was advanced by the whole block on entry, but we stopped
+    // partway through.
+    *target_counter->value = next_target;
+    ReachTarget(ctx);
+}
+
+static void
+InstrumentExactTargets(TRACE trace)
+{
+    const CounterUnits units = target_counter->units;
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        const ADDRINT bbl_addr = BBL_Address(bbl);
+        ADDRINT n = 0;
+        ADDRINT first_unit_index = 0;
+        ADDRINT index = 0;
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins), ++index) {
+            const ADDRINT ins_units = units(ins);
+            if (ins_units == 0)
+                continue;
+            if (n == 0)
+                first_unit_index = index;
+            if (stop_bbl == bbl_addr && n == stop_units) {
+                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) StopIf,
+                                 IARG_CALL_ORDER, CALL_ORDER_FIRST,
+                                 IARG_ADDRINT, bbl_addr,
+                                 IARG_END);
+                INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR) StopThen,
+                                   IARG_CALL_ORDER, CALL_ORDER_FIRST,
+                                   IARG_CONTEXT,
+                                   IARG_END);
+            }
+            n += ins_units;
+        }
+        if (n == 0)
+            continue;
+
+        // Check after the counter itself has been advanced for the block.
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR) TargetIf,
+                         IARG_CALL_ORDER, CALL_ORDER_LAST,
+                         IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) TargetThen,
+                           IARG_CALL_ORDER, CALL_ORDER_LAST,
+                           IARG_CONTEXT,
+                           IARG_ADDRINT, bbl_addr,
+                           IARG_ADDRINT, BBL_Size(bbl),
+                           IARG_ADDRINT, n,
+                           IARG_ADDRINT, first_unit_index,
+                           IARG_END);
+    }
+}
+
+static ADDRINT
+InexactTargetIf()
+{
+    return *target_counter->value >= next_target;
+}
+
 static void
 Instrument(TRACE trace, void *)
 {
@@ -58,12 +219,35 @@ Instrument(TRACE trace, void *)
                              IARG_PTR, counter,
                              IARG_END);
     }
+
+    if (targets.empty())
+        return;
+    if (target_counter->units) {
+        InstrumentExactTargets(trace);
+    } else {
+        TRACE_InsertIfCall(trace, IPOINT_BEFORE, (AFUNPTR) InexactTargetIf,
+                           IARG_END);
+        TRACE_InsertThenCall(trace, IPOINT_BEFORE, (AFUNPTR) ReachTarget,
+                             IARG_CONTEXT,
+                             IARG_END);
+    }
 }
 
 void
-RegisterCounter(const std::string &name, const ADDRINT *counter)
+RegisterCounter(const std::string &name, ADDRINT *counter, CounterUnits units)
 {
-    counters[name] = counter;
+    counters[name] = Counter{counter, units};
+}
+
+static const Counter &
+FindCounter(const std::string &name)
+{
+    const auto counter_it = counters.find(name);
+    if (counter_it == counters.end()) {
+        std::cerr << "breakpoint: error: no such counter: " << name << "\n";
+        std::abort();
+    }
+    return counter_it->second;
 }
 
 namespace {
@@ -85,6 +269,22 @@ struct BreakpointPlugin final : Plugin
     bool
     command(const std::string &cmd, const std::vector<std::string> &args, std::string &result) override
     {
+        if (cmd == "target") {
+            if (args.size() != 2) {
+                std::cerr << "breakpoint: error: bad usage\n";
+                std::cerr << "usage: target <counter> <count>\n";
+                std::abort();
+            }
+            AddTarget(args.at(0), FindCounter(args.at(0)), std::stoull(args.at(1)));
+            return true;
+        }
+
+        // Report the number of targets reached and pending.
+        if (cmd == "targets") {
+            result = std::to_string(targets_reached) + " " + std::to_string(targets.size());
+            return true;
+        }
+
         if (cmd != "breakpoint")
             return false;
 
@@ -95,15 +295,60 @@ struct BreakpointPlugin final : Plugin
         }
 
         const ADDRINT target = std::stoull(args.at(1));
-        const std::string &counter_name = args.at(0);
-        const auto counter_it = counters.find(counter_name);
-        if (counter_it == counters.end()) {
-            std::cerr << "breakpoint: error: no such counter: " << counter_name << "\n";
-            std::abort();
+        SetBreakpoint(FindCounter(args.at(0)).value, target);
+        return true;
+    }
+
+    // Pending breakpoints are saved by counter name, one per line. Targets
+    // are saved on a line starting with "target", followed by the counter
+    // name, the number reached and the pending ones.
+    void
+    serialize(std::ostream &os) const override
+    {
+        for (const auto &[name, counter] : counters) {
+            const auto it = breakpoints.find(counter.value);
+            if (it != breakpoints.end() &&
+                it->second != std::numeric_limits<ADDRINT>::max())
+                os << name << ' ' << it->second << '\n';
         }
+        if (target_counter) {
+            os << "target " << target_name << ' ' << targets_reached;
+            for (ADDRINT target : targets)
+                os << ' ' << target;
+            os << '\n';
+        }
+    }
 
-        SetBreakpoint(counter_it->second, target);
-        return true;
+    void
+    unserialize(std::istream &is) override
+    {
+        std::string line;
+        while (std::getline(is, line)) {
+            std::istringstream ss(line);
+            std::string name;
+            if (!(ss >> name))
+                continue;
+
+            if (name == "target") {
+                ss >> name >> targets_reached;
+                const Counter &counter = FindCounter(name);
+                ADDRINT target;
+                while (ss >> target)
+                    AddTarget(name, counter, target);
+                continue;
+            }
+
+            ADDRINT target;
+            if (!(ss >> target))
+                continue;
+            const auto counter_it = counters.find(name);
+            if (counter_it == counters.end()) {
+                std::cerr << "breakpoint: warning: dropping breakpoint on unknown counter: " << name << "\n";
+                continue;
+            }
+            SetBreakpoint(counter_it->second.value, target);
+        }
+        stop_bbl = 0;
     }
 } plugin;
 }
@@ -1,6 +1,13 @@
 #pragma once
 
 #include <string>
+#include <pin.H>
+
+// Number of units an instruction adds to a counter when it executes.
+using CounterUnits = ADDRINT (*)(INS ins);
 
 // TODO: Move to separate file, like counters.hh/cc.
-void RegisterCounter(const std::string &name, const ADDRINT *counter);
+// Counters that provide their per-instruction units can stop exactly at
+// targets; the others are only checked at trace entry.
+void RegisterCounter(const std::string &name, ADDRINT *counter,
+                     CounterUnits units = nullptr);
@@ -45,6 +45,9 @@ struct CallCountPlugin final : Plugin
         PIN_AddFiniFunction(finish, nullptr);
         return true;
     }
+
+    void serialize(std::ostream &os) const override { os << callcount; }
+    void unserialize(std::istream &is) override { is >> callcount; }
 } plugin;
 
 }
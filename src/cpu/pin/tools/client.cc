@@ -5,21 +5,25 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 #include <unordered_map>
 #pragma GCC diagnostic pop
 #include <unordered_set>
 #include <cstdint>
+#include <sstream>
+#include <algorithm>
 
 #include "pin.H"
 #include "ops.hh"
 #include "ringbuf.hh"
 #include "debug.hh"
 #include "cpu/pin/regfile.h"
-#include "slev.hh"
 #include "progmark2inst.hh"
 #include "plugin.hh"
+#include "fastsyscall.hh"
+#include "instcount.hh"
 
 static const char *prog;
 static KNOB<std::string> log_path(KNOB_MODE_WRITEONCE, "pintool", "log", "", "specify path to log file");
@@ -27,7 +31,8 @@ static std::ofstream log_;
 static KNOB<std::string> req_path(KNOB_MODE_WRITEONCE, "pintool", "req_path", "", "specify path to CPU communciation FIFO");
 static KNOB<std::string> resp_path(KNOB_MODE_WRITEONCE, "pintool", "resp_path", "", "specify path to response FIFO");
 static KNOB<std::string> mem_path(KNOB_MODE_WRITEONCE, "pintool", "mem_path", "", "specify path to physmem file");
-static KNOB<bool> enable_inst_count(KNOB_MODE_WRITEONCE, "pintool", "inst_count", "1", "enable instruction counting");
+static KNOB<std::string> chan_path(KNOB_MODE_WRITEONCE, "pintool", "chan_path", "", "specify path to shared-memory channel (replaces req_path/resp_path)");
+static KNOB<std::string> result_path(KNOB_MODE_WRITEONCE, "pintool", "result_path", "", "specify path to shared command result region");
 static KNOB<bool> enable_trace(KNOB_MODE_WRITEONCE, "pintool", "trace", "0", "enable instruction tracing");
 
 static CONTEXT user_ctx;
@@ -35,7 +40,6 @@ static CONTEXT saved_kernel_ctx;
 static std::unordered_set<ADDRINT> kernel_pages;
 static ADDRINT virtual_vsyscall_base = 0;
 static ADDRINT physical_vsyscall_base = 0;
-static uint64_t inst_count = 0;
 static std::unordered_map<ADDRINT, std::string> symbol_table;
 
 static uint64_t pinops_count = 0;
@@ -55,11 +59,18 @@ static ADDRINT getpage(ADDRINT addr) {
     return addr & ~(ADDRINT) 0xFFF;
 }
 
+static void
+SaveUserContext(const CONTEXT *ctx)
+{
+    PIN_SaveContext(ctx, &user_ctx);
+    SaveInstCount(ctx);
+}
+
 void
 ContextSwitchToKernel(CONTEXT *ctx, RunResult result)
 {
     // Save the user context.
-    PIN_SaveContext(ctx, &user_ctx);
+    SaveUserContext(ctx);
 
     // Swap in the kernel context.
     PIN_SaveContext(&saved_kernel_ctx, ctx);
@@ -244,15 +255,21 @@ HandleSyscall(CONTEXT *ctx, ADDRINT pc)
 {
     dbgs() << "CLIENT: handling syscall: 0x" << std::hex << pc << ": number=" << std::dec << PIN_GetContextReg(ctx, REG_RAX) << "\n";
     assert(!IsKernelCode(pc));
-    PIN_SaveContext(ctx, &user_ctx);
+
+    // Run result is syscall.
+    RunResult result;
+    result.result = RunResult::RUNRESULT_SYSCALL;
+
+    // Try to handle it here without going to gem5.
+    if (FastSyscall(ctx, pc, result.syscall))
+        PIN_ExecuteAt(ctx);
+
+    SaveUserContext(ctx);
     PIN_SaveContext(&saved_kernel_ctx, ctx);
 
     // Update PC.
     PIN_SetContextReg(&user_ctx, REG_RIP, pc);
 
-    // Run result is syscall.
-    RunResult result;
-    result.result = RunResult::RUNRESULT_SYSCALL;
     CopyOutRunResult(ctx, result);
     PIN_ExecuteAt(ctx);
 }
@@ -264,7 +281,7 @@ HandleCPUID(CONTEXT *ctx, ADDRINT next_pc)
 
     // TODO: Share with HandleSyscall.
     assert(!IsKernelCode(next_pc));
-    PIN_SaveContext(ctx, &user_ctx);
+    SaveUserContext(ctx);
     PIN_SaveContext(&saved_kernel_ctx, ctx);
 
     // Update PC.
@@ -298,7 +315,8 @@ HandleOp_RESETUSER(const CONTEXT *kernel_ctx)
 static ADDRINT
 HandleOp_GET_INSTCOUNT()
 {
-    return inst_count;
+    // Counted by the instcount plugin; zero if it's disabled.
+    return instcount;
 }
 
 static void
@@ -364,6 +382,23 @@ HandleOp_GET_MEMPATH(const char *user_ptr, size_t size)
     HandleOp_GetPath(user_ptr, size, mem_path.Value());
 }
 
+static void
+HandleOp_GET_CHANPATH(const char *user_ptr, size_t size)
+{
+    HandleOp_GetPath(user_ptr, size, chan_path.Value());
+}
+
+static void
+HandleOp_SET_SYSCALL_STATE(const PinSyscallState *user_state_ptr)
+{
+    PinSyscallState state;
+    if (PIN_SafeCopy(&state, user_state_ptr, sizeof state) != sizeof state) {
+        std::cerr << "CLIENT: Failed to copy syscall state\n";
+        Abort();
+    }
+    SetSyscallState(state);
+}
+
 static void
 HandleOp_SET_VSYSCALL_BASE(void *virt, void *phys)
 {
@@ -389,109 +424,110 @@ HandleOp_ABORT(const char *user_msg, size_t line, void *pc)
 }
 
 static void
-HandleOp_RUN(const CONTEXT *kernel_ctx_ptr, ADDRINT next_pc)
+HandleOp_RUN(const CONTEXT *kernel_ctx_ptr, const PinRunArgs *user_args_ptr, ADDRINT next_pc)
 {
+    PinRunArgs args;
+    if (PIN_SafeCopy(&args, user_args_ptr, sizeof args) != sizeof args) {
+        std::cerr << "CLIENT: Failed to copy run args\n";
+        Abort();
+    }
+    SetRunArgs(args);
+    SetInstBudget(args.max_insts);
+
     PIN_SaveContext(kernel_ctx_ptr, &saved_kernel_ctx);
     PIN_SetContextReg(&saved_kernel_ctx, REG_RIP, next_pc);
     std::cerr << __FUNCTION__ << ": switching to user context\n";
+    LoadInstCount(&user_ctx);
     PIN_ExecuteAt(&user_ctx);
     std::abort(); // TODO: UNREACHABLE
 }
 
+// Integer registers, indexed by PinRegGroup.
+static const REG gpr_groups[] = {
+    REG_RAX, REG_RBX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_RSP, REG_RBP,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+    REG_RIP,
+};
+static_assert(sizeof gpr_groups / sizeof *gpr_groups == PINREG_GROUP_RIP + 1);
+
+static uint64_t &
+GetGPRField(PinRegFile &rf, int group)
+{
+    return *reinterpret_cast<uint64_t *>(
+        reinterpret_cast<uint8_t *>(&rf) + pinreg_fields[group].offset);
+}
+
 static void
-HandleOp_SET_REGS(const PinRegFile *user_regfile_ptr)
+HandleOp_SET_REGS(const PinRegFile *user_regfile_ptr, ADDRINT mask)
 {
     PinRegFile rf;
     if (PIN_SafeCopy(&rf, user_regfile_ptr, sizeof rf) != sizeof rf) {
         std::cerr << "CLIENT: Failed to copy regfile\n";
         Abort();
     }
-    const auto set_reg = [] (REG reg, uint64_t value) {
-        PIN_SetContextReg(&user_ctx, reg, value);
+    const auto set_reg = [mask] (uint32_t group, REG reg, uint64_t value) {
+        if (mask & group)
+            PIN_SetContextReg(&user_ctx, reg, value);
     };
 
     // Set integer registers.
-    set_reg(REG_RAX, rf.rax);
-    set_reg(REG_RBX, rf.rbx);
-    set_reg(REG_RCX, rf.rcx);
-    set_reg(REG_RDX, rf.rdx);
-    set_reg(REG_RDI, rf.rdi);
-    set_reg(REG_RSI, rf.rsi);
-    set_reg(REG_RSP, rf.rsp);
-    set_reg(REG_RBP, rf.rbp);
-    set_reg(REG_R8, rf.r8);
-    set_reg(REG_R9, rf.r9);
-    set_reg(REG_R10, rf.r10);
-    set_reg(REG_R11, rf.r11);
-    set_reg(REG_R12, rf.r12);
-    set_reg(REG_R13, rf.r13);
-    set_reg(REG_R14, rf.r14);
-    set_reg(REG_R15, rf.r15);
-    set_reg(REG_RIP, rf.rip);
+    for (int i = 0; i <= PINREG_GROUP_RIP; ++i)
+        set_reg((uint32_t) 1 << i, gpr_groups[i], GetGPRField(rf, i));
 
     // Set floating-point registers.
-    for (int i = 0; i < 8; ++i)
-        PIN_SetContextRegval(&user_ctx, REG(REG_ST0 + i), (const uint8_t *) &rf.fprs[i]);
-    for (int i = 0; i < 16; ++i)
-        PIN_SetContextRegval(&user_ctx, REG(REG_XMM0 + i), (const uint8_t *) &rf.xmms[i]);
-    set_reg(REG_FPCW, rf.fcw);
-    set_reg(REG_FPSW, rf.fsw);
-    set_reg(REG_FPTAG, rf.ftag);
+    if (mask & PINREG(X87))
+        for (int i = 0; i < 8; ++i)
+            PIN_SetContextRegval(&user_ctx, REG(REG_ST0 + i), (const uint8_t *) &rf.fprs[i]);
+    if (mask & PINREG(XMM))
+        for (int i = 0; i < 16; ++i)
+            PIN_SetContextRegval(&user_ctx, REG(REG_XMM0 + i), (const uint8_t *) &rf.xmms[i]);
+    set_reg(PINREG(FPCTRL), REG_FPCW, rf.fcw);
+    set_reg(PINREG(FPCTRL), REG_FPSW, rf.fsw);
+    set_reg(PINREG(FPCTRL), REG_FPTAG, rf.ftag);
 
     // Misc regs.
-    set_reg(REG_RFLAGS, rf.rflags);
-    set_reg(REG_SEG_FS, rf.fs);
-    set_reg(REG_SEG_GS, rf.gs);
-    set_reg(REG_SEG_FS_BASE, rf.fs_base);
-    set_reg(REG_SEG_GS_BASE, rf.gs_base);
-
-    dbgs() << "DEBUG: setting REG_SEG_FS_BASE to 0x" << std::hex << rf.fs_base << "\n";
+    set_reg(PINREG(RFLAGS), REG_RFLAGS, rf.rflags);
+    set_reg(PINREG(SEG), REG_SEG_FS, rf.fs);
+    set_reg(PINREG(SEG), REG_SEG_GS, rf.gs);
+    set_reg(PINREG(FS_BASE), REG_SEG_FS_BASE, rf.fs_base);
+    set_reg(PINREG(GS_BASE), REG_SEG_GS_BASE, rf.gs_base);
+
+    if (mask & PINREG(FS_BASE))
+        dbgs() << "DEBUG: setting REG_SEG_FS_BASE to 0x" << std::hex << rf.fs_base << "\n";
 }
 
 static void
-HandleOp_GET_REGS(PinRegFile *user_regfile_ptr)
+HandleOp_GET_REGS(PinRegFile *user_regfile_ptr, ADDRINT mask)
 {
     PinRegFile rf;
     std::memset(&rf, 0, sizeof rf);
 
-    const auto get_reg = [] (REG reg, auto &value) {
-        value = PIN_GetContextReg(&user_ctx, reg);
+    const auto get_reg = [mask] (uint32_t group, REG reg, auto &value) {
+        if (mask & group)
+            value = PIN_GetContextReg(&user_ctx, reg);
     };
 
     // Get integer registers.
-    get_reg(REG_RAX, rf.rax);
-    get_reg(REG_RBX, rf.rbx);
-    get_reg(REG_RCX, rf.rcx);
-    get_reg(REG_RDX, rf.rdx);
-    get_reg(REG_RDI, rf.rdi);
-    get_reg(REG_RSI, rf.rsi);
-    get_reg(REG_RSP, rf.rsp);
-    get_reg(REG_RBP, rf.rbp);
-    get_reg(REG_R8, rf.r8);
-    get_reg(REG_R9, rf.r9);
-    get_reg(REG_R10, rf.r10);
-    get_reg(REG_R11, rf.r11);
-    get_reg(REG_R12, rf.r12);
-    get_reg(REG_R13, rf.r13);
-    get_reg(REG_R14, rf.r14);
-    get_reg(REG_R15, rf.r15);
-    get_reg(REG_RIP, rf.rip);
+    for (int i = 0; i <= PINREG_GROUP_RIP; ++i)
+        get_reg((uint32_t) 1 << i, gpr_groups[i], GetGPRField(rf, i));
 
     // Get floating-point registers.
-    for (int i = 0; i < 8; ++i)
-        PIN_GetContextRegval(&user_ctx, REG(REG_ST0 + i), (uint8_t *) &rf.fprs[i]);
-    for (int i = 0; i < 16; ++i)
-        PIN_GetContextRegval(&user_ctx, REG(REG_XMM0 + i), (uint8_t *) &rf.xmms[i]);
-    get_reg(REG_FPCW, rf.fcw);
-    get_reg(REG_FPSW, rf.fsw);
-    get_reg(REG_FPTAG, rf.ftag);
+    if (mask & PINREG(X87))
+        for (int i = 0; i < 8; ++i)
+            PIN_GetContextRegval(&user_ctx, REG(REG_ST0 + i), (uint8_t *) &rf.fprs[i]);
+    if (mask & PINREG(XMM))
+        for (int i = 0; i < 16; ++i)
+            PIN_GetContextRegval(&user_ctx, REG(REG_XMM0 + i), (uint8_t *) &rf.xmms[i]);
+    get_reg(PINREG(FPCTRL), REG_FPCW, rf.fcw);
+    get_reg(PINREG(FPCTRL), REG_FPSW, rf.fsw);
+    get_reg(PINREG(FPCTRL), REG_FPTAG, rf.ftag);
 
     // Misc regs.
-    get_reg(REG_RFLAGS, rf.rflags);
-    get_reg(REG_SEG_FS, rf.fs);
-    get_reg(REG_SEG_GS, rf.gs);
-    get_reg(REG_SEG_FS_BASE, rf.fs_base);
-    get_reg(REG_SEG_GS_BASE, rf.gs_base);
+    get_reg(PINREG(RFLAGS), REG_RFLAGS, rf.rflags);
+    get_reg(PINREG(SEG), REG_SEG_FS, rf.fs);
+    get_reg(PINREG(SEG), REG_SEG_GS, rf.gs);
+    get_reg(PINREG(FS_BASE), REG_SEG_FS_BASE, rf.fs_base);
+    get_reg(PINREG(GS_BASE), REG_SEG_GS_BASE, rf.gs_base);
 
     // Copy out.
     if (PIN_SafeCopy(user_regfile_ptr, &rf, sizeof rf) != sizeof rf) {
@@ -499,7 +535,8 @@ HandleOp_GET_REGS(PinRegFile *user_regfile_ptr)
         Abort();
     }
 
-    dbgs() << "DEBUG: getting FS_BASE: 0x" << std::hex << rf.fs_base << "\n";
+    if (mask & PINREG(FS_BASE))
+        dbgs() << "DEBUG: getting FS_BASE: 0x" << std::hex << rf.fs_base << "\n";
 }
 
 static void
@@ -566,6 +603,98 @@ HandleOp_READ_COMMAND_RESULT(ADDRINT buf_vptr, ADDRINT idx, ADDRINT len)
     PIN_SafeCopy(reinterpret_cast<void *>(buf_vptr), gCommandResult.data() + idx, len);
 }
 
+// The shared command result region (see -result_path), grown as needed.
+static int result_fd = -1;
+static char *result_map = nullptr;
+static size_t result_map_size = 0;
+
+static ADDRINT
+HandleOp_SHARE_COMMAND_RESULT()
+{
+    if (result_fd < 0)
+        return 0;
+
+    if (gCommandResult.size() > result_map_size) {
+        size_t size = std::max<size_t>(result_map_size, 1 << 20);
+        while (size < gCommandResult.size())
+            size *= 2;
+        if (ftruncate(result_fd, size) < 0) {
+            std::cerr << __func__ << ": ftruncate failed\n";
+            Abort();
+        }
+        if (result_map)
+            munmap(result_map, result_map_size);
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, result_fd, 0);
+        if (p == MAP_FAILED) {
+            std::cerr << __func__ << ": mmap failed\n";
+            Abort();
+        }
+        result_map = static_cast<char *>(p);
+        result_map_size = size;
+    }
+    std::copy(gCommandResult.begin(), gCommandResult.end(), result_map);
+    return 1;
+}
+
+// Plugin state is saved as a sequence of records, one per enabled plugin:
+// the plugin's name and the size of its state on separate lines, followed
+// by the state itself.
+static ADDRINT
+HandleOp_SAVE_STATE()
+{
+    std::ostringstream os;
+    for (Plugin *plugin : plugins) {
+        if (!plugin->enabled())
+            continue;
+        std::ostringstream state;
+        plugin->serialize(state);
+        const std::string s = state.str();
+        os << plugin->name() << "\n" << s.size() << "\n" << s;
+    }
+    gCommandResult = os.str();
+    return gCommandResult.size();
+}
+
+static std::string gLoadState;
+
+static void
+HandleOp_LOAD_STATE_CHUNK(ADDRINT buf_vptr, ADDRINT len)
+{
+    const size_t old_size = gLoadState.size();
+    gLoadState.resize(old_size + len);
+    PIN_SafeCopy(&gLoadState[old_size], reinterpret_cast<const void *>(buf_vptr), len);
+}
+
+static void
+HandleOp_LOAD_STATE()
+{
+    std::istringstream is(gLoadState);
+    std::string name;
+    while (std::getline(is, name)) {
+        size_t size;
+        if (!(is >> size) || is.get() != '\n') {
+            std::cerr << __func__ << ": malformed plugin state\n";
+            Abort();
+        }
+        std::string s(size, '\0');
+        is.read(&s[0], size);
+
+        const auto it = std::find_if(plugins.begin(), plugins.end(), [&] (Plugin *plugin) {
+            return plugin->enabled() && name == plugin->name();
+        });
+        if (it == plugins.end()) {
+            std::cerr << __func__ << ": warning: ignoring state for disabled plugin '" << name << "'\n";
+            continue;
+        }
+        std::istringstream state(s);
+        (*it)->unserialize(state);
+    }
+    gLoadState.clear();
+
+    // Analysis routines may have cached pointers to the old state.
+    PIN_RemoveInstrumentation();
+}
+
 const std::string *
 GetSymbol(ADDRINT addr)
 {
@@ -637,6 +766,13 @@ Instrument_Instruction_PinOps(INS ins, void *)
                                  IARG_END);
         break;
 
+      case PinOp::OP_GET_CHANPATH:
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_GET_CHANPATH,
+                                 IARG_REG_VALUE, REG_RDI,
+                                 IARG_REG_VALUE, REG_RSI,
+                                 IARG_END);
+        break;
+
       case PinOp::OP_SET_VSYSCALL_BASE:
         INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_SET_VSYSCALL_BASE,
                                  IARG_REG_VALUE, REG_RDI,
@@ -661,19 +797,28 @@ Instrument_Instruction_PinOps(INS ins, void *)
       case PinOp::OP_RUN:
         INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_RUN,
                                  IARG_CONST_CONTEXT,
+                                 IARG_REG_VALUE, REG_RSI,
                                  IARG_ADDRINT, pc + INS_Size(ins),
                                  IARG_END);
         break;
 
+      case PinOp::OP_SET_SYSCALL_STATE:
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_SET_SYSCALL_STATE,
+                                 IARG_REG_VALUE, REG_RDI,
+                                 IARG_END);
+        break;
+
       case PinOp::OP_SET_REGS:
         INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_SET_REGS,
                                  IARG_REG_VALUE, REG_RDI,
+                                 IARG_REG_VALUE, REG_RSI,
                                  IARG_END);
         break;
 
       case PinOp::OP_GET_REGS:
         INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_GET_REGS,
                                  IARG_REG_VALUE, REG_RDI,
+                                 IARG_REG_VALUE, REG_RSI,
                                  IARG_END);
         break;
 
@@ -699,6 +844,30 @@ Instrument_Instruction_PinOps(INS ins, void *)
                                  IARG_END);
         break;
 
+      case PinOp::OP_SAVE_STATE:
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_SAVE_STATE,
+                                 IARG_RETURN_REGS, REG_RAX,
+                                 IARG_END);
+        break;
+
+      case PinOp::OP_LOAD_STATE_CHUNK:
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_LOAD_STATE_CHUNK,
+                                 IARG_REG_VALUE, REG_RDI,
+                                 IARG_REG_VALUE, REG_RSI,
+                                 IARG_END);
+        break;
+
+      case PinOp::OP_LOAD_STATE:
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_LOAD_STATE,
+                                 IARG_END);
+        break;
+
+      case PinOp::OP_SHARE_COMMAND_RESULT:
+        INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) HandleOp_SHARE_COMMAND_RESULT,
+                                 IARG_RETURN_REGS, REG_RAX,
+                                 IARG_END);
+        break;
+
       default:
         std::cerr << "CLIENT: fatal: unimplemented pinop " << std::dec << op << "\n";
         Abort();
@@ -818,24 +987,6 @@ Instruction_Vsyscall(INS ins, void *)
     }
 }
 
-static void
-HandleInstCount(ADDRINT num_insts)
-{
-    inst_count += num_insts;
-}
-
-static void
-Instrument_Trace_InstCount(TRACE trace, void *)
-{
-    if (IsKernelCode(trace))
-        return;
-    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
-        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR) HandleInstCount,
-                       IARG_ADDRINT, BBL_NumIns(bbl),
-                       IARG_END);
-    }
-}
-
 static void
 HandleTrace(ADDRINT pc)
 {
@@ -929,7 +1080,7 @@ static void Fini(int32_t code, void *) {
     log_ << "Exiting: code = " << code << std::endl;
     log_ << prog << ": Finished running the program, Pin exiting!" << std::endl;
     log_ << "STATS: total pinops: " << std::dec << pinops_count << std::endl;
-    log_ << "inst-count " << inst_count << std::endl;
+    log_ << "inst-count " << instcount << std::endl;
 }
 
 template <class T>
@@ -991,10 +1142,15 @@ main(int argc, char *argv[])
     }
     log_.open(log_path.Value());
 
-    if (CheckPathArg(req_path) < 0)
-        return EXIT_FAILURE;
-    if (CheckPathArg(resp_path) < 0)
-        return EXIT_FAILURE;
+    if (!chan_path.Value().empty()) {
+        if (CheckPathArg(chan_path) < 0)
+            return EXIT_FAILURE;
+    } else {
+        if (CheckPathArg(req_path) < 0)
+            return EXIT_FAILURE;
+        if (CheckPathArg(resp_path) < 0)
+            return EXIT_FAILURE;
+    }
 
     OS_FILE_ATTRIBUTES attr;
     if (mem_path.Value().empty()) {
@@ -1006,6 +1162,13 @@ main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (!result_path.Value().empty()) {
+        if ((result_fd = open(result_path.Value().c_str(), O_RDWR)) < 0) {
+            std::cerr << "error: failed to open file: " << result_path.Value() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
     // TODO: Reason better about ordering here.
     // INS_AddInstrumentFunction(Instrument_Instruction_PrintCall, nullptr);
 
@@ -1013,14 +1176,9 @@ main(int argc, char *argv[])
         INS_AddInstrumentFunction(Instruction_Trace, nullptr);
     INS_AddInstrumentFunction(Instruction_Vsyscall, nullptr);
 
-    // TODO: Remove this!
-    if (enable_inst_count.Value())
-        TRACE_AddInstrumentFunction(Instrument_Trace_InstCount, nullptr);
-
     // TODO: Use a static function registration list to make it cleaner.
     // FIXME: Migrate all of these to plugins.
-    if (!slev_register() ||
-        !progmark2inst_register() || // TODO: Remove progmark2inst
+    if (!progmark2inst_register() || // TODO: Remove progmark2inst
         false)
         return EXIT_FAILURE;
 
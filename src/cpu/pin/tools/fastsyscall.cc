@@ -0,0 +1,246 @@
+#include "fastsyscall.hh"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+
+#include "instcount.hh"
+#include "plugin.hh"
+
+// NOTE: Syscalls that change gem5's MemState (e.g., mmap, or brk with a new
+// break point) must always go to gem5, so they can't be listed here.
+static KNOB<std::string> fast_syscalls(KNOB_MODE_WRITEONCE, "pintool", "fast_syscalls", "",
+                                       "comma-separated syscalls to service in the pintool "
+                                       "(getpid,getppid,gettid,getuid,geteuid,getgid,getegid,"
+                                       "clock_gettime,gettimeofday,brk,write)");
+static KNOB<bool> check_fast_syscalls(KNOB_MODE_WRITEONCE, "pintool", "check_fast_syscalls", "0",
+                                      "forward fast syscalls to gem5 and check the pintool's result");
+
+// Largest write(2) serviced on the fast path.
+static constexpr size_t max_fast_write = 4096;
+
+// Matches seconds_since_epoch in gem5's syscall emulation.
+static constexpr uint64_t seconds_since_epoch = 1000 * 1000 * 1000;
+
+// x86-64 Linux syscall numbers.
+static const std::map<std::string, ADDRINT> syscall_numbers = {
+    {"write", 1},
+    {"brk", 12},
+    {"getpid", 39},
+    {"gettimeofday", 96},
+    {"getuid", 102},
+    {"getgid", 104},
+    {"geteuid", 107},
+    {"getegid", 108},
+    {"getppid", 110},
+    {"gettid", 186},
+    {"clock_gettime", 228},
+};
+
+static std::unordered_set<ADDRINT> allowed;
+static std::map<ADDRINT, uint64_t> counts;
+static PinSyscallState state;
+static bool have_state = false;
+static PinRunArgs run_args;
+static ADDRINT run_start_insts = 0;
+
+void
+SetSyscallState(const PinSyscallState &new_state)
+{
+    state = new_state;
+    have_state = true;
+}
+
+void
+SetRunArgs(const PinRunArgs &args)
+{
+    run_args = args;
+    run_start_insts = instcount;
+}
+
+namespace {
+
+// Result of servicing a syscall locally.
+struct Result
+{
+    uint64_t rax;
+    ADDRINT data_addr = 0;
+    size_t data_size = 0;
+    uint8_t data[PIN_SYSCALL_CHECK_DATA_MAX];
+};
+
+}
+
+static bool
+GetTimePair(const CONTEXT *ctx, ADDRINT ptr, uint64_t divisor, bool dry_run,
+            Result &result)
+{
+    if (ptr == 0)
+        return false;
+    // time_ns is fixed for the run, so time has to move on with the
+    // instructions executed, as gem5 will move it when the run ends.
+    // Otherwise, a guest waiting for time to pass could spin forever in an
+    // unbounded run. Checks compare against gem5, which goes by time_ns.
+    uint64_t time_ns = run_args.time_ns;
+    if (!dry_run) {
+        if (run_args.ps_per_inst != 0 && InstCountEnabled())
+            time_ns += (GetInstCount(ctx) - run_start_insts) *
+                run_args.ps_per_inst / 1000;
+        else if (run_args.max_insts == 0)
+            return false;
+    }
+    const uint64_t per_sec = 1000 * 1000 * 1000 / divisor;
+    const uint64_t elapsed = time_ns / divisor;
+    const int64_t pair[2] = {
+        static_cast<int64_t>(elapsed / per_sec + seconds_since_epoch),
+        static_cast<int64_t>(elapsed % per_sec),
+    };
+    static_assert(sizeof pair <= sizeof result.data);
+    std::memcpy(result.data, pair, sizeof pair);
+    result.data_addr = ptr;
+    result.data_size = sizeof pair;
+    result.rax = 0;
+    return true;
+}
+
+static bool
+Write(ADDRINT fd, ADDRINT buf, ADDRINT size, bool dry_run, Result &result)
+{
+    if (fd >= PIN_SYSCALL_STATE_FDS || state.fds[fd] < 0 || size > max_fast_write)
+        return false;
+    if (dry_run) {
+        result.rax = size;
+        return true;
+    }
+    uint8_t data[max_fast_write];
+    if (PIN_SafeCopy(data, reinterpret_cast<const void *>(buf), size) != size)
+        return false;
+    const ssize_t bytes = ::write(state.fds[fd], data, size);
+    result.rax = bytes < 0 ? -errno : bytes;
+    return true;
+}
+
+/// Compute the syscall's result, performing side effects unless dry_run.
+static bool
+Service(const CONTEXT *ctx, bool dry_run, Result &result)
+{
+    const ADDRINT sysno = PIN_GetContextReg(ctx, REG_RAX);
+    const ADDRINT arg0 = PIN_GetContextReg(ctx, REG_RDI);
+    const ADDRINT arg1 = PIN_GetContextReg(ctx, REG_RSI);
+    const ADDRINT arg2 = PIN_GetContextReg(ctx, REG_RDX);
+
+    switch (sysno) {
+      case 1: // write
+        return Write(arg0, arg1, arg2, dry_run, result);
+      case 12: // brk
+        // Only queries; moving the break changes gem5's MemState.
+        if (arg0 != 0 && arg0 != state.brk)
+            return false;
+        result.rax = state.brk;
+        return true;
+      case 39: // getpid
+        result.rax = state.pid;
+        return true;
+      case 96: // gettimeofday
+        return GetTimePair(ctx, arg0, 1000, dry_run, result);
+      case 102: // getuid
+        result.rax = state.uid;
+        return true;
+      case 104: // getgid
+        result.rax = state.gid;
+        return true;
+      case 107: // geteuid
+        result.rax = state.euid;
+        return true;
+      case 108: // getegid
+        result.rax = state.egid;
+        return true;
+      case 110: // getppid
+        result.rax = state.ppid;
+        return true;
+      case 186: // gettid
+        result.rax = state.tid;
+        return true;
+      case 228: // clock_gettime
+        return GetTimePair(ctx, arg1, 1, dry_run, result);
+      default:
+        return false;
+    }
+}
+
+bool
+FastSyscall(CONTEXT *ctx, ADDRINT next_pc, PinSyscallCheck &check)
+{
+    std::memset(&check, 0, sizeof check);
+    if (!have_state || !allowed.count(PIN_GetContextReg(ctx, REG_RAX)))
+        return false;
+
+    const bool check_mode = check_fast_syscalls.Value();
+    Result result;
+    if (!Service(ctx, check_mode, result))
+        return false;
+
+    if (check_mode) {
+        check.valid = 1;
+        check.result = result.rax;
+        check.data_addr = result.data_addr;
+        check.data_size = result.data_size;
+        std::memcpy(check.data, result.data, result.data_size);
+        return false;
+    }
+
+    if (result.data_size != 0 &&
+        PIN_SafeCopy(reinterpret_cast<void *>(result.data_addr), result.data,
+                     result.data_size) != result.data_size)
+        return false;
+
+    ++counts[PIN_GetContextReg(ctx, REG_RAX)];
+    PIN_SetContextReg(ctx, REG_RAX, result.rax);
+    PIN_SetContextReg(ctx, REG_RIP, next_pc);
+    return true;
+}
+
+namespace {
+struct FastSyscallPlugin final : Plugin
+{
+    const char *name() const override { return "fastsyscall"; }
+
+    bool enabled() const override { return !fast_syscalls.Value().empty(); }
+
+    bool
+    reg() override
+    {
+        std::stringstream ss(fast_syscalls.Value());
+        std::string name;
+        while (std::getline(ss, name, ',')) {
+            const auto it = syscall_numbers.find(name);
+            if (it == syscall_numbers.end()) {
+                std::cerr << "fastsyscall: error: unsupported syscall: " << name << "\n";
+                return false;
+            }
+            allowed.insert(it->second);
+        }
+        return true;
+    }
+
+    bool
+    command(const std::string &cmd, const std::vector<std::string> &args, std::string &result) override
+    {
+        if (cmd != "fastsyscalls")
+            return false;
+
+        // Output: one "<sysno> <count>" line per syscall serviced locally.
+        std::stringstream ss;
+        for (const auto &[sysno, count] : counts)
+            ss << sysno << " " << count << "\n";
+        result = ss.str();
+        return true;
+    }
+} plugin;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <pin.H>
+
+#include "ops.hh"
+
+void SetSyscallState(const PinSyscallState &state);
+void SetRunArgs(const PinRunArgs &args);
+
+/**
+ * Try to service the syscall in ctx without going to gem5. On success,
+ * updates ctx so that execution resumes at next_pc with the syscall's
+ * return value and returns true. Otherwise, returns false and, in check
+ * mode, fills in check with the result the fast path would have produced.
+ */
+bool FastSyscall(CONTEXT *ctx, ADDRINT next_pc, PinSyscallCheck &check);
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+/**
+ * Insert-only open-addressing hash table (linear probing). Entries live in
+ * a deque, in insertion order, so pointers to them (e.g., counters passed
+ * to analysis routines) stay valid as the table grows.
+ */
+template <typename Key, typename Value, typename Hash>
+class FlatTable
+{
+  public:
+    struct Entry
+    {
+        Key key;
+        Value value;
+    };
+
+    /// Find key, or insert it with a value constructed from args.
+    template <typename... Args>
+    std::pair<Entry *, bool>
+    emplace(const Key &key, Args &&...args)
+    {
+        if ((entries.size() + 1) * 2 > slots.size())
+            grow();
+        const uint64_t h = Hash()(key);
+        for (size_t i = h & mask();; i = (i + 1) & mask()) {
+            Slot &slot = slots[i];
+            if (slot.index == 0) {
+                entries.push_back(Entry{key, Value(std::forward<Args>(args)...)});
+                slot.hash = h;
+                slot.index = entries.size();
+                return {&entries.back(), true};
+            }
+            Entry &entry = entries[slot.index - 1];
+            if (slot.hash == h && entry.key == key)
+                return {&entry, false};
+        }
+    }
+
+    size_t size() const { return entries.size(); }
+
+    typename std::deque<Entry>::iterator begin() { return entries.begin(); }
+    typename std::deque<Entry>::iterator end() { return entries.end(); }
+    typename std::deque<Entry>::const_iterator begin() const { return entries.begin(); }
+    typename std::deque<Entry>::const_iterator end() const { return entries.end(); }
+
+  private:
+    struct Slot
+    {
+        uint64_t hash = 0;
+        size_t index = 0; // Index into entries plus one, or 0 if empty.
+    };
+
+    std::vector<Slot> slots;
+    std::deque<Entry> entries;
+
+    size_t mask() const { return slots.size() - 1; }
+
+    void
+    grow()
+    {
+        std::vector<Slot> old(std::max<size_t>(slots.size() * 2, 1024));
+        std::swap(old, slots);
+        for (const Slot &slot : old) {
+            if (slot.index == 0)
+                continue;
+            size_t i = slot.hash & mask();
+            while (slots[i].index != 0)
+                i = (i + 1) & mask();
+            slots[i] = slot;
+        }
+    }
+};
+
+/// Mix a 64-bit value into a hash (the MurmurHash3 finalizer).
+inline uint64_t
+mixHash(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
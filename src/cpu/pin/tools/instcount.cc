@@ -3,19 +3,143 @@
 #include <pin.H>
 #include <string>
 #include <iostream>
+#include <limits>
 #include "client.hh"
 #include "plugin.hh"
 #include "breakpoint.hh"
 
 static KNOB<bool> enable(KNOB_MODE_WRITEONCE, "pintool", "instcount", "0", "Enable instruction counting");
+static KNOB<bool> inline_count(KNOB_MODE_WRITEONCE, "pintool", "instcount-inline", "0",
+                               "Keep the instruction count in a tool register while the user runs");
 
 // TODO: Make this static.
+// With -instcount-inline, this is only up to date while the kernel runs;
+// the user's count is in count_reg, which Pin can update with inlined
+// code instead of a call per block.
 ADDRINT instcount;
+static REG count_reg = REG_INVALID();
+
+// Instruction count at which the current run's budget expires.
+static ADDRINT budget_end = std::numeric_limits<ADDRINT>::max();
+
+// When the budget expires in the middle of a basic block, we re-instrument
+// that block to stop before its stop_index'th instruction.
+static ADDRINT stop_bbl = 0;
+static ADDRINT stop_index = 0;
+
+void
+SetInstBudget(ADDRINT max_insts)
+{
+    budget_end = max_insts ? instcount + max_insts : std::numeric_limits<ADDRINT>::max();
+    stop_bbl = 0;
+}
+
+static ADDRINT
+GetCount(const CONTEXT *ctx)
+{
+    return inline_count.Value() ? PIN_GetContextReg(ctx, count_reg) : instcount;
+}
 
 static void
-Analyze(ADDRINT n)
+SetCount(CONTEXT *ctx, ADDRINT count)
+{
+    if (inline_count.Value())
+        PIN_SetContextReg(ctx, count_reg, count);
+    else
+        instcount = count;
+}
+
+void
+SaveInstCount(const CONTEXT *user_ctx)
+{
+    if (enable.Value() && inline_count.Value())
+        instcount = PIN_GetContextReg(user_ctx, count_reg);
+}
+
+void
+LoadInstCount(CONTEXT *user_ctx)
+{
+    if (enable.Value() && inline_count.Value())
+        PIN_SetContextReg(user_ctx, count_reg, instcount);
+}
+
+bool
+InstCountEnabled()
+{
+    return enable.Value();
+}
+
+ADDRINT
+GetInstCount(const CONTEXT *user_ctx)
+{
+    return enable.Value() ? GetCount(user_ctx) : 0;
+}
+
+[[noreturn]] static void
+Stop(CONTEXT *ctx)
+{
+    RunResult result;
+    result.result = result.RUNRESULT_INSTCOUNT;
+    ContextSwitchToKernel(ctx, result);
+    PIN_ExecuteAt(ctx);
+    std::abort(); // TODO: Unreachable
+}
+
+static ADDRINT
+AnalyzeIf(ADDRINT n)
 {
     instcount += n;
+    return instcount > budget_end;
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL
+InlineIncrement(ADDRINT count, ADDRINT n)
+{
+    return count + n;
+}
+
+static ADDRINT PIN_FAST_ANALYSIS_CALL
+InlineIf(ADDRINT count)
+{
+    return count > budget_end;
+}
+
+static void
+AnalyzeThen(CONTEXT *ctx, ADDRINT bbl_addr, ADDRINT bbl_size, ADDRINT n)
+{
+    // The budget expires in this block.
+    const ADDRINT count = GetCount(ctx) - n;
+    const ADDRINT k = budget_end - count;
+    if (k == 0) {
+        SetCount(ctx, count);
+        Stop(ctx);
+    }
+
+    if (stop_bbl == bbl_addr) {
+        // Already instrumented to stop partway through.
+        return;
+    }
+
+    stop_bbl = bbl_addr;
+    stop_index = k;
+    SetCount(ctx, count);
+    PIN_RemoveInstrumentationInRange(bbl_addr, bbl_addr + bbl_size - 1);
+    PIN_ExecuteAt(ctx);
+}
+
+static ADDRINT
+StopIf(ADDRINT bbl_addr)
+{
+    return stop_bbl == bbl_addr;
+}
+
+static void
+StopThen(CONTEXT *ctx)
+{
+    // We counted the whole block on entry, but stopped partway through.
+    SetCount(ctx, budget_end);
+    stop_bbl = 0;
+    Stop(ctx);
 }
 
 static void
@@ -24,12 +148,58 @@ Instrument(TRACE trace, void *)
     if (IsKernelCode(trace))
         return;
     for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
-        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR) Analyze,
-                       IARG_ADDRINT, BBL_NumIns(bbl),
-                       IARG_END);
+        const ADDRINT bbl_addr = BBL_Address(bbl);
+        if (stop_bbl == bbl_addr) {
+            INS ins = BBL_InsHead(bbl);
+            for (ADDRINT i = 0; i < stop_index && INS_Valid(ins); ++i)
+                ins = INS_Next(ins);
+            if (INS_Valid(ins)) {
+                INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR) StopIf,
+                                 IARG_CALL_ORDER, CALL_ORDER_FIRST,
+                                 IARG_ADDRINT, bbl_addr,
+                                 IARG_END);
+                INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR) StopThen,
+                                   IARG_CALL_ORDER, CALL_ORDER_FIRST,
+                                   IARG_CONTEXT,
+                                   IARG_END);
+            }
+        }
+
+        if (inline_count.Value()) {
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR) InlineIncrement,
+                           IARG_CALL_ORDER, CALL_ORDER_FIRST + 1,
+                           IARG_FAST_ANALYSIS_CALL,
+                           IARG_REG_VALUE, count_reg,
+                           IARG_ADDRINT, BBL_NumIns(bbl),
+                           IARG_RETURN_REGS, count_reg,
+                           IARG_END);
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR) InlineIf,
+                             IARG_CALL_ORDER, CALL_ORDER_FIRST + 1,
+                             IARG_FAST_ANALYSIS_CALL,
+                             IARG_REG_VALUE, count_reg,
+                             IARG_END);
+        } else {
+            BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR) AnalyzeIf,
+                             IARG_CALL_ORDER, CALL_ORDER_FIRST + 1,
+                             IARG_ADDRINT, BBL_NumIns(bbl),
+                             IARG_END);
+        }
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR) AnalyzeThen,
+                           IARG_CALL_ORDER, CALL_ORDER_FIRST + 1,
+                           IARG_CONTEXT,
+                           IARG_ADDRINT, bbl_addr,
+                           IARG_ADDRINT, BBL_Size(bbl),
+                           IARG_ADDRINT, BBL_NumIns(bbl),
+                           IARG_END);
     }
 }
 
+static ADDRINT
+Units(INS)
+{
+    return 1;
+}
+
 static void
 Finish(int32_t code, void *)
 {
@@ -54,7 +224,12 @@ struct InstCountPlugin final : Plugin
     {
         assert(enabled());
         TRACE_AddInstrumentFunction(Instrument, nullptr);
-        RegisterCounter("inst", &instcount);
+        // Breakpoints and targets read counters while the user runs, so
+        // they can't use the inlined count.
+        if (inline_count.Value())
+            count_reg = PIN_ClaimToolRegister();
+        else
+            RegisterCounter("inst", &instcount, Units);
         PIN_AddFiniFunction(Finish, nullptr);
         return true;
     }
@@ -69,5 +244,19 @@ struct InstCountPlugin final : Plugin
 
         return false;
     }
+
+    void
+    serialize(std::ostream &os) const override
+    {
+        os << instcount;
+    }
+
+    void
+    unserialize(std::istream &is) override
+    {
+        is >> instcount;
+        budget_end = std::numeric_limits<ADDRINT>::max();
+        stop_bbl = 0;
+    }
 } plugin;
 }
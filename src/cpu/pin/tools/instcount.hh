@@ -3,3 +3,17 @@
 #include <pin.H>
 
 extern ADDRINT instcount;
+
+/// Stop with RUNRESULT_INSTCOUNT after exactly max_insts more instructions
+/// (0: no limit).
+void SetInstBudget(ADDRINT max_insts);
+
+/// With -instcount-inline, copy the count out of a user context that's
+/// switching to the kernel, and back into one that's about to run.
+void SaveInstCount(const CONTEXT *user_ctx);
+void LoadInstCount(CONTEXT *user_ctx);
+
+/// Whether instructions are counted at all (-instcount).
+bool InstCountEnabled();
+/// The instruction count as of a running user context.
+ADDRINT GetInstCount(const CONTEXT *user_ctx);
@@ -8,11 +8,13 @@
 #include <inttypes.h>
 #include <sys/prctl.h>
 #include <asm/prctl.h>
+#include <linux/futex.h>
 
 #define STDERR_FILENO 2
 #define ENOMEM 12
 
 #include "cpu/pin/message.hh"
+#include "cpu/pin/ring.h"
 #include "syscall.h"
 #include "printf.h"
 #include "ops.hh"
@@ -50,6 +52,7 @@ do_assert_failure(const char *file, int line, const char *desc)
 static int req_fd;
 static int resp_fd;
 static int mem_fd;
+static struct PinChannelShared *chan; // NULL if using pipes.
 
 typedef struct Message Message;
 
@@ -109,18 +112,103 @@ void write_all(int fd, const void *data_, size_t size) {
     }
 }
 
+long pin_ring_futex(uint32_t *uaddr, int op, uint32_t val, void *arg) {
+    return futex(uaddr, op == PIN_RING_FUTEX_WAIT ? FUTEX_WAIT : FUTEX_WAKE, val);
+}
+
+void chan_read(void *data, size_t size) {
+    if (chan)
+        pin_ring_read(&chan->req, data, size, chan->spin, NULL);
+    else
+        read_all(req_fd, data, size);
+}
+
+void chan_write(const void *data, size_t size) {
+    if (chan)
+        pin_ring_write(&chan->resp, data, size, chan->spin, NULL);
+    else
+        write_all(resp_fd, data, size);
+}
+
 void _putchar(char c) {
     write(STDERR_FILENO, &c, 1);
 }
 
 void msg_read(Message *msg) {
     printf("KERNEL: reading request\n");
-    read_all(req_fd, msg, sizeof *msg);
+    chan_read(msg, PINMSG_HEADER_SIZE);
+    if (msg->size > PINMSG_PAYLOAD_MAX) {
+        printf_("error: bad message payload size (%u)\n", msg->size);
+        pinop_abort();
+    }
+    chan_read(&msg->map, msg->size);
     printf("KERNEL: read request\n");
 }
 
-void msg_write(const Message *msg) {
-    write_all(resp_fd, msg, sizeof *msg);
+void msg_write(Message *msg) {
+    msg->size = pinmsg_payload_size(msg);
+    chan_write(msg, PINMSG_HEADER_SIZE + msg->size);
+}
+
+void do_map(struct PinMapping *m) {
+    // Check if vsyscall. This is special case.
+    bool is_vsyscall = false;
+    if (m->vaddr == vsyscall_base) {
+        printf("KERNEL: fixing up vsyscall mapping 0x%" PRIx64 "->0x%" PRIx64 "\n",
+               m->vaddr, m->paddr);
+        m->vaddr = 0xcafebabe000;
+        is_vsyscall = true;
+    }
+
+    // printf_("mapping page: %p->%p 0x%lx\n", (void *) m->vaddr, (void *) m->paddr, m->size);
+    void *map;
+    if ((map = mmap((void *) m->vaddr, m->size, m->prot,
+                    MAP_SHARED | MAP_FIXED, mem_fd, m->paddr)) == MAP_FAILED) {
+        err("mmap failed: vaddr=%p size=%zu paddr=%p\n", m->vaddr, m->size, m->paddr);
+        if (errno == ENOMEM)
+            diagnose_ENOMEM();
+        pinop_abort();
+    }
+    if (map != (void *) m->vaddr) {
+        printf_("error: mmap mapped wrong address\n");
+        pinop_abort();
+    }
+    printf_("mapped page: %p->%p %p\n", (void *) m->vaddr, (void *) m->paddr, (void *) m->size);
+    // printf_("first byte: %02hhx\n", * (uint8_t *) map);
+    if (is_vsyscall) {
+        pinop_set_vsyscall_base((void *) vsyscall_base, map);
+    }
+}
+
+void do_unmap(const struct PinMapping *m) {
+    if (munmap((void *) m->vaddr, m->size) < 0) {
+        printf_("error: munmap failed (%d): vaddr=%p size=0x%x\n",
+                errno, m->vaddr, m->size);
+        pinop_abort();
+    }
+    printf_("unmapped page: %p\n", (void*) m->vaddr);
+}
+
+// Send the result of the last command (or state save): through the shared
+// result region if there is one, otherwise streamed after the message.
+static void send_command_result(struct Message *msg, size_t bytes) {
+    msg->command_result_size = bytes;
+    if (pinop_share_command_result()) {
+        msg->type = CommandResultShared;
+        msg_write(msg);
+        return;
+    }
+    msg->type = CommandResult;
+    msg_write(msg);
+
+    // TODO: Should just send null-terminated string, once we use buffered files on the gem5 end.
+    for (size_t i = 0; i != bytes; ) {
+        char buf[1024];
+        const size_t chunk = min(bytes - i, sizeof buf);
+        pinop_read_command_result(buf, i, chunk);
+        chan_write(buf, chunk);
+        i += chunk;
+    }
 }
 
 void main_event_loop(void) {
@@ -148,57 +236,41 @@ void main_event_loop(void) {
             break;
 
           case Map:
-            {
-                // Check if vsyscall. This is special case.
-                bool is_vsyscall = false;
-                if (msg.map.vaddr == vsyscall_base) {
-                    printf("KERNEL: fixing up vsyscall mapping 0x%" PRIx64 "->0x%" PRIx64 "\n",
-                           msg.map.vaddr, msg.map.paddr);
-                    msg.map.vaddr = 0xcafebabe000;
-                    is_vsyscall = true;
-                }
-                
-                // printf_("mapping page: %p->%p 0x%lx\n", (void *) msg.map.vaddr, (void *) msg.map.paddr, msg.map.size);
-                void *map;
-                if ((map = mmap((void *) msg.map.vaddr, msg.map.size, msg.map.prot,
-                                MAP_SHARED | MAP_FIXED, mem_fd, msg.map.paddr)) == MAP_FAILED) {
-                    err("mmap failed: vaddr=%p size=%zu paddr=%p\n", msg.map.vaddr, msg.map.size, msg.map.paddr);
-                    if (errno == ENOMEM)
-                        diagnose_ENOMEM();
-                    pinop_abort();
-                }
-                if (map != (void *) msg.map.vaddr) {
-                    printf_("error: mmap mapped wrong address\n");
-                    pinop_abort();
-                }
-                printf_("mapped page: %p->%p %p\n", (void *) msg.map.vaddr, (void *) msg.map.paddr, (void *) msg.map.size);
-                // printf_("first byte: %02hhx\n", * (uint8_t *) map);
-                if (is_vsyscall) {
-                    pinop_set_vsyscall_base((void *) vsyscall_base, map);
-                }
-                msg.type = Ack;
-                msg_write(&msg);
-            }
+            do_map(&msg.map);
+            msg.type = Ack;
+            msg_write(&msg);
             break;
 
           case Unmap:
-            {
-                if (munmap((void *) msg.map.vaddr, msg.map.size) < 0) {
-                    printf_("error: munmap failed (%d): vaddr=%p size=0x%x\n",
-                            errno, msg.map.vaddr, msg.map.size);
+            do_unmap(&msg.map);
+            msg.type = Ack;
+            msg_write(&msg);
+            break;
+
+          case Batch:
+            for (uint32_t i = 0; i < msg.batch.count; ++i) {
+                struct PinBatchEntry *entry = &msg.batch.entries[i];
+                switch (entry->type) {
+                  case Map:
+                    do_map(&entry->map);
+                    break;
+                  case Unmap:
+                    do_unmap(&entry->map);
+                    break;
+                  default:
+                    printf_("error: bad batch entry type (%d)\n", (int) entry->type);
                     pinop_abort();
                 }
-                printf_("unmapped page: %p\n", (void*) msg.map.vaddr);
-                msg.type = Ack;
-                msg_write(&msg);
             }
+            msg.type = Ack;
+            msg_write(&msg);
             break;
 
           case Run:
             {
                 printf("KERNEL handling RUN request\n");
                 struct RunResult result;
-                pinop_run(&result);
+                pinop_run(&result, &msg.run);
                 Message msg;
                 msg.inst_count = pinop_get_instcount();
                 switch (result.result) {
@@ -212,6 +284,7 @@ void main_event_loop(void) {
                   case RUNRESULT_SYSCALL:
                     // Send this up to gem5.
                     msg.type = Syscall;
+                    msg.syscall_check = result.syscall;
                     break;
 
                   case RUNRESULT_CPUID:
@@ -223,6 +296,10 @@ void main_event_loop(void) {
                     // Send up to gem5.
                     msg.type = Break;
                     break;
+
+                  case RUNRESULT_INSTCOUNT:
+                    msg.type = InstBudget;
+                    break;
                     
                   default:
                     printf_("KERNEL ERROR: unhandled run result: %d\n", result);
@@ -234,14 +311,28 @@ void main_event_loop(void) {
             break;
 
           case SetRegs:
-            pinop_set_regs(&msg.regfile);
-            msg.type = Ack;
-            msg_write(&msg);
+            {
+                struct PinRegFile rf;
+                pinregs_unpack(&rf, msg.regs.mask, msg.regs.data);
+                pinop_set_regs(&rf, msg.regs.mask);
+                msg.type = Ack;
+                msg_write(&msg);
+            }
             break;
 
           case GetRegs:
-            pinop_get_regs(&msg.regfile);
-            msg.type = SetRegs;
+            {
+                struct PinRegFile rf;
+                pinop_get_regs(&rf, msg.regs.mask);
+                pinregs_pack(&rf, msg.regs.mask, msg.regs.data);
+                msg.type = SetRegs;
+                msg_write(&msg);
+            }
+            break;
+
+          case SetSyscallState:
+            pinop_set_syscall_state(&msg.syscall_state);
+            msg.type = Ack;
             msg_write(&msg);
             break;
 
@@ -257,20 +348,29 @@ void main_event_loop(void) {
           case ExecCommand:
             {
                 const size_t bytes = pinop_exec_command(msg.command);
-                msg.type = CommandResult;
-                msg.command_result_size = bytes;
-                msg_write(&msg);
+                send_command_result(&msg, bytes);
+            }
+            break;
 
-                // TODO: Should just send null-terminated string, once we use buffered files on the gem5 end.
-                for (size_t i = 0; i != bytes; ) {
-                    char buf[1024];
-                    const size_t chunk = min(bytes - i, sizeof buf);
-                    pinop_read_command_result(buf, i, chunk);
-                    write_all(resp_fd, buf, chunk);
-                    i += chunk;
-                }
+          case SaveState:
+            {
+                const size_t bytes = pinop_save_state();
+                send_command_result(&msg, bytes);
             }
             break;
+
+          case LoadState:
+            for (uint64_t i = 0; i != msg.state_size; ) {
+                char buf[1024];
+                const size_t chunk = min(msg.state_size - i, sizeof buf);
+                chan_read(buf, chunk);
+                pinop_load_state_chunk(buf, chunk);
+                i += chunk;
+            }
+            pinop_load_state();
+            msg.type = Ack;
+            msg_write(&msg);
+            break;
               
           default:
             printf_("error: bad message type (%d)\n", msg.type);
@@ -312,21 +412,39 @@ void switch_stacks(void *new_stack, void (*f)(void)) {
 void main2(void) {
     char path[256];
     printf("KERNEL: starting up\n");
-    
-    // Open request file.
-    pinop_get_reqpath(path, sizeof path);
-    if ((req_fd = open(path, O_RDONLY)) < 0) {
-        printf("error: open failed: %s (%d)\n", path, errno);
-        pinop_abort(); 
-    }
 
-    printf("KERNEL: opened request file\n");
+    // Use the shared-memory channel if gem5 gave us one.
+    pinop_get_chanpath(path, sizeof path);
+    if (path[0]) {
+        int chan_fd;
+        if ((chan_fd = open(path, O_RDWR)) < 0) {
+            err("open: %s", path);
+            pinop_abort();
+        }
+        void *map;
+        if ((map = mmap(NULL, sizeof *chan, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        chan_fd, 0)) == MAP_FAILED) {
+            err("mmap: %s", path);
+            pinop_abort();
+        }
+        chan = (struct PinChannelShared *) map;
+        printf("KERNEL: mapped shared-memory channel\n");
+    } else {
+        // Open request file.
+        pinop_get_reqpath(path, sizeof path);
+        if ((req_fd = open(path, O_RDONLY)) < 0) {
+            printf("error: open failed: %s (%d)\n", path, errno);
+            pinop_abort(); 
+        }
+
+        printf("KERNEL: opened request file\n");
     
-    // Open response file.
-    pinop_get_resppath(path, sizeof path);
-    if ((resp_fd = open(path, O_WRONLY)) < 0) {
-        err("open: %s", path);
-        pinop_abort();
+        // Open response file.
+        pinop_get_resppath(path, sizeof path);
+        if ((resp_fd = open(path, O_WRONLY)) < 0) {
+            err("open: %s", path);
+            pinop_abort();
+        }
     }
 
     // Open physmem file.
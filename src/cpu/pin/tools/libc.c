@@ -12,3 +12,11 @@ int strncmp(const char *s1, const char *s2, size_t n) {
   }
   return 0;
 }
+
+void *memcpy(void *dst, const void *src, size_t n) {
+  char *d = (char *) dst;
+  const char *s = (const char *) src;
+  for (size_t i = 0; i < n; ++i)
+    d[i] = s[i];
+  return dst;
+}
@@ -3,3 +3,4 @@
 #include <stddef.h>
 
 int strncmp(const char *s1, const char *s2, size_t n);
+void *memcpy(void *dst, const void *src, size_t n);
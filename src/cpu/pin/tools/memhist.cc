@@ -1,65 +1,397 @@
 #include <pin.H>
-#include <array>
-#include <iostream>
 #include <algorithm>
-#include <limits>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
 
+#include "client.hh"
+#include "flattable.hh"
 #include "plugin.hh"
 
+// Histogram of loaded values. Loads are recorded into Pin trace buffers,
+// which a consumer thread aggregates into a count-min sketch, tracking the
+// top-K values as it goes. Results are exact for top-K values with an error
+// of 0 and otherwise overestimate by at most the reported error.
+
 namespace {
 
-KNOB<bool> enable(KNOB_MODE_WRITEONCE, "pintool", "memhist", "0", "Enable load/store data histogram collection");
+KNOB<bool> enable(KNOB_MODE_WRITEONCE, "pintool", "memhist", "0", "Enable load value histogram collection");
+KNOB<unsigned> sketch_width(KNOB_MODE_WRITEONCE, "pintool", "memhist-width", "65536",
+                            "Count-min sketch width (error is about total loads / width)");
+KNOB<unsigned> sketch_depth(KNOB_MODE_WRITEONCE, "pintool", "memhist-depth", "4",
+                            "Count-min sketch depth (error bound fails with probability about e^-depth)");
+KNOB<unsigned> topk_size(KNOB_MODE_WRITEONCE, "pintool", "memhist-topk", "64",
+                         "Number of hot load values to track");
+KNOB<unsigned> buffer_pages(KNOB_MODE_WRITEONCE, "pintool", "memhist-buffer-pages", "64",
+                            "Size of each trace buffer, in pages");
 
-using hash_t = uint16_t;
+struct LoadRecord
+{
+    ADDRINT pc; // 0 if not filled.
+    ADDRINT addr;
+    ADDRINT value;
+};
 
-std::array<ADDRINT, std::numeric_limits<hash_t>::max() + 1> hist;
+BUFFER_ID buffer;
+size_t buffer_records;
+REG ea_reg;
 
-hash_t
-hash(ADDRINT value)
+// The buffer Pin is currently filling. Only one application thread runs in
+// each Pin process.
+LoadRecord *cur_buf = nullptr;
+
+// Buffer queues, guarded by mutex.
+PIN_MUTEX mutex;
+PIN_SEMAPHORE work; // Set when queue is non-empty or stopping.
+PIN_SEMAPHORE idle; // Set when every queued buffer has been aggregated.
+PIN_SEMAPHORE freed; // Set when a buffer is returned to free_bufs.
+std::vector<std::pair<LoadRecord *, size_t>> queue;
+std::vector<LoadRecord *> free_bufs;
+size_t num_bufs = 0;
+const size_t max_bufs = 8;
+uint64_t submitted = 0;
+uint64_t processed = 0;
+bool stopping = false;
+bool consumer_running = false;
+PIN_THREAD_UID consumer_uid;
+
+/**
+ * Count-min sketch. Each value increments one counter in each row; the
+ * smallest of them bounds its count from above.
+ */
+class CountMinSketch
 {
-#if 0
-    return static_cast<uint8_t>(value * 0x9e3779b9);
-#elif 0
-    hash_t hash = ((value >> 0) & 0xFFFF) ^ ((value >> 16) & 0xFFFF) ^ ((value >> 32) & 0xFFFF) ^
-        ((value >> 48) & 0xFFFF);
-    return hash;
-#else
-    return static_cast<hash_t>(value * 0x9e3779b9);
-#endif
+  public:
+    void
+    init(size_t width, size_t depth)
+    {
+        this->width = width;
+        this->depth = depth;
+        counts.assign(width * depth, 0);
+    }
+
+    uint64_t
+    add(ADDRINT value)
+    {
+        uint64_t est = ~(uint64_t) 0;
+        for (size_t row = 0; row < depth; ++row) {
+            uint64_t &count = counts[row * width + index(value, row)];
+            est = std::min(est, ++count);
+        }
+        return est;
+    }
+
+    void reset() { std::fill(counts.begin(), counts.end(), 0); }
+
+    void
+    serialize(std::ostream &os) const
+    {
+        for (size_t i = 0; i < counts.size(); ++i)
+            if (counts[i])
+                os << i << ' ' << counts[i] << '\n';
+    }
+
+    void
+    unserialize(std::istream &is, size_t n)
+    {
+        size_t i;
+        uint64_t count;
+        while (n-- && is >> i >> count)
+            if (i < counts.size())
+                counts[i] = count;
+    }
+
+  private:
+    size_t width = 0;
+    size_t depth = 0;
+    std::vector<uint64_t> counts;
+
+    size_t
+    index(ADDRINT value, size_t row) const
+    {
+        return mixHash(value + row * 0x9e3779b97f4a7c15ULL) % width;
+    }
+};
+
+struct TopEntry
+{
+    ADDRINT value;
+    uint64_t count; // Upper bound on the number of loads of value.
+    uint64_t error; // count - error is a lower bound.
+    ADDRINT pc; // Last load of value.
+    ADDRINT addr;
+};
+
+// Aggregated loads, guarded by sketch_mutex. The consumer holds it while
+// it aggregates a buffer, so it's kept apart from the queues that the
+// application thread needs to hand over the next one.
+PIN_MUTEX sketch_mutex;
+CountMinSketch sketch;
+std::vector<TopEntry> top;
+std::unordered_map<ADDRINT, size_t> top_index; // Value to index in top.
+uint64_t top_min = 0; // Lower bound on the smallest count in top.
+
+void
+Aggregate(const LoadRecord &rec)
+{
+    const uint64_t est = sketch.add(rec.value);
+
+    const auto it = top_index.find(rec.value);
+    if (it != top_index.end()) {
+        TopEntry &entry = top[it->second];
+        ++entry.count;
+        entry.pc = rec.pc;
+        entry.addr = rec.addr;
+        return;
+    }
+
+    // The sketch counted this load exactly, so at most est - 1 of the
+    // earlier ones are error.
+    const TopEntry entry{rec.value, est, est - 1, rec.pc, rec.addr};
+    if (top.size() < topk_size.Value()) {
+        top_index.emplace(rec.value, top.size());
+        top.push_back(entry);
+        return;
+    }
+    if (est <= top_min)
+        return;
+    const auto min_it = std::min_element(top.begin(), top.end(), [] (const TopEntry &a, const TopEntry &b) {
+        return a.count < b.count;
+    });
+    top_min = min_it->count;
+    if (est <= top_min)
+        return;
+    top_index.erase(min_it->value);
+    top_index.emplace(rec.value, min_it - top.begin());
+    *min_it = entry;
 }
 
 void
-RecordLoadValue(ADDRINT value)
+AggregateBuffer(LoadRecord *buf, size_t n)
 {
-    ++hist[hash(value)];
+    // Pin sometimes reports an empty buffer that isn't (see bbtrace.cc), so
+    // go by which records are filled in.
+    if (n == 0)
+        n = buffer_records;
+    for (size_t i = 0; i < n; ++i)
+        if (buf[i].pc)
+            Aggregate(buf[i]);
+    std::memset(buf, 0, buffer_records * sizeof *buf);
 }
 
 void
-InstrumentINS(INS ins, void *)
-{
-    if (INS_IsMemoryRead(ins) && INS_IsValidForIpointAfter(ins)) {
-        const REG dst = INS_RegW(ins, 0);
-        if (REG_valid(dst) && REG_valid_for_iarg_reg_value(dst)) {
-            INS_InsertPredicatedCall(ins, IPOINT_AFTER,
-                                     (AFUNPTR) RecordLoadValue,
-                                     IARG_REG_VALUE, dst,
+Consumer(void *)
+{
+    bool done = false;
+    while (!done) {
+        PIN_SemaphoreWait(&work);
+        PIN_MutexLock(&mutex);
+        PIN_SemaphoreClear(&work);
+        std::vector<std::pair<LoadRecord *, size_t>> bufs;
+        std::swap(bufs, queue);
+        done = stopping;
+        PIN_MutexUnlock(&mutex);
+
+        for (const auto &[buf, n] : bufs) {
+            PIN_MutexLock(&sketch_mutex);
+            AggregateBuffer(buf, n);
+            PIN_MutexUnlock(&sketch_mutex);
+
+            PIN_MutexLock(&mutex);
+            free_bufs.push_back(buf);
+            PIN_SemaphoreSet(&freed);
+            if (++processed == submitted)
+                PIN_SemaphoreSet(&idle);
+            PIN_MutexUnlock(&mutex);
+        }
+    }
+}
+
+LoadRecord *
+GetFreeBuffer()
+{
+    for (;;) {
+        PIN_MutexLock(&mutex);
+        if (!free_bufs.empty()) {
+            LoadRecord *buf = free_bufs.back();
+            free_bufs.pop_back();
+            PIN_MutexUnlock(&mutex);
+            return buf;
+        }
+        if (num_bufs < max_bufs) {
+            ++num_bufs;
+            PIN_MutexUnlock(&mutex);
+            LoadRecord *buf = (LoadRecord *) PIN_AllocateBuffer(buffer);
+            std::memset(buf, 0, buffer_records * sizeof *buf);
+            return buf;
+        }
+        // The consumer is behind; wait for it.
+        PIN_SemaphoreClear(&freed);
+        PIN_MutexUnlock(&mutex);
+        PIN_SemaphoreWait(&freed);
+    }
+}
+
+void *
+BufferFull(BUFFER_ID, THREADID, const CONTEXT *, void *buf, uint64_t n, void *)
+{
+    PIN_MutexLock(&mutex);
+    queue.emplace_back((LoadRecord *) buf, n);
+    ++submitted;
+    PIN_SemaphoreClear(&idle);
+    PIN_SemaphoreSet(&work);
+    PIN_MutexUnlock(&mutex);
+
+    cur_buf = GetFreeBuffer();
+    return cur_buf;
+}
+
+/**
+ * Wait for the consumer to aggregate everything queued, then aggregate the
+ * loads in the buffer Pin is filling. Returns with sketch_mutex held.
+ */
+void
+Sync()
+{
+    // Commands run on the application thread, so nothing is queued while
+    // we wait.
+    for (;;) {
+        PIN_MutexLock(&mutex);
+        const bool done = processed == submitted;
+        PIN_MutexUnlock(&mutex);
+        if (done)
+            break;
+        PIN_SemaphoreWait(&idle);
+    }
+    PIN_MutexLock(&sketch_mutex);
+    // Pin keeps filling the buffer where it left off; the records we take
+    // are zeroed, so they're skipped when it's full.
+    if (cur_buf) {
+        for (size_t i = 0; i < buffer_records; ++i) {
+            if (cur_buf[i].pc) {
+                Aggregate(cur_buf[i]);
+                cur_buf[i] = LoadRecord{};
+            }
+        }
+    }
+}
+
+ADDRINT
+ReturnEA(ADDRINT ea)
+{
+    return ea;
+}
+
+void
+InstrumentTRACE(TRACE trace, void *)
+{
+    if (IsKernelCode(trace))
+        return;
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins)) {
+            if (!INS_IsMemoryRead(ins) || !INS_IsValidForIpointAfter(ins))
+                continue;
+            const REG dst = INS_RegW(ins, 0);
+            if (!REG_valid(dst) || !REG_valid_for_iarg_reg_value(dst))
+                continue;
+            // The address is gone after the load, so stash it.
+            INS_InsertPredicatedCall(ins, IPOINT_BEFORE, (AFUNPTR) ReturnEA,
+                                     IARG_MEMORYREAD_EA,
+                                     IARG_RETURN_REGS, ea_reg,
                                      IARG_END);
+            INS_InsertFillBufferPredicated(ins, IPOINT_AFTER, buffer,
+                                           IARG_INST_PTR, offsetof(LoadRecord, pc),
+                                           IARG_REG_VALUE, ea_reg, offsetof(LoadRecord, addr),
+                                           IARG_REG_VALUE, dst, offsetof(LoadRecord, value),
+                                           IARG_END);
         }
     }
 }
 
+void
+ThreadStart(THREADID tid, CONTEXT *ctx, int32_t, void *)
+{
+    cur_buf = (LoadRecord *) PIN_GetBufferPointer(ctx, buffer);
+    std::memset(cur_buf, 0, buffer_records * sizeof *cur_buf);
+}
+
+void
+PrepareForFini(void *)
+{
+    PIN_MutexLock(&mutex);
+    stopping = true;
+    PIN_SemaphoreSet(&work);
+    PIN_MutexUnlock(&mutex);
+    if (consumer_running)
+        PIN_WaitForThreadTermination(consumer_uid, PIN_INFINITE_TIMEOUT, nullptr);
+    consumer_running = false;
+}
+
+std::string
+hex(ADDRINT x)
+{
+    std::ostringstream ss;
+    ss << std::hex << x;
+    return ss.str();
+}
+
+// One line per top value, hottest first: count error value pc addr.
 void
 Dump(std::string &result)
 {
-    for (std::size_t i = 0; i < hist.size(); ++i)
-        if (const auto count = hist[i])
-            result += std::to_string(count) + ' ' + std::to_string(i) + '\n';
+    Sync();
+    std::vector<TopEntry> sorted = top;
+    PIN_MutexUnlock(&sketch_mutex);
+    std::sort(sorted.begin(), sorted.end(), [] (const TopEntry &a, const TopEntry &b) {
+        return a.count > b.count;
+    });
+    for (const TopEntry &entry : sorted)
+        result += std::to_string(entry.count) + ' ' + std::to_string(entry.error) + ' ' +
+            hex(entry.value) + ' ' + hex(entry.pc) + ' ' + hex(entry.addr) + '\n';
 }
 
 void
 Reset()
 {
-    std::fill(hist.begin(), hist.end(), 0);
+    Sync();
+    sketch.reset();
+    top.clear();
+    top_index.clear();
+    top_min = 0;
+    PIN_MutexUnlock(&sketch_mutex);
+}
+
+void
+Serialize(std::ostream &os)
+{
+    Sync();
+    std::ostringstream sketch_os;
+    sketch.serialize(sketch_os);
+    const std::string sketch_str = sketch_os.str();
+    os << std::count(sketch_str.begin(), sketch_str.end(), '\n') << '\n' << sketch_str;
+    for (const TopEntry &entry : top)
+        os << entry.value << ' ' << entry.count << ' ' << entry.error << ' '
+           << entry.pc << ' ' << entry.addr << '\n';
+    PIN_MutexUnlock(&sketch_mutex);
+}
+
+void
+Unserialize(std::istream &is)
+{
+    size_t n;
+    if (!(is >> n))
+        return;
+    sketch.unserialize(is, n);
+    TopEntry entry;
+    while (is >> entry.value >> entry.count >> entry.error >> entry.pc >> entry.addr) {
+        if (top.size() == topk_size.Value())
+            break;
+        top_index.emplace(entry.value, top.size());
+        top.push_back(entry);
+    }
 }
 
 struct MemoryHistogramPlugin final : Plugin
@@ -77,8 +409,40 @@ struct MemoryHistogramPlugin final : Plugin
     bool
     reg() override
     {
-        INS_AddInstrumentFunction(InstrumentINS, nullptr);
-        return true; 
+        if (sketch_width.Value() == 0 || sketch_depth.Value() == 0 || topk_size.Value() == 0) {
+            std::cerr << "memhist: -memhist-width, -memhist-depth and -memhist-topk must be nonzero\n";
+            return false;
+        }
+        sketch.init(sketch_width.Value(), sketch_depth.Value());
+
+        buffer = PIN_DefineTraceBuffer(sizeof(LoadRecord), buffer_pages.Value(), BufferFull, nullptr);
+        if (buffer == BUFFER_ID_INVALID) {
+            std::cerr << "memhist: failed to define trace buffer\n";
+            return false;
+        }
+        buffer_records = buffer_pages.Value() * 4096 / sizeof(LoadRecord);
+        ea_reg = PIN_ClaimToolRegister();
+        if (ea_reg == REG_INVALID()) {
+            std::cerr << "memhist: no tool register left for load addresses\n";
+            return false;
+        }
+
+        PIN_MutexInit(&mutex);
+        PIN_MutexInit(&sketch_mutex);
+        PIN_SemaphoreInit(&work);
+        PIN_SemaphoreInit(&idle);
+        PIN_SemaphoreInit(&freed);
+        PIN_SemaphoreSet(&idle);
+        if (PIN_SpawnInternalThread(Consumer, nullptr, 0, &consumer_uid) == INVALID_THREADID) {
+            std::cerr << "memhist: failed to spawn consumer thread\n";
+            return false;
+        }
+        consumer_running = true;
+
+        TRACE_AddInstrumentFunction(InstrumentTRACE, nullptr);
+        PIN_AddThreadStartFunction(ThreadStart, nullptr);
+        PIN_AddPrepareForFiniFunction(PrepareForFini, nullptr);
+        return true;
     }
 
     void
@@ -110,6 +474,9 @@ struct MemoryHistogramPlugin final : Plugin
         printUsage();
         std::abort();
     }
+
+    void serialize(std::ostream &os) const override { Serialize(os); }
+    void unserialize(std::istream &is) override { Unserialize(is); }
 } plugin;
 
 }
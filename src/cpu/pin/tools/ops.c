@@ -25,6 +25,10 @@ void __attribute__((naked)) pinop_get_mempath(char *data, size_t size) {
     asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_GET_MEMPATH));
 }
 
+void __attribute__((naked)) pinop_get_chanpath(char *data, size_t size) {
+    asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_GET_CHANPATH));
+}
+
 void __attribute__((naked)) pinop_exit(int code) {
     asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_EXIT));
 }
@@ -38,7 +42,7 @@ void __attribute__((naked)) pinop_resetuser() {
     asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_RESETUSER));
 }
 
-void __attribute__((naked)) pinop_run(struct RunResult *result) {
+void __attribute__((naked)) pinop_run(struct RunResult *result, const struct PinRunArgs *args) {
     asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_RUN));
 }
 
@@ -50,11 +54,15 @@ uint64_t __attribute__((naked)) pinop_get_instcount(void) {
     asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_GET_INSTCOUNT));
 }
 
-void __attribute__((naked)) pinop_set_regs(const struct PinRegFile *regfile) {
+void __attribute__((naked)) pinop_set_syscall_state(const struct PinSyscallState *state) {
+    asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_SET_SYSCALL_STATE));
+}
+
+void __attribute__((naked)) pinop_set_regs(const struct PinRegFile *regfile, uint32_t mask) {
     asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_SET_REGS));
 }
 
-void __attribute__((naked)) pinop_get_regs(struct PinRegFile *regfile) {
+void __attribute__((naked)) pinop_get_regs(struct PinRegFile *regfile, uint32_t mask) {
     asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_GET_REGS));
 }
 
@@ -69,3 +77,19 @@ size_t __attribute__((naked)) pinop_exec_command(const char *cmd) {
 void __attribute__((naked)) pinop_read_command_result(char *buf, size_t idx, size_t size) {
     asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_READ_COMMAND_RESULT));
 }
+
+size_t __attribute__((naked)) pinop_save_state(void) {
+    asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_SAVE_STATE));
+}
+
+void __attribute__((naked)) pinop_load_state_chunk(const char *buf, size_t size) {
+    asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_LOAD_STATE_CHUNK));
+}
+
+void __attribute__((naked)) pinop_load_state(void) {
+    asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_LOAD_STATE));
+}
+
+bool __attribute__((naked)) pinop_share_command_result(void) {
+    asm volatile ("movb $0, (%0)\nret\n" :: "r"(pinops_addr_base + OP_SHARE_COMMAND_RESULT));
+}
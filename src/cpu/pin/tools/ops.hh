@@ -10,6 +10,8 @@
 # include <stddef.h>
 #endif
 
+#include "cpu/pin/shared.h"
+
 enum PinOp
 {
     OP_SET_REG,
@@ -28,6 +30,12 @@ enum PinOp
     OP_ADD_SYMBOL,
     OP_EXEC_COMMAND,
     OP_READ_COMMAND_RESULT,
+    OP_GET_CHANPATH,
+    OP_SET_SYSCALL_STATE,
+    OP_SAVE_STATE,
+    OP_LOAD_STATE_CHUNK,
+    OP_LOAD_STATE,
+    OP_SHARE_COMMAND_RESULT,
     OP_COUNT,
 };
 
@@ -51,6 +59,7 @@ struct RunResult {
     } result;
     union {
         uint64_t addr; // RUNRESULT_PAGEFAULT
+        struct PinSyscallCheck syscall; // RUNRESULT_SYSCALL
     };
 };
 
@@ -60,16 +69,19 @@ void pinop_get_reg(const char *name, uint8_t *data, size_t size);
 void pinop_get_reqpath(char *data, size_t size);
 void pinop_get_resppath(char *data, size_t size);
 void pinop_get_mempath(char *data, size_t size);
+void pinop_get_chanpath(char *data, size_t size);
 void pinop_exit(int code);
 void pinop_abort(const char *msg, size_t line);
 void pinop_resetuser(void);
-void pinop_run(struct RunResult *result);
+void pinop_run(struct RunResult *result, const struct PinRunArgs *args);
 void pinop_set_vsyscall_base(void *virt, void *phys);
 uint64_t pinop_get_instcount(void);
+void pinop_set_syscall_state(const struct PinSyscallState *state);
 
 struct PinRegFile;
-void pinop_set_regs(const struct PinRegFile *regfile);
-void pinop_get_regs(struct PinRegFile *regfile);
+/// Only the register groups in mask (PINREG_*) are set/got.
+void pinop_set_regs(const struct PinRegFile *regfile, uint32_t mask);
+void pinop_get_regs(struct PinRegFile *regfile, uint32_t mask);
 
 void pinop_add_symbol(const char *name, void *vaddr);
 
@@ -77,4 +89,14 @@ void pinop_add_symbol(const char *name, void *vaddr);
 size_t pinop_exec_command(const char *s);
 void pinop_read_command_result(char *buf, size_t idx, size_t size);
 
+/// Serialize all plugins' state. Returns the number of bytes, which are
+/// read back with pinop_read_command_result().
+size_t pinop_save_state(void);
+/// Append to the state to be loaded by pinop_load_state().
+void pinop_load_state_chunk(const char *buf, size_t size);
+void pinop_load_state(void);
+/// Copy the last command result into the shared result region. Returns
+/// false if gem5 didn't give the pintool one.
+bool pinop_share_command_result(void);
+
 #define pinop_abort() (pinop_abort)(__FILE__, __LINE__)
@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <string>
+#include <istream>
+#include <ostream>
 
 struct Plugin
 {
@@ -16,6 +18,13 @@ struct Plugin
     // TODO: Merge cmd into args, so we just have an arg vector (like main functions).
     // TODO: Consider making the result an ostream, not a string.
     virtual bool command(const std::string &cmd, const std::vector<std::string> &args, std::string &result) { return false; }
+
+    // Checkpointing: save and restore any state that should survive a
+    // checkpoint (counters, histograms, ...). unserialize() is called on a
+    // fresh Pin process, before the program runs, with exactly what
+    // serialize() wrote.
+    virtual void serialize(std::ostream &os) const {}
+    virtual void unserialize(std::istream &is) {}
 };
 
 extern std::vector<Plugin *> plugins;
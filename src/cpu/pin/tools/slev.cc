@@ -1,25 +1,31 @@
 // TODO: Don't dump the last interval, or at least extend it with some special kind
 // of marker to indicate it's the last.
 
-#include "slev.hh"
-
 #include <fstream>
 #include <iostream>
 #include <list>
 #include <cassert>
+#include <sstream>
+#include <unordered_map>
 #include <unordered_set>
 #include <pin.H>
 
 #include "client.hh"
+#include "plugin.hh"
+#include "vecfile.hh"
 
 static KNOB<std::string> OutputFile(KNOB_MODE_WRITEONCE, "pintool", "slev", "", "Collect source location edge vectors");
 static KNOB<unsigned long> IntervalSize(KNOB_MODE_WRITEONCE, "pintool", "slev-interval", "0", "SLEV interval size");
 static KNOB<std::string> ProgressMarkerFile(KNOB_MODE_WRITEONCE, "pintool", "slev-progmark", "",
                                             "Path to progress marker file (instruction address list)");
+static KNOB<std::string> OutputFormat(KNOB_MODE_WRITEONCE, "pintool", "slev-format", "text",
+                                      "SLEV output format (text, vec: see vecfile.hh)");
 
 using Count = long;
 
 static std::ofstream out;
+static VecWriter vec_out(64); // Intervals per chunk.
+static bool use_vec = false;
 static std::unordered_set<ADDRINT> progmarks; // TODO: Rename to waypoints.
 static long interval_size = 0;
 
@@ -32,10 +38,11 @@ static int num_intervals = 0;
 
 struct Block {
     long id;
+    ADDRINT addr;
     uint64_t hits;
 
-    Block(long id)
-        : id(id), hits(0)
+    Block(long id, ADDRINT addr, uint64_t hits = 0)
+        : id(id), addr(addr), hits(hits)
     {
     }
 
@@ -47,9 +54,35 @@ struct Block {
 };
 
 static std::list<Block> blocks;
+static long next_id = 1;
+
+// Blocks from a restored checkpoint that haven't been instrumented yet, by
+// address. They keep their old ids, so that intervals stay comparable.
+static std::unordered_multimap<ADDRINT, Block> restored_blocks;
 
 static void
-DumpInterval()
+DumpIntervalVec()
+{
+    VecWriter::Vector vec;
+    for (auto &block : blocks) {
+        if (block.hits) {
+            vec.emplace_back(block.id, block.hits);
+            block.reset();
+        }
+    }
+    for (auto &[addr, block] : restored_blocks) {
+        if (block.hits) {
+            vec.emplace_back(block.id, block.hits);
+            block.reset();
+        }
+    }
+    std::ostringstream comment;
+    comment << "interval=" << num_intervals << " insts=" << prev_insts << "," << total_insts << " progmarks=" << prev_progmarks << "," << total_progmarks;
+    vec_out.addVector(std::move(vec), comment.str());
+}
+
+static void
+DumpIntervalText()
 {
     out << "T";
     for (auto &block : blocks) {
@@ -58,7 +91,22 @@ DumpInterval()
             block.reset();
         }
     }
+    for (auto &[addr, block] : restored_blocks) {
+        if (block.hits) {
+            out << " :" << block.id << ":" << block.hits;
+            block.reset();
+        }
+    }
     out << "\n# interval=" << num_intervals << " insts=" << prev_insts << "," << total_insts << " progmarks=" << prev_progmarks << "," << total_progmarks << "\n";
+}
+
+static void
+DumpInterval()
+{
+    if (use_vec)
+        DumpIntervalVec();
+    else
+        DumpIntervalText();
 
     // Update global counters.
     prev_progmarks = total_progmarks;
@@ -92,7 +140,14 @@ InstrumentBBL(BBL bbl)
     for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
         if (progmarks.count(INS_Address(ins)))
             ++num_progmarks;
-    blocks.emplace_back(blocks.size() + 1);
+    const ADDRINT addr = BBL_Address(bbl);
+    const auto restored_it = restored_blocks.find(addr);
+    if (restored_it != restored_blocks.end()) {
+        blocks.push_back(restored_it->second);
+        restored_blocks.erase(restored_it);
+    } else {
+        blocks.emplace_back(next_id++, addr);
+    }
     Block *block = &blocks.back();
     BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR) UpdateInstCount,
                    IARG_PTR, &block->hits,
@@ -116,48 +171,101 @@ static void
 Finish(int32_t code, void *)
 {
     DumpInterval();
-    out.close();
+    if (use_vec)
+        vec_out.close();
+    else
+        out.close();
 }
 
-bool
-slev_register()
+namespace {
+struct SLEVPlugin final : Plugin
 {
-    if (OutputFile.Value().empty())
-        return true;
+    const char *name() const override { return "slev"; }
 
-    out.open(OutputFile.Value());
-    if (!out) {
-        std::cerr << "slev: failed to open output file\n";
-        return false;
-    }
+    int priority() const override { return 1; }
 
-    if (IntervalSize.Value() == 0) {
-        std::cerr << "slev: -slev-interval: required\n";
-        return false;
+    bool
+    enabled() const override
+    {
+        return !OutputFile.Value().empty();
     }
 
-    if (ProgressMarkerFile.Value().empty()) {
-        std::cerr << "slev: -slev-progmark: required\n";
-        return false;
-    }
+    bool
+    reg() override
+    {
+        if (OutputFormat.Value() == "vec") {
+            use_vec = true;
+        } else if (OutputFormat.Value() != "text") {
+            std::cerr << "slev: -slev-format: must be text or vec\n";
+            return false;
+        }
+        bool opened;
+        if (use_vec) {
+            opened = vec_out.open(OutputFile.Value(), VecWriter::Vectors);
+        } else {
+            out.open(OutputFile.Value());
+            opened = static_cast<bool>(out);
+        }
+        if (!opened) {
+            std::cerr << "slev: failed to open output file\n";
+            return false;
+        }
 
-    // Parse progress markers.
-    std::ifstream progmark_f(ProgressMarkerFile.Value());
-    if (!progmark_f) {
-        std::cerr << "slev: failed to open progress marker file\n";
-        return false;
-    }
-    progmark_f >> std::hex;
-    ADDRINT inst;
-    while (progmark_f >> inst)
-        progmarks.insert(inst);
+        if (IntervalSize.Value() == 0) {
+            std::cerr << "slev: -slev-interval: required\n";
+            return false;
+        }
 
-    // Set interval size.
-    interval_size = IntervalSize.Value();
+        if (ProgressMarkerFile.Value().empty()) {
+            std::cerr << "slev: -slev-progmark: required\n";
+            return false;
+        }
 
-    // Register callbacks.
-    TRACE_AddInstrumentFunction(InstrumentTRACE, nullptr);
-    PIN_AddFiniFunction(Finish, nullptr);
+        // Parse progress markers.
+        std::ifstream progmark_f(ProgressMarkerFile.Value());
+        if (!progmark_f) {
+            std::cerr << "slev: failed to open progress marker file\n";
+            return false;
+        }
+        progmark_f >> std::hex;
+        ADDRINT inst;
+        while (progmark_f >> inst)
+            progmarks.insert(inst);
 
-    return true;
+        // Set interval size.
+        interval_size = IntervalSize.Value();
+
+        // Register callbacks.
+        TRACE_AddInstrumentFunction(InstrumentTRACE, nullptr);
+        PIN_AddFiniFunction(Finish, nullptr);
+
+        return true;
+    }
+
+    // A restored run appends intervals to a new output file, numbered from
+    // where the checkpoint left off.
+    void
+    serialize(std::ostream &os) const override
+    {
+        os << prev_progmarks << ' ' << total_progmarks << ' '
+           << cur_insts << ' ' << prev_insts << ' ' << total_insts << ' '
+           << num_intervals << ' ' << next_id << '\n';
+        for (const Block &block : blocks)
+            os << block.id << ' ' << block.addr << ' ' << block.hits << '\n';
+        for (const auto &[addr, block] : restored_blocks)
+            os << block.id << ' ' << addr << ' ' << block.hits << '\n';
+    }
+
+    void
+    unserialize(std::istream &is) override
+    {
+        is >> prev_progmarks >> total_progmarks >> cur_insts >> prev_insts
+           >> total_insts >> num_intervals >> next_id;
+        long id;
+        ADDRINT addr;
+        uint64_t hits;
+        while (is >> id >> addr >> hits)
+            restored_blocks.emplace(addr, Block(id, addr, hits));
+    }
+} plugin;
 }
@@ -1 +0,0 @@
-bool slev_register();
@@ -115,3 +115,14 @@ int arch_prctl(int code, unsigned long addr) {
         : "i"(SYS_arch_prctl), "r"(code), "r"(addr));
     return set_errno(result);
 }
+
+long futex(uint32_t *uaddr, int op, uint32_t val) {
+    long result;
+    asm volatile (
+        "xorl %%r10d, %%r10d\n"
+        "syscall\n"
+        : "=a"(result)
+        : "0"((long) SYS_futex), "D"(uaddr), "S"(op), "d"(val)
+        : "rcx", "r10", "r11", "memory");
+    return set_errno(result);
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 void __attribute__((noreturn)) exit(int code);
@@ -10,5 +11,6 @@ int open(const char *path, int flags, ...);
 void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
 int munmap(void *addr, size_t length);
 int arch_prctl(int code, unsigned long addr);
+long futex(uint32_t *uaddr, int op, uint32_t val);
 
 extern int errno;
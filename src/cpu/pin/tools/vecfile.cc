@@ -0,0 +1,210 @@
+#include "vecfile.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+void
+putU32(std::string &buf, uint32_t x)
+{
+    for (int i = 0; i < 4; ++i)
+        buf.push_back(static_cast<char>(x >> (i * 8)));
+}
+
+void
+putU64(std::string &buf, uint64_t x)
+{
+    for (int i = 0; i < 8; ++i)
+        buf.push_back(static_cast<char>(x >> (i * 8)));
+}
+
+void
+putVarint(std::string &buf, uint64_t x)
+{
+    while (x >= 0x80) {
+        buf.push_back(static_cast<char>(x | 0x80));
+        x >>= 7;
+    }
+    buf.push_back(static_cast<char>(x));
+}
+
+const char file_magic[] = "PINVEC01";
+const char index_magic[] = "PINVIDX1";
+
+}
+
+bool
+VecWriter::open(const std::string &path, Kind kind)
+{
+    this->kind = kind;
+    os.open(path, std::ios::binary);
+    if (!os)
+        return false;
+
+    std::string header(file_magic, 8);
+    putU32(header, kind);
+    putU32(header, 0);
+    os.write(header.data(), header.size());
+
+    cur.firstRecord = 0;
+    PIN_MutexInit(&mutex);
+    PIN_SemaphoreInit(&ready);
+    if (PIN_SpawnInternalThread(writerMain, this, 0, &threadUid) ==
+        INVALID_THREADID) {
+        std::cerr << "vecfile: failed to spawn writer thread\n";
+        return false;
+    }
+    threadRunning = true;
+    PIN_AddPrepareForFiniFunction(prepareForFini, this);
+    return static_cast<bool>(os);
+}
+
+void
+VecWriter::addVector(Vector &&vec, const std::string &comment)
+{
+    cur.vectors.emplace_back(std::move(vec), comment);
+    ++numRecords;
+    if (cur.size() >= chunkRecords)
+        submit();
+}
+
+void
+VecWriter::addTrace(const uint32_t *hashes, size_t n)
+{
+    while (n > 0) {
+        const size_t m = std::min(n, chunkRecords - cur.trace.size());
+        cur.trace.insert(cur.trace.end(), hashes, hashes + m);
+        numRecords += m;
+        hashes += m;
+        n -= m;
+        if (cur.size() >= chunkRecords)
+            submit();
+    }
+}
+
+void
+VecWriter::submit()
+{
+    if (cur.size() == 0)
+        return;
+    // The next chunk starts after the records added so far.
+    Chunk chunk;
+    chunk.firstRecord = numRecords;
+    std::swap(chunk, cur);
+
+    // Once the writer thread is stopping, close() writes what's left.
+    PIN_MutexLock(&mutex);
+    queue.push_back(std::move(chunk));
+    if (!stopping)
+        PIN_SemaphoreSet(&ready);
+    PIN_MutexUnlock(&mutex);
+}
+
+void
+VecWriter::write(const Chunk &chunk)
+{
+    std::string payload;
+    if (kind == Vectors) {
+        for (const auto &[vec, comment] : chunk.vectors) {
+            Vector sorted = vec;
+            std::sort(sorted.begin(), sorted.end());
+            putVarint(payload, sorted.size());
+            uint64_t prev_id = 0;
+            for (const auto &[id, count] : sorted) {
+                putVarint(payload, id - prev_id);
+                putVarint(payload, count);
+                prev_id = id;
+            }
+            putVarint(payload, comment.size());
+            payload += comment;
+        }
+    } else {
+        std::unordered_map<uint32_t, uint64_t> dict;
+        for (const uint32_t hash : chunk.trace) {
+            const auto it = dict.find(hash);
+            if (it == dict.end()) {
+                putVarint(payload, 0);
+                putU32(payload, hash);
+                dict.emplace(hash, dict.size() + 1);
+            } else {
+                putVarint(payload, it->second);
+            }
+        }
+    }
+
+    index.emplace_back(chunk.firstRecord, os.tellp());
+    std::string header;
+    putU32(header, None);
+    putU32(header, chunk.size());
+    putU64(header, chunk.firstRecord);
+    putU32(header, payload.size());
+    putU32(header, payload.size());
+    os.write(header.data(), header.size());
+    os.write(payload.data(), payload.size());
+}
+
+void
+VecWriter::writerMain(void *arg)
+{
+    VecWriter *w = static_cast<VecWriter *>(arg);
+    bool done = false;
+    while (!done) {
+        PIN_SemaphoreWait(&w->ready);
+        PIN_MutexLock(&w->mutex);
+        PIN_SemaphoreClear(&w->ready);
+        std::deque<Chunk> chunks;
+        std::swap(chunks, w->queue);
+        done = w->stopping;
+        PIN_MutexUnlock(&w->mutex);
+
+        for (const Chunk &chunk : chunks)
+            w->write(chunk);
+    }
+}
+
+void
+VecWriter::stopThread()
+{
+    if (!threadRunning)
+        return;
+    PIN_MutexLock(&mutex);
+    stopping = true;
+    PIN_SemaphoreSet(&ready);
+    PIN_MutexUnlock(&mutex);
+    PIN_WaitForThreadTermination(threadUid, PIN_INFINITE_TIMEOUT, nullptr);
+    threadRunning = false;
+}
+
+void
+VecWriter::prepareForFini(void *arg)
+{
+    // Internal threads have to be joined before Fini functions run.
+    // Records added after this (e.g., trace buffers flushed at thread exit)
+    // are written by close().
+    static_cast<VecWriter *>(arg)->stopThread();
+}
+
+void
+VecWriter::close()
+{
+    stopThread();
+    submit();
+    for (const Chunk &chunk : queue)
+        write(chunk);
+    queue.clear();
+
+    std::string trailer;
+    const uint64_t index_offset = os.tellp();
+    putU64(trailer, index.size());
+    for (const auto &[first_record, offset] : index) {
+        putU64(trailer, first_record);
+        putU64(trailer, offset);
+    }
+    putU64(trailer, index_offset);
+    trailer.append(index_magic, 8);
+    os.write(trailer.data(), trailer.size());
+    os.close();
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <pin.H>
+
+/*
+ * Chunked binary format for basic block vectors and traces (see
+ * configs/multibin/VecFile.py, which also reads it back as text).
+ *
+ * All integers are little-endian.
+ *
+ *   file:   magic "PINVEC01", u32 kind, u32 reserved, chunk*, index, footer
+ *   chunk:  u32 codec, u32 num_records, u64 first_record, u32 raw_size,
+ *           u32 stored_size, stored_size bytes of (possibly compressed)
+ *           payload
+ *   index:  u64 num_chunks, num_chunks * (u64 first_record, u64 offset)
+ *   footer: u64 index offset, magic "PINVIDX1"
+ *
+ * Vector payloads hold one record per interval: varint n, then n pairs of
+ * (varint id delta, varint count) in increasing id order, then a varint
+ * length and that many bytes of comment (e.g., SLEV interval metadata).
+ * Trace payloads hold one record per block: varint 0 followed by a u32
+ * hash the first time the hash appears in the chunk, and varint i + 1 for
+ * the chunk's i'th distinct hash after that.
+ *
+ * Files without an index (e.g., the writer was killed) can still be read
+ * sequentially.
+ */
+class VecWriter
+{
+  public:
+    enum Kind : uint32_t
+    {
+        Vectors = 0,
+        Trace = 1,
+    };
+
+    enum Codec : uint32_t
+    {
+        None = 0,
+        Zlib = 1, // Not available in PinCRT; written by VecFile.py only.
+    };
+
+    using Vector = std::vector<std::pair<uint64_t, uint64_t>>;
+
+    VecWriter(size_t chunk_records) : chunkRecords(chunk_records) {}
+    VecWriter(const VecWriter &) = delete;
+
+    /**
+     * Open the file and start the writer thread. Encoding and I/O happen
+     * there, so adding records only costs a copy.
+     */
+    bool open(const std::string &path, Kind kind);
+
+    /// Add one interval's vector of (id, count) pairs.
+    void addVector(Vector &&vec, const std::string &comment);
+    /// Add block hashes to a trace.
+    void addTrace(const uint32_t *hashes, size_t n);
+
+    /// Write out everything and add the index. Call from a Fini function.
+    void close();
+
+  private:
+    struct Chunk
+    {
+        uint64_t firstRecord;
+        std::vector<std::pair<Vector, std::string>> vectors;
+        std::vector<uint32_t> trace;
+
+        size_t
+        size() const
+        {
+            return vectors.empty() ? trace.size() : vectors.size();
+        }
+    };
+
+    const size_t chunkRecords;
+    Kind kind;
+    std::ofstream os;
+
+    // Chunk being filled by the application thread.
+    Chunk cur;
+    uint64_t numRecords = 0;
+
+    // Full chunks, waiting for the writer thread.
+    PIN_MUTEX mutex;
+    PIN_SEMAPHORE ready;
+    std::deque<Chunk> queue;
+    bool stopping = false;
+    bool threadRunning = false;
+    PIN_THREAD_UID threadUid;
+
+    // (first record, file offset) of each chunk written.
+    std::vector<std::pair<uint64_t, uint64_t>> index;
+
+    void submit();
+    void write(const Chunk &chunk);
+    /// Drain the queue and join the writer thread.
+    void stopThread();
+
+    static void writerMain(void *arg);
+    static void prepareForFini(void *arg);
+};
@@ -23,6 +23,12 @@ Analyze(ADDRINT n)
     waypointcount += n;
 }
 
+static ADDRINT
+Units(INS ins)
+{
+    return isWaypoint(ins) ? 1 : 0;
+}
+
 static void
 InstrumentBBL(BBL bbl)
 {
@@ -67,7 +73,7 @@ struct WaypointCountPlugin final : Plugin
     reg() override
     {
         TRACE_AddInstrumentFunction(InstrumentTRACE, nullptr);
-        RegisterCounter("waypoint", &waypointcount);
+        RegisterCounter("waypoint", &waypointcount, Units);
         PIN_AddFiniFunction(Finish, nullptr);
         return true;
     }
@@ -80,5 +86,8 @@ struct WaypointCountPlugin final : Plugin
         result = std::to_string(waypointcount);
         return true;
     }
+
+    void serialize(std::ostream &os) const override { os << waypointcount; }
+    void unserialize(std::istream &is) override { is >> waypointcount; }
 } plugin;
 }
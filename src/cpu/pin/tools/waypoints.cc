@@ -12,7 +12,7 @@ static KNOB<std::string> WaypointsFile(KNOB_MODE_WRITEONCE, "pintool", "waypoint
 
 std::unordered_set<ADDRINT> waypoints;
 
-static bool
+bool
 isWaypoint(INS ins)
 {
     return waypoints.count(INS_Address(ins)) > 0;
@@ -5,4 +5,5 @@
 
 extern std::unordered_set<ADDRINT> waypoints;
 
+bool isWaypoint(INS ins);
 ADDRINT countStaticWaypoints(BBL bbl);
@@ -38,19 +38,28 @@
 #include "mem/physical.hh"
 
 #include <fcntl.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/user.h>
 #include <unistd.h>
 #include <zlib.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <climits>
 #include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
 #include <iostream>
 #include <string>
+#include <thread>
 
 #include "base/intmath.hh"
+#include "base/soft_dirty.hh"
 #include "base/trace.hh"
 #include "debug/AddrRanges.hh"
 #include "debug/Checkpoint.hh"
@@ -77,19 +86,159 @@ namespace gem5
 namespace memory
 {
 
+namespace
+{
+
+// Pages hashed or compressed by one task when checkpointing with
+// pagelists (16 MiB with 4 KiB pages).
+constexpr std::size_t pagesPerChunk = 4096;
+
+struct PageSummary
+{
+    // Not written since the last checkpoint; neither checked nor hashed.
+    bool clean;
+    bool zero;
+    std::pair<uint64_t, uint64_t> hash;
+};
+
+uint64_t
+loadWord(const uint8_t *p)
+{
+    uint64_t word;
+    std::memcpy(&word, p, sizeof word);
+    return word;
+}
+
+uint64_t
+rotl(uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+bool
+isZeroPage(const uint8_t *page, std::size_t size)
+{
+    // Check a 64-byte block at a time, OR-ing its words together so the
+    // compiler can vectorize it, and give up at the first nonzero block.
+    for (std::size_t i = 0; i != size; i += 64) {
+        uint64_t acc = 0;
+        for (std::size_t j = 0; j != 64; j += 8)
+            acc |= loadWord(page + i + j);
+        if (acc)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * A 128-bit non-cryptographic page hash: four independent lanes of
+ * XXH64 rounds, so the loop pipelines, folded into two words.
+ */
+std::pair<uint64_t, uint64_t>
+hashPage(const uint8_t *page, std::size_t size)
+{
+    constexpr uint64_t prime1 = 0x9e3779b185ebca87ULL;
+    constexpr uint64_t prime2 = 0xc2b2ae3d27d4eb4fULL;
+    constexpr uint64_t prime3 = 0x165667b19e3779f9ULL;
+    uint64_t lanes[4] = {prime1 + prime2, prime2, 0, -prime1};
+    for (std::size_t i = 0; i != size; i += 32) {
+        for (int l = 0; l != 4; ++l) {
+            lanes[l] += loadWord(page + i + l * 8) * prime2;
+            lanes[l] = rotl(lanes[l], 31) * prime1;
+        }
+    }
+    const auto avalanche = [] (uint64_t h) {
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+        return h;
+    };
+    return {avalanche(rotl(lanes[0], 1) + rotl(lanes[1], 7) +
+                      rotl(lanes[2], 12) + rotl(lanes[3], 18)),
+            avalanche(lanes[0] ^ rotl(lanes[1], 19) ^ rotl(lanes[2], 37) ^
+                      rotl(lanes[3], 53))};
+}
+
+/**
+ * Hash a range of a file, a block at a time (block must be a multiple of
+ * 32 bytes).
+ */
+std::pair<uint64_t, uint64_t>
+hashFileRange(int fd, uint64_t offset, uint64_t size, std::size_t block)
+{
+    std::pair<uint64_t, uint64_t> hash(size, 0);
+    std::vector<uint8_t> buf(block);
+    for (uint64_t done = 0; done < size; done += block) {
+        std::fill(buf.begin(), buf.end(), 0);
+        const std::size_t want = std::min<uint64_t>(block, size - done);
+        if (pread(fd, buf.data(), want, offset + done) != (ssize_t)want)
+            fatal("Failed to read %d bytes at %d\n", want, offset + done);
+        const auto block_hash = hashPage(buf.data(), block);
+        hash.first = rotl(hash.first, 23) ^ block_hash.first;
+        hash.second = rotl(hash.second, 23) ^ block_hash.second;
+    }
+    return hash;
+}
+
+bool
+startsGzipMember(int fd, uint64_t offset)
+{
+    uint8_t magic[2];
+    return pread(fd, magic, sizeof magic, offset) == sizeof magic &&
+        magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+/**
+ * Compress pages into a gzip member. Members can be concatenated, and
+ * gzread() reads them back as one stream.
+ */
+std::string
+compressPages(std::vector<const uint8_t *> pages, std::size_t page_size)
+{
+    z_stream zs = {};
+    // 16 + 15 window bits: a gzip header and trailer, as gzopen() writes.
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + 15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        panic("deflateInit2 failed\n");
+    std::string out(deflateBound(&zs, pages.size() * page_size), '\0');
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = out.size();
+    for (std::size_t i = 0; i != pages.size(); ++i) {
+        zs.next_in = const_cast<Bytef *>(pages[i]);
+        zs.avail_in = page_size;
+        const int flush = i + 1 == pages.size() ? Z_FINISH : Z_NO_FLUSH;
+        const int res = deflate(&zs, flush);
+        panic_if(res != (flush == Z_FINISH ? Z_STREAM_END : Z_OK),
+                 "deflate failed\n");
+    }
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+} // anonymous namespace
+
 PhysicalMemory::PhysicalMemory(const std::string& _name,
                                const std::vector<AbstractMemory*>& _memories,
                                bool mmap_using_noreserve,
                                const std::string& shared_backstore,
                                bool auto_unlink_shared_backstore,
                                bool anonymous_shared_backstore,
-                               bool serialize_using_pagelist) :
+                               bool serialize_using_pagelist,
+                               unsigned pagelist_threads,
+                               const std::string &pagelist_cache,
+                               bool pagelist_dirty_tracking) :
     _name(_name), size(0), mmapUsingNoReserve(mmap_using_noreserve),
     sharedBackstore(shared_backstore),
     anonymousSharedBackstore(anonymous_shared_backstore),
     sharedBackstoreSize(0),
     pageSize(sysconf(_SC_PAGE_SIZE)),
-    serializeUsingPagelist(serialize_using_pagelist)    
+    serializeUsingPagelist(serialize_using_pagelist),
+    pagelistThreads(pagelist_threads),
+    pagelistCache(pagelist_cache),
+    trackDirty(pagelist_dirty_tracking && serialize_using_pagelist)
 {
     // Register cleanup callback if requested.
     if (auto_unlink_shared_backstore && !sharedBackstore.empty()) {
@@ -199,6 +348,63 @@ PhysicalMemory::PhysicalMemory(const std::string& _name,
                            f->isConfReported(), f->isInAddrMap(),
                            f->isKvmMap());
     }
+
+    if (trackDirty && !soft_dirty::supported()) {
+        warn("No soft-dirty page tracking (CONFIG_MEM_SOFT_DIRTY); "
+             "checkpoints will hash every page\n");
+        trackDirty = false;
+    }
+    if (trackDirty) {
+        for (const auto &s : backingStore)
+            dirtyPages.emplace_back(s.range.size() / pageSize);
+        lastPageIds.resize(backingStore.size());
+    }
+}
+
+void
+PhysicalMemory::markDirty(Addr paddr, Addr size)
+{
+    if (!trackDirty)
+        return;
+    for (std::size_t i = 0; i != backingStore.size(); ++i) {
+        const AddrRange &range = backingStore[i].range;
+        if (!range.contains(paddr))
+            continue;
+        const Addr end = std::min<Addr>(paddr + size, range.end());
+        for (Addr addr = paddr; addr < end; addr += pageSize)
+            dirtyPages[i][(addr - range.start()) / pageSize] = true;
+        return;
+    }
+}
+
+void
+PhysicalMemory::collectDirtyPages() const
+{
+    for (std::size_t i = 0; i != backingStore.size(); ++i) {
+        const BackingStoreEntry &s = backingStore[i];
+        const Addr base = (Addr)s.pmem;
+        std::vector<bool> &dirty = dirtyPages[i];
+        if (s.shmFd < 0) {
+            soft_dirty::forEachDirtyPage(0, base, s.range.size(), pageSize,
+                                         [&] (Addr vaddr) {
+                                             dirty[(vaddr - base) /
+                                                   pageSize] = true;
+                                         });
+            continue;
+        }
+
+        // Reclaiming a shared page loses its soft-dirty bit, so go by the
+        // file, which also reports the pages that aren't present.
+        struct stat st;
+        if (fstat(s.shmFd, &st) < 0)
+            panic("fstat failed on a shared backing store\n");
+        soft_dirty::forEachDirtyFilePage(0, st.st_ino, base, s.range.size(),
+                                         pageSize, [&] (Addr offset) {
+            const Addr page = (offset - s.shmOffset) / pageSize;
+            if (offset >= (Addr)s.shmOffset && page < dirty.size())
+                dirty[page] = true;
+        });
+    }
 }
 
 void
@@ -365,12 +571,22 @@ PhysicalMemory::serialize(CheckpointOut &cp) const
     unsigned int nbr_of_stores = backingStore.size();
     SERIALIZE_SCALAR(nbr_of_stores);
 
+    ++pagelistPass;
+    if (trackDirty)
+        collectDirtyPages();
     unsigned int store_id = 0;
     // store each backing store memory segment in a file
     for (auto& s : backingStore) {
         ScopedCheckpointSection sec(cp, csprintf("store%d", store_id));
         serializeStore(cp, store_id++, s.range, s.pmem);
     }
+    // The next checkpoint only needs what's written from here on.
+    if (trackDirty) {
+        if (!soft_dirty::clear(0))
+            panic("Failed to clear soft-dirty bits\n");
+        for (auto &dirty : dirtyPages)
+            std::fill(dirty.begin(), dirty.end(), false);
+    }
 }
 
 void
@@ -448,17 +664,17 @@ PhysicalMemory::serializeStorePaged(CheckpointOut &cp, unsigned int store_id,
     SERIALIZE_SCALAR(filename_ids);
     SERIALIZE_SCALAR(range_size);
 
-    // Open page file.
+    // Open page file. New pages are appended to the previous checkpoint's
+    // page file (hardlinked) as another gzip member, so ids carry over.
     const std::string filepath_pages = CheckpointIn::dir() + "/" + filename_pages;
     if (!(::access(filepath_pages.c_str(), F_OK) < 0 && (errno == ENOENT || errno == ENOTDIR)))
         fatal("File already exists. Refusing to overwrite it.\n");
     if (!pagelistPath.empty())
         if (link(pagelistPath.c_str(), filepath_pages.c_str()) < 0)
             fatal("Failed to hardlink paths\n");
-    FILE *file_pages_raw = std::fopen(filepath_pages.c_str(), "ab");
-    if (!file_pages_raw)
+    FILE *file_pages = std::fopen(filepath_pages.c_str(), "ab");
+    if (!file_pages)
         fatal("Failed to open memory checkpoint page file %s\n", filepath_pages);
-    gzFile file_pages = ::gzdopen(fileno(file_pages_raw), "wb");
     pagelistPath = filepath_pages;
 
     // Open id file.
@@ -467,23 +683,142 @@ PhysicalMemory::serializeStorePaged(CheckpointOut &cp, unsigned int store_id,
     if (!file_ids)
         fatal("Failed to open memory checkpoint id file %s\n", filepath_ids);
 
-    // Memory pages.
+    // Memory pages. Chunks are hashed and their new pages compressed in
+    // parallel, while ids are assigned and everything is written in order
+    // here, with at most `threads` chunks in each stage.
     assert((range.size() & (pageSize - 1)) == 0);
-    for (std::size_t i = 0; i != range.size(); i += pageSize) {
-        // Hash the page.
-        const Sha256Hash page_hash = sha256(&mem[i], pageSize);
-        const auto res = pages.emplace(page_hash, pages.size());
-        const PageId id = res.first->second;
-        if (res.second) {
-            // Added new page; write out to page file.
-            if (gzwrite(file_pages, &mem[i], pageSize) != pageSize)
-                fatal("Failed to write page data\n");
+    const std::size_t num_pages = range.size() / pageSize;
+    const std::size_t num_chunks = divCeil(num_pages, pagesPerChunk);
+    const unsigned threads = pagelistThreads ? pagelistThreads :
+        std::max(std::thread::hardware_concurrency(), 1u);
+
+    // With dirty tracking, pages not written since the last checkpoint
+    // (which went to the same page file) keep their ids.
+    const bool incremental = trackDirty &&
+        lastPageIds[store_id].size() == num_pages;
+    if (trackDirty)
+        lastPageIds[store_id].resize(num_pages);
+
+    const auto hash_chunk = [&] (std::size_t chunk) {
+        const std::size_t begin = chunk * pagesPerChunk;
+        const std::size_t end = std::min(begin + pagesPerChunk, num_pages);
+        std::vector<PageSummary> summaries(end - begin);
+        for (std::size_t i = begin; i != end; ++i) {
+            const uint8_t *page = &mem[i * pageSize];
+            PageSummary &summary = summaries[i - begin];
+            summary.clean = incremental && !dirtyPages[store_id][i];
+            if (summary.clean)
+                continue;
+            summary.zero = isZeroPage(page, pageSize);
+            if (!summary.zero)
+                summary.hash = hashPage(page, pageSize);
         }
-        if (std::fwrite(&id, sizeof id, 1, file_ids) != 1)
+        return summaries;
+    };
+
+    std::deque<std::future<std::vector<PageSummary>>> hashing;
+    // Each chunk's new pages are compressed, and their entries given
+    // digests, on a worker.
+    std::deque<std::future<std::string>> compressing;
+    std::size_t next_chunk = 0;
+    const auto write_member = [&] {
+        const std::string member = compressing.front().get();
+        compressing.pop_front();
+        if (std::fwrite(member.data(), 1, member.size(), file_pages) !=
+            member.size())
+            fatal("Failed to write page data\n");
+    };
+
+    std::size_t new_pages_total = 0;
+    std::size_t zero_pages = 0;
+    std::size_t clean_pages = 0;
+    std::vector<PageId> ids;
+    for (std::size_t chunk = 0; chunk != num_chunks; ++chunk) {
+        while (next_chunk != num_chunks && hashing.size() < threads)
+            hashing.push_back(std::async(std::launch::async, hash_chunk,
+                                         next_chunk++));
+        const std::vector<PageSummary> summaries = hashing.front().get();
+        hashing.pop_front();
+
+        ids.clear();
+        std::vector<const uint8_t *> new_pages;
+        std::vector<std::pair<PageEntry *, const uint8_t *>> new_entries;
+        const uint8_t *chunk_mem = &mem[chunk * pagesPerChunk * pageSize];
+        for (std::size_t i = 0; i != summaries.size(); ++i) {
+            const uint8_t *page = chunk_mem + i * pageSize;
+            const PageSummary &summary = summaries[i];
+            if (summary.clean) {
+                ++clean_pages;
+                ids.push_back(
+                    lastPageIds[store_id][chunk * pagesPerChunk + i]);
+                continue;
+            }
+            if (summary.zero) {
+                ++zero_pages;
+                if (!zeroPage) {
+                    zeroPage = numPages++;
+                    new_pages.push_back(page);
+                }
+                ids.push_back(*zeroPage);
+                continue;
+            }
+            const auto res = pages.try_emplace(
+                summary.hash, PageEntry{numPages, page, pagelistPass});
+            PageEntry &entry = res.first->second;
+            if (res.second) {
+                // Added new page.
+                ids.push_back(numPages++);
+                new_pages.push_back(page);
+                new_entries.emplace_back(&entry, page);
+            } else if (entry.pass == pagelistPass ?
+                       std::memcmp(entry.witness, page, pageSize) != 0 :
+                       sha256(page, pageSize) != entry.digest) {
+                // Hash collision. Store the page on its own; it won't be
+                // deduplicated.
+                warn("Page hash collision at offset %#x\n",
+                     (page - mem));
+                ids.push_back(numPages++);
+                new_pages.push_back(page);
+            } else {
+                entry.witness = page;
+                entry.pass = pagelistPass;
+                ids.push_back(entry.id);
+            }
+        }
+        if (std::fwrite(ids.data(), sizeof(PageId), ids.size(), file_ids) !=
+            ids.size())
             fatal("Failed to write page id\n");
+        if (trackDirty)
+            std::copy(ids.begin(), ids.end(),
+                      &lastPageIds[store_id][chunk * pagesPerChunk]);
+
+        new_pages_total += new_pages.size();
+        if (!new_pages.empty()) {
+            compressing.push_back(std::async(
+                std::launch::async,
+                [this, pages = std::move(new_pages),
+                 entries = std::move(new_entries)] () mutable {
+                    // Nothing reads a digest until a later pass.
+                    for (const auto &[entry, page] : entries)
+                        entry->digest = sha256(page, pageSize);
+                    return compressPages(std::move(pages), pageSize);
+                }));
+        }
+        while (compressing.size() >= threads ||
+               (!compressing.empty() &&
+                compressing.front().wait_for(std::chrono::seconds(0)) ==
+                std::future_status::ready))
+            write_member();
     }
+    while (!compressing.empty())
+        write_member();
 
-    gzclose(file_pages);
+    DPRINTF(Checkpoint, "Wrote %d new pages of %d (%d zero, %d clean)\n",
+            new_pages_total, num_pages, zero_pages, clean_pages);
+
+    if (std::fclose(file_pages))
+        fatal("Close failed on memory checkpoint page file %s\n",
+              filepath_pages);
     std::fclose(file_ids);
 }
 
@@ -583,14 +918,10 @@ PhysicalMemory::unserializeStorePaged(CheckpointIn &cp, unsigned int store_id,
     const std::string filepath_pages = path(filename_pages);
     const std::string filepath_ids = path(filename_ids);
 
-    gzFile file_pages = gzopen(filepath_pages.c_str(), "rb");
-    if (!file_pages)
-        fatal("Can't open physical memory checkpoint pages file '%s'\n", filename_pages);
     FILE *file_ids = std::fopen(filepath_ids.c_str(), "rb");
     if (!file_ids)
         fatal("Can't open physical memory checkpoint pageid file '%s'\n", filename_ids);
 
-    using PageId = int;
     using Page = std::vector<uint8_t>;
 
     // we've already got the actual backing store mapped
@@ -608,6 +939,22 @@ PhysicalMemory::unserializeStorePaged(CheckpointIn &cp, unsigned int store_id,
         fatal("Memory range size has changed! Saw %lld, expected %lld\n",
               range_size, range.size());
 
+    // Parse ids.
+    std::vector<PageId> ids(range.size() / pageSize);
+    if (std::fread(ids.data(), sizeof(PageId), ids.size(), file_ids) !=
+        ids.size())
+        fatal("Failed to read page ids\n");
+    std::fclose(file_ids);
+
+    if (!pagelistCache.empty()) {
+        unserializeStoreCached(store_id, filepath_pages, ids);
+        return;
+    }
+
+    gzFile file_pages = gzopen(filepath_pages.c_str(), "rb");
+    if (!file_pages)
+        fatal("Can't open physical memory checkpoint pages file '%s'\n", filename_pages);
+
     // Parse page table.
     std::vector<Page> pages;
     while (true) {
@@ -621,15 +968,245 @@ PhysicalMemory::unserializeStorePaged(CheckpointIn &cp, unsigned int store_id,
     }
     gzclose(file_pages);
 
-    // Parse ids.
-    for (std::size_t i = 0; i != range.size(); i += pageSize) {
-        PageId id;
-        if (std::fread(&id, sizeof id, 1, file_ids) != 1)
-            fatal("Failed to read page id\n");
-        const Page &page = pages.at(id);
-        std::copy(page.begin(), page.end(), &pmem[i]);
-    }
-}   
+    for (std::size_t i = 0; i != ids.size(); ++i) {
+        const Page &page = pages.at(ids[i]);
+        std::copy(page.begin(), page.end(), &pmem[i * pageSize]);
+    }
+}
+
+int
+PhysicalMemory::openPageCache(const std::string &filepath_pages,
+                              std::vector<bool> &zero) const
+{
+    struct stat st;
+    if (stat(filepath_pages.c_str(), &st) < 0)
+        fatal("Can't stat physical memory checkpoint pages file '%s'\n",
+              filepath_pages);
+    const uint64_t size = st.st_size;
+
+    if (mkdir(pagelistCache.c_str(), 0777) < 0 && errno != EEXIST)
+        fatal("Can't create page cache directory '%s'\n", pagelistCache);
+    const std::string base = csprintf("%s/%x-%x", pagelistCache,
+                                      st.st_dev, st.st_ino);
+    const std::string filepath_raw = base + ".raw";
+    const std::string filepath_meta = base + ".meta";
+    const std::string filepath_lock = base + ".lock";
+
+    // Other runs may be restoring from the same page file. The lock is a
+    // file of its own, since the copy may be replaced.
+    const int fd_lock = open(filepath_lock.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd_lock < 0 || flock(fd_lock, LOCK_EX) < 0)
+        fatal("Can't lock page cache file '%s'\n", filepath_lock);
+
+    const int fd_pages = open(filepath_pages.c_str(), O_RDONLY);
+    if (fd_pages < 0)
+        fatal("Can't open physical memory checkpoint pages file '%s'\n",
+              filepath_pages);
+
+    // The metadata: hashes of the start of the page file and of the
+    // members last decompressed, where those members start and end, how
+    // many pages the copy has, and which of them are zero. Inodes are
+    // reused, and chains of the same program often start with the same
+    // pages, so the copy is only used if both hashes still match.
+    std::pair<uint64_t, uint64_t> prefix_hash, last_hash;
+    uint64_t last = 0;
+    uint64_t consumed = 0;
+    std::size_t num_pages = 0;
+    std::ifstream meta(filepath_meta);
+    std::string version;
+    bool valid = meta >> version && version == "v2" &&
+        meta >> std::hex >> prefix_hash.first >> prefix_hash.second >>
+            last_hash.first >> last_hash.second >> std::dec >> last >>
+            consumed >> num_pages;
+    if (valid) {
+        zero.assign(num_pages, false);
+        for (std::size_t id; meta >> id && id < num_pages; )
+            zero[id] = true;
+        struct stat st_raw;
+        valid = last <= consumed && consumed <= size &&
+            stat(filepath_raw.c_str(), &st_raw) == 0 &&
+            (uint64_t)st_raw.st_size >= num_pages * pageSize &&
+            hashFileRange(fd_pages, 0, std::min<uint64_t>(consumed,
+                                                          pageSize),
+                          pageSize) == prefix_hash &&
+            hashFileRange(fd_pages, last, consumed - last, pageSize) ==
+                last_hash &&
+            (consumed == size || startsGzipMember(fd_pages, consumed));
+    }
+
+    // A stale copy is replaced, not rewritten, since other runs may have
+    // it mapped.
+    std::string filepath_new;
+    int fd;
+    if (valid) {
+        fd = open(filepath_raw.c_str(), O_RDWR);
+    } else {
+        last = consumed = 0;
+        num_pages = 0;
+        zero.clear();
+        filepath_new = csprintf("%s.%d.tmp", filepath_raw, getpid());
+        fd = open(filepath_new.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    }
+    if (fd < 0)
+        fatal("Can't open page cache file '%s'\n", filepath_raw);
+
+    if (consumed < size) {
+        DPRINTF(Checkpoint, "Decompressing %s from byte %d into %s\n",
+                filepath_pages, consumed, filepath_raw);
+        // The page file is a series of gzip members, so reading can
+        // start where the last checkpoint's pages ended.
+        if (lseek(fd_pages, consumed, SEEK_SET) < 0)
+            fatal("Failed to seek in page file '%s'\n", filepath_pages);
+        gzFile file_pages = gzdopen(dup(fd_pages), "rb");
+        if (!file_pages)
+            fatal("Can't open physical memory checkpoint pages file '%s'\n",
+                  filepath_pages);
+        std::vector<uint8_t> page(pageSize);
+        while (true) {
+            int bytes = gzread(file_pages, page.data(), page.size());
+            // zlib passes anything that isn't gzip through as is.
+            if (gzdirect(file_pages))
+                fatal("Page file '%s' isn't gzip at byte %d\n",
+                      filepath_pages, consumed);
+            if (bytes == 0 && gzeof(file_pages))
+                break;
+            if (bytes != page.size())
+                fatal("Failed to read page\n");
+            if (pwrite(fd, page.data(), page.size(),
+                       num_pages * pageSize) != page.size())
+                fatal("Failed to write page cache file '%s'\n",
+                      filepath_raw);
+            zero.push_back(isZeroPage(page.data(), page.size()));
+            ++num_pages;
+        }
+        gzclose(file_pages);
+        last = consumed;
+        consumed = size;
+    }
+
+    if (!valid || last != consumed) {
+        prefix_hash = hashFileRange(fd_pages, 0,
+                                    std::min<uint64_t>(consumed, pageSize),
+                                    pageSize);
+        last_hash = hashFileRange(fd_pages, last, consumed - last, pageSize);
+        if (!filepath_new.empty() &&
+            rename(filepath_new.c_str(), filepath_raw.c_str()) < 0)
+            fatal("Failed to replace page cache file '%s'\n", filepath_raw);
+
+        const std::string filepath_tmp = filepath_meta + ".tmp";
+        std::ofstream out(filepath_tmp);
+        out << "v2" << std::hex << " " << prefix_hash.first << " "
+            << prefix_hash.second << " " << last_hash.first << " "
+            << last_hash.second << std::dec << " " << last << " "
+            << consumed << " " << num_pages << "\n";
+        for (std::size_t id = 0; id != num_pages; ++id)
+            if (zero[id])
+                out << id << "\n";
+        out.close();
+        if (!out || rename(filepath_tmp.c_str(), filepath_meta.c_str()) < 0)
+            fatal("Failed to write page cache file '%s'\n", filepath_meta);
+    }
+    close(fd_pages);
+
+    flock(fd_lock, LOCK_UN);
+    close(fd_lock);
+    return fd;
+}
+
+void
+PhysicalMemory::unserializeStoreCached(unsigned int store_id,
+                                       const std::string &filepath_pages,
+                                       const std::vector<PageId> &ids)
+{
+    std::vector<bool> zero;
+    const int fd = openPageCache(filepath_pages, zero);
+    for (const PageId id : ids)
+        if (id >= zero.size())
+            fatal("Page id %d out of range in '%s'\n", id, filepath_pages);
+
+    const BackingStoreEntry &store = backingStore[store_id];
+    const bool shared = store.shmFd >= 0;
+
+    // Each mapped run is a VMA; stay well clear of the limit, and read
+    // whatever doesn't fit.
+    std::size_t map_budget = 0;
+    if (!shared) {
+        std::ifstream max_map_count("/proc/sys/vm/max_map_count");
+        if (!(max_map_count >> map_budget))
+            map_budget = 65530;
+        map_budget /= 2;
+    }
+
+    // Runs of pages [begin, end) with consecutive ids.
+    std::vector<std::pair<std::size_t, std::size_t>> reads;
+    std::size_t mapped = 0;
+    std::size_t zeroed = 0;
+    for (std::size_t begin = 0, end; begin != ids.size(); begin = end) {
+        uint8_t *pmem = &store.pmem[begin * pageSize];
+        end = begin + 1;
+        if (zero[ids[begin]]) {
+            while (end != ids.size() && zero[ids[end]])
+                ++end;
+            const std::size_t size = (end - begin) * pageSize;
+            const int res = shared ?
+                fallocate(store.shmFd, FALLOC_FL_PUNCH_HOLE |
+                          FALLOC_FL_KEEP_SIZE,
+                          store.shmOffset + begin * pageSize, size) :
+                madvise(pmem, size, MADV_DONTNEED);
+            if (res < 0)
+                std::memset(pmem, 0, size);
+            zeroed += end - begin;
+            continue;
+        }
+
+        while (end != ids.size() && ids[end] == ids[end - 1] + 1 &&
+               !zero[ids[end]])
+            ++end;
+        if (mapped != map_budget) {
+            const int flags = MAP_PRIVATE | MAP_FIXED |
+                (mmapUsingNoReserve ? MAP_NORESERVE : 0);
+            if (mmap(pmem, (end - begin) * pageSize, PROT_READ | PROT_WRITE,
+                     flags, fd, (off_t)ids[begin] * pageSize) != MAP_FAILED) {
+                ++mapped;
+                continue;
+            }
+            warn("Failed to map checkpoint pages; reading them instead\n");
+            map_budget = mapped;
+        }
+        reads.emplace_back(begin, end);
+    }
+
+    // Read the rest in parallel.
+    const unsigned threads = pagelistThreads ? pagelistThreads :
+        std::max(std::thread::hardware_concurrency(), 1u);
+    const auto read_runs = [&] (unsigned thread) {
+        for (std::size_t r = thread; r < reads.size(); r += threads) {
+            const auto [begin, end] = reads[r];
+            uint8_t *pmem = &store.pmem[begin * pageSize];
+            const std::size_t size = (end - begin) * pageSize;
+            const off_t offset = (off_t)ids[begin] * pageSize;
+            for (std::size_t done = 0; done != size; ) {
+                const ssize_t bytes = pread(fd, pmem + done, size - done,
+                                            offset + done);
+                if (bytes <= 0)
+                    fatal("Failed to read page cache for '%s'\n",
+                          filepath_pages);
+                done += bytes;
+            }
+        }
+    };
+    std::vector<std::future<void>> readers;
+    for (unsigned thread = 0; thread != threads; ++thread)
+        readers.push_back(std::async(std::launch::async, read_runs, thread));
+    for (auto &reader : readers)
+        reader.get();
+
+    // Mappings keep the file open.
+    close(fd);
+
+    DPRINTF(Checkpoint, "Restored %d pages: %d runs mapped, %d runs read, "
+            "%d pages zero\n", ids.size(), mapped, reads.size(), zeroed);
+}
 
 } // namespace memory
 } // namespace gem5
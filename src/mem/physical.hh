@@ -39,15 +39,17 @@
 #define __MEM_PHYSICAL_HH__
 
 #include <cstdint>
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "base/addr_range.hh"
 #include "base/addr_range_map.hh"
+#include "base/sha256.hh"
 #include "base/stl_helpers/hash_helpers.hh"
 #include "mem/packet.hh"
 #include "sim/serialize.hh"
-#include "base/sha256.hh"
 
 namespace gem5
 {
@@ -166,11 +168,43 @@ class PhysicalMemory : public Serializable
     std::vector<BackingStoreEntry> backingStore;
 
     bool serializeUsingPagelist;
+    // Threads hashing and compressing pages; 0 means one per host core.
+    unsigned pagelistThreads;
+    // Where uncompressed page files are kept for lazy restores, if set.
+    const std::string pagelistCache;
+    // Whether pages written since the last checkpoint are tracked.
+    bool trackDirty;
     mutable std::string pagelistPath;
 
-    using PageHash = Sha256Hash;
+    using PageHash = std::pair<uint64_t, uint64_t>;
     using PageId = uint32_t;
-    mutable stl_helpers::unordered_map<PageHash, PageId> pages;
+    /**
+     * A page written to the page file. The witness is a copy of it in
+     * the backing store, valid if it was seen in the current pass; a hash
+     * match against it is confirmed by comparing the pages. A match in a
+     * later pass is confirmed by the page's SHA-256 digest instead, taken
+     * when it was written.
+     */
+    struct PageEntry
+    {
+        PageId id;
+        const uint8_t *witness;
+        uint64_t pass;
+        Sha256Hash digest;
+    };
+    mutable stl_helpers::unordered_map<PageHash, PageEntry> pages;
+    mutable PageId numPages = 0;
+    // All-zero pages are recognized without hashing.
+    mutable std::optional<PageId> zeroPage;
+    // Counts calls to serialize(), to tell which witnesses are current.
+    mutable uint64_t pagelistPass = 0;
+    /**
+     * For each backing store, the pages written since the last checkpoint
+     * and the page ids it was written with, if dirty pages are tracked.
+     * Clean pages keep their ids rather than being hashed again.
+     */
+    mutable std::vector<std::vector<bool>> dirtyPages;
+    mutable std::vector<std::vector<PageId>> lastPageIds;
 
     // Prevent copying
     PhysicalMemory(const PhysicalMemory&);
@@ -203,7 +237,10 @@ class PhysicalMemory : public Serializable
                    const std::string& shared_backstore,
                    bool auto_unlink_shared_backstore,
                    bool anonymous_shared_backstore,
-                   bool serialize_using_pagelist);
+                   bool serialize_using_pagelist,
+                   unsigned pagelist_threads,
+                   const std::string &pagelist_cache,
+                   bool pagelist_dirty_tracking);
 
     /**
      * Unmap all the backing store we have used.
@@ -257,6 +294,22 @@ class PhysicalMemory : public Serializable
     std::vector<BackingStoreEntry> getBackingStore() const
     { return backingStore; }
 
+    /**
+     * Whether the next checkpoint only hashes the pages written since the
+     * last one. Writes to this process' mappings of the backing store are
+     * found with soft-dirty bits; anything else that maps it (such as a
+     * Pin process) must report its writes with markDirty().
+     */
+    bool trackingDirtyPages() const { return trackDirty; }
+
+    /**
+     * Record that a range of the backing store was written.
+     *
+     * @param paddr Start of the range.
+     * @param size Size of the range.
+     */
+    void markDirty(Addr paddr, Addr size);
+
     /**
      * Perform an untimed memory access and update all the state
      * (e.g. locked addresses) and statistics accordingly. The packet
@@ -301,6 +354,13 @@ class PhysicalMemory : public Serializable
     void serializeStorePaged(CheckpointOut &cp, unsigned int store_id,
                              AddrRange range, uint8_t *pmem) const;
 
+    /**
+     * Add the soft-dirty pages of this process' mappings of the backing
+     * stores to dirtyPages, along with the pages of shared stores that
+     * aren't present (see soft_dirty::forEachDirtyFilePage()).
+     */
+    void collectDirtyPages() const;
+
     /**
      * Unserialize the memories in the system. As with the
      * serialization, this action is independent of how the address
@@ -319,6 +379,30 @@ class PhysicalMemory : public Serializable
                                const std::string &filename_pages,
                                const std::string &filename_ids);
 
+    /**
+     * Open the uncompressed copy of a page file in pagelistCache, first
+     * decompressing any pages it doesn't have yet. Copies are named after
+     * the page file's inode, so the checkpoints sharing a page file share
+     * a copy, and it is extended as checkpoints are appended.
+     *
+     * @param filepath_pages The page file.
+     * @param zero Set to whether each page is all zeros.
+     * @return A descriptor for the copy.
+     */
+    int openPageCache(const std::string &filepath_pages,
+                      std::vector<bool> &zero) const;
+
+    /**
+     * Restore a backing store from the uncompressed copy of its page file.
+     * A private store maps runs of pages straight from the copy, so they
+     * are read on first touch and the page cache is shared between runs;
+     * a shared store (see sharedBackstore) is mapped by other processes
+     * too, so it is filled in with reads. All-zero pages are just cleared.
+     */
+    void unserializeStoreCached(unsigned int store_id,
+                                const std::string &filepath_pages,
+                                const std::vector<PageId> &ids);
+
 };
 
 } // namespace memory
@@ -121,6 +121,25 @@ class System(SimObject):
         True,
         "Use pagelists when checkpointing",
     )
+    pagelist_threads = Param.Unsigned(
+        0,
+        "Threads hashing and compressing pages when checkpointing with "
+        "pagelists (0: one per host core)",
+    )
+    pagelist_cache = Param.String(
+        "",
+        "Directory for uncompressed copies of checkpoint page files, shared "
+        "between runs. If set, paged checkpoints are restored from them "
+        "lazily instead of being decompressed into memory.",
+    )
+    pagelist_dirty_tracking = Param.Bool(
+        False,
+        "When checkpointing with pagelists, only hash the pages written "
+        "since the last checkpoint, found with soft-dirty bits. The kernel "
+        "loses the bits of shared memory pages it reclaims, so pages that "
+        "aren't resident are assumed written, and under memory pressure "
+        "more pages are hashed. Needs CONFIG_MEM_SOFT_DIRTY",
+    )
 
     cache_line_size = Param.Unsigned(64, "Cache line size in bytes")
 
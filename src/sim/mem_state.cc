@@ -28,7 +28,10 @@
 
 #include "sim/mem_state.hh"
 
+#include <algorithm>
 #include <cassert>
+#include <iterator>
+#include <vector>
 
 #include "arch/generic/mmu.hh"
 #include "debug/Vma.hh"
@@ -67,7 +70,7 @@ MemState::operator=(const MemState &in)
     _stackMin = in._stackMin;
     _nextThreadStackBase = in._nextThreadStackBase;
     _mmapEnd = in._mmapEnd;
-    _vmaList = in._vmaList; /* This assignment does a deep copy. */
+    _vmas = in._vmas; /* This assignment does a deep copy. */
 
     return *this;
 }
@@ -78,15 +81,68 @@ MemState::resetOwner(Process *owner)
     _ownerProcess = owner;
 }
 
+void
+MemState::subscribe(Listener *listener)
+{
+    _listeners.push_back(listener);
+}
+
+void
+MemState::unsubscribe(Listener *listener)
+{
+    auto it = std::find(_listeners.begin(), _listeners.end(), listener);
+    panic_if(it == _listeners.end(), "MemState listener isn't subscribed\n");
+    _listeners.erase(it);
+}
+
+void
+MemState::protectRegion(Addr start_addr, Addr length, int prot)
+{
+    DPRINTF(Vma, "memstate: protecting [0x%x - 0x%x] with %#x\n",
+            start_addr, start_addr + length, prot);
+    for (Listener *listener : _listeners)
+        listener->protectionChanged(start_addr, length, prot);
+}
+
+void
+MemState::insertVMA(VMA &&vma)
+{
+    const Addr start = vma.start();
+    [[maybe_unused]] auto [vma_it, inserted] =
+        _vmas.emplace(start, std::move(vma));
+    panic_if(!inserted, "VMA at %#x already exists\n", start);
+}
+
+MemState::VMAMap::iterator
+MemState::findVMA(Addr vaddr)
+{
+    auto vma_it = firstVMAEndingAfter(vaddr);
+    if (vma_it != _vmas.end() && vma_it->second.contains(vaddr))
+        return vma_it;
+    return _vmas.end();
+}
+
+MemState::VMAMap::iterator
+MemState::firstVMAEndingAfter(Addr start_addr)
+{
+    // The last VMA starting at or before start_addr is the only one that
+    // can contain it; otherwise, it's the next one.
+    auto vma_it = _vmas.upper_bound(start_addr);
+    if (vma_it != _vmas.begin()) {
+        auto prev = std::prev(vma_it);
+        if (prev->second.end() > start_addr)
+            return prev;
+    }
+    return vma_it;
+}
+
 bool
 MemState::isUnmapped(Addr start_addr, Addr length)
 {
     Addr end_addr = start_addr + length;
-    const AddrRange range(start_addr, end_addr);
-    for (const auto &vma : _vmaList) {
-        if (vma.intersects(range))
-            return false;
-    }
+    auto vma_it = firstVMAEndingAfter(start_addr);
+    if (vma_it != _vmas.end() && vma_it->second.start() < end_addr)
+        return false;
 
     /**
      * In case someone skips the VMA interface and just directly maps memory
@@ -182,10 +238,13 @@ MemState::mapRegion(Addr start_addr, Addr length,
     assert(isUnmapped(start_addr, length));
 
     /**
-     * Record the region in our list structure.
+     * Record the region in our VMA index.
      */
-    _vmaList.emplace_back(AddrRange(start_addr, start_addr + length),
-                          _pageBytes, region_name, sim_fd, offset);
+    insertVMA(VMA(AddrRange(start_addr, start_addr + length), _pageBytes,
+                  region_name, sim_fd, offset));
+
+    for (Listener *listener : _listeners)
+        listener->mapped(start_addr, length);
 }
 
 void
@@ -194,68 +253,69 @@ MemState::unmapRegion(Addr start_addr, Addr length)
     Addr end_addr = start_addr + length;
     const AddrRange range(start_addr, end_addr);
 
-    // HACK: Pin: mark unmapped pages.
-    for (Addr addr = start_addr; addr < end_addr; addr += 0x1000)
-        unmapped.push_back(addr);
+    for (Listener *listener : _listeners)
+        listener->unmapped(start_addr, length);
 
-    auto vma = std::begin(_vmaList);
-    while (vma != std::end(_vmaList)) {
-        if (vma->isStrictSuperset(range)) {
+    auto vma = firstVMAEndingAfter(start_addr);
+    while (vma != _vmas.end() && vma->second.start() < end_addr) {
+        VMA &area = vma->second;
+        if (area.isStrictSuperset(range)) {
             DPRINTF(Vma, "memstate: split vma [0x%x - 0x%x] into "
                     "[0x%x - 0x%x] and [0x%x - 0x%x]\n",
-                    vma->start(), vma->end(),
-                    vma->start(), start_addr,
-                    end_addr, vma->end());
+                    area.start(), area.end(),
+                    area.start(), start_addr,
+                    end_addr, area.end());
             /**
              * Need to split into two smaller regions.
              * Create a clone of the old VMA and slice it to the right.
              */
-            _vmaList.push_back(*vma);
-            _vmaList.back().sliceRegionRight(start_addr);
+            VMA right = area;
+            right.sliceRegionLeft(end_addr);
 
             /**
              * Slice old VMA to encapsulate the left region.
              */
-            vma->sliceRegionLeft(end_addr);
+            area.sliceRegionRight(start_addr);
+            insertVMA(std::move(right));
 
             /**
              * Region cannot be in any more VMA, because it is completely
              * contained in this one!
              */
             break;
-        } else if (vma->isSubset(range)) {
+        } else if (area.isSubset(range)) {
             DPRINTF(Vma, "memstate: destroying vma [0x%x - 0x%x]\n",
-                    vma->start(), vma->end());
+                    area.start(), area.end());
             /**
              * Need to nuke the existing VMA.
              */
-            vma = _vmaList.erase(vma);
+            vma = _vmas.erase(vma);
 
             continue;
 
-        } else if (vma->intersects(range)) {
+        } else if (area.start() < start_addr) {
+            DPRINTF(Vma, "memstate: resizing vma [0x%x - 0x%x] "
+                    "into [0x%x - 0x%x]\n",
+                    area.start(), area.end(),
+                    area.start(), start_addr);
             /**
-             * Trim up the existing VMA.
+             * Overlaps from the right.
              */
-            if (vma->start() < start_addr) {
-                DPRINTF(Vma, "memstate: resizing vma [0x%x - 0x%x] "
-                        "into [0x%x - 0x%x]\n",
-                        vma->start(), vma->end(),
-                        vma->start(), start_addr);
-                /**
-                 * Overlaps from the right.
-                 */
-                vma->sliceRegionRight(start_addr);
-            } else {
-                DPRINTF(Vma, "memstate: resizing vma [0x%x - 0x%x] "
-                        "into [0x%x - 0x%x]\n",
-                        vma->start(), vma->end(),
-                        end_addr, vma->end());
-                /**
-                 * Overlaps from the left.
-                 */
-                vma->sliceRegionLeft(end_addr);
-            }
+            area.sliceRegionRight(start_addr);
+        } else {
+            DPRINTF(Vma, "memstate: resizing vma [0x%x - 0x%x] "
+                    "into [0x%x - 0x%x]\n",
+                    area.start(), area.end(),
+                    end_addr, area.end());
+            /**
+             * Overlaps from the left, so it moves up to end_addr, past
+             * the range; it's the last one.
+             */
+            auto node = _vmas.extract(vma);
+            node.mapped().sliceRegionLeft(end_addr);
+            node.key() = end_addr;
+            _vmas.insert(std::move(node));
+            break;
         }
 
         vma++;
@@ -290,75 +350,71 @@ MemState::remapRegion(Addr start_addr, Addr new_start_addr, Addr length)
     Addr end_addr = start_addr + length;
     const AddrRange range(start_addr, end_addr);
 
-    // HACK: Pin: mark all remapped pages as unmapped.
-    for (Addr addr = start_addr; addr < end_addr; addr += 0x1000)
-        unmapped.push_back(addr);
+    for (Listener *listener : _listeners)
+        listener->remapped(start_addr, new_start_addr, length);
+
+    /**
+     * Take out the VMAs in the range, since their pieces in it move, and
+     * put the pieces back in once they have all been cut.
+     */
+    std::vector<VMA> areas;
+    auto vma = firstVMAEndingAfter(start_addr);
+    while (vma != _vmas.end() && vma->second.start() < end_addr) {
+        areas.push_back(std::move(vma->second));
+        vma = _vmas.erase(vma);
+    }
 
-    auto vma = std::begin(_vmaList);
-    while (vma != std::end(_vmaList)) {
-        if (vma->isStrictSuperset(range)) {
+    for (VMA &area : areas) {
+        if (area.isStrictSuperset(range)) {
             /**
              * Create clone of the old VMA and slice right.
              */
-            _vmaList.push_back(*vma);
-            _vmaList.back().sliceRegionRight(start_addr);
+            VMA left = area;
+            left.sliceRegionRight(start_addr);
 
             /**
              * Create clone of the old VMA and slice it left.
              */
-            _vmaList.push_back(*vma);
-            _vmaList.back().sliceRegionLeft(end_addr);
+            VMA right = area;
+            right.sliceRegionLeft(end_addr);
 
             /**
              * Slice the old VMA left and right to adjust the file backing,
              * then overwrite the virtual addresses!
              */
-            vma->sliceRegionLeft(start_addr);
-            vma->sliceRegionRight(end_addr);
-            vma->remap(new_start_addr);
+            area.sliceRegionLeft(start_addr);
+            area.sliceRegionRight(end_addr);
+            area.remap(new_start_addr);
 
+            insertVMA(std::move(left));
+            insertVMA(std::move(right));
+        } else if (area.isSubset(range)) {
             /**
-             * The region cannot be in any more VMAs, because it is
-             * completely contained in this one!
+             * Just go ahead and remap it!
              */
-            break;
-        } else if (vma->isSubset(range)) {
+            area.remap(area.start() - start_addr + new_start_addr);
+        } else if (area.start() < start_addr) {
             /**
-             * Just go ahead and remap it!
+             * Overlaps from the right: keep a clone of the old region
+             * to the left and remap the old region.
              */
-            vma->remap(vma->start() - start_addr + new_start_addr);
-        } else if (vma->intersects(range)) {
+            VMA left = area;
+            left.sliceRegionRight(start_addr);
+            area.sliceRegionLeft(start_addr);
+            area.remap(new_start_addr);
+            insertVMA(std::move(left));
+        } else {
             /**
-             * Create a clone of the old VMA.
+             * Overlaps from the left: keep a clone of the old region
+             * to the right and remap the old region.
              */
-            _vmaList.push_back(*vma);
-
-            if (vma->start() < start_addr) {
-                /**
-                 * Overlaps from the right.
-                 */
-                _vmaList.back().sliceRegionRight(start_addr);
-
-                /**
-                 * Remap the old region.
-                 */
-                vma->sliceRegionLeft(start_addr);
-                vma->remap(new_start_addr);
-            } else {
-                /**
-                 * Overlaps from the left.
-                 */
-                _vmaList.back().sliceRegionLeft(end_addr);
-
-                /**
-                 * Remap the old region.
-                 */
-                vma->sliceRegionRight(end_addr);
-                vma->remap(new_start_addr + vma->start() - start_addr);
-            }
+            VMA right = area;
+            right.sliceRegionLeft(end_addr);
+            area.sliceRegionRight(end_addr);
+            area.remap(new_start_addr + area.start() - start_addr);
+            insertVMA(std::move(right));
         }
-
-        vma++;
+        insertVMA(std::move(area));
     }
 
     /**
@@ -398,31 +454,31 @@ MemState::fixupFault(Addr vaddr)
      * Check if we are accessing a mapped virtual address. If so then we
      * just haven't allocated it a physical page yet and can do so here.
      */
-    for (const auto &vma : _vmaList) {
-        if (vma.contains(vaddr)) {
-            Addr vpage_start = roundDown(vaddr, _pageBytes);
-            _ownerProcess->allocateMem(vpage_start, _pageBytes);
+    auto vma_it = findVMA(vaddr);
+    if (vma_it != _vmas.end()) {
+        const VMA &vma = vma_it->second;
+        Addr vpage_start = roundDown(vaddr, _pageBytes);
+        _ownerProcess->allocateMem(vpage_start, _pageBytes);
 
+        /**
+         * We are assuming that fresh pages are zero-filled, so there is
+         * no need to zero them out when there is no backing file.
+         * This assumption will not hold true if/when physical pages
+         * are recycled.
+         */
+        if (vma.hasHostBuf()) {
             /**
-             * We are assuming that fresh pages are zero-filled, so there is
-             * no need to zero them out when there is no backing file.
-             * This assumption will not hold true if/when physical pages
-             * are recycled.
+             * Write the memory for the host buffer contents for all
+             * ThreadContexts associated with this process.
              */
-            if (vma.hasHostBuf()) {
-                /**
-                 * Write the memory for the host buffer contents for all
-                 * ThreadContexts associated with this process.
-                 */
-                for (auto &cid : _ownerProcess->contextIds) {
-                    auto *tc = _ownerProcess->system->threads[cid];
-                    SETranslatingPortProxy
-                        virt_mem(tc, SETranslatingPortProxy::Always);
-                    vma.fillMemPages(vpage_start, _pageBytes, virt_mem);
-                }
+            for (auto &cid : _ownerProcess->contextIds) {
+                auto *tc = _ownerProcess->system->threads[cid];
+                SETranslatingPortProxy
+                    virt_mem(tc, SETranslatingPortProxy::Always);
+                vma.fillMemPages(vpage_start, _pageBytes, virt_mem);
             }
-            return true;
         }
+        return true;
     }
 
     /**
@@ -486,7 +542,7 @@ MemState::printVmaList()
 {
     std::stringstream file_content;
 
-    for (auto vma : _vmaList) {
+    for (const auto &[start, vma] : _vmas) {
         std::stringstream line;
         line << std::hex << vma.start() << "-";
         line << std::hex << vma.end() << " ";
@@ -32,7 +32,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 
-#include <list>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -67,6 +67,33 @@ class System;
 class MemState : public Serializable
 {
   public:
+    /**
+     * Something that keeps its own view of the address space, such as a
+     * CPU that mirrors the mappings into another process, and wants to
+     * hear about changes to it. Each change is reported once, as a
+     * page-aligned range, however many pages it covers.
+     */
+    class Listener
+    {
+      public:
+        virtual ~Listener() = default;
+
+        /** A region was created (mmap, brk). */
+        virtual void mapped(Addr start, Addr length) {}
+        /** A range was unmapped (munmap, brk, or mremap's target). */
+        virtual void unmapped(Addr start, Addr length) {}
+        /** A range moved to new_start (mremap). */
+        virtual void
+        remapped(Addr start, Addr new_start, Addr length)
+        {
+        }
+        /** A range's protection changed to prot (mprotect). */
+        virtual void
+        protectionChanged(Addr start, Addr length, int prot)
+        {
+        }
+    };
+
     MemState(Process *owner, Addr brk_point, Addr stack_base,
              Addr max_stack_size, Addr next_thread_stack_base,
              Addr mmap_end);
@@ -78,6 +105,13 @@ class MemState : public Serializable
      */
     void resetOwner(Process *owner);
 
+    /**
+     * Start or stop telling a listener about changes to the address
+     * space. Listeners aren't copied along with the MemState.
+     */
+    void subscribe(Listener *listener);
+    void unsubscribe(Listener *listener);
+
     /**
      * Get/set base addresses and sizes for the stack and data segments of
      * the process' memory.
@@ -153,6 +187,16 @@ class MemState : public Serializable
      */
     void remapRegion(Addr start_addr, Addr new_start_addr, Addr length);
 
+    /**
+     * Record a change of protection for a range. Protection isn't
+     * enforced in SE mode, so this only tells the listeners.
+     *
+     * @param start_addr Start address of the range.
+     * @param length Length of the range.
+     * @param prot New protection (PROT_* flags).
+     */
+    void protectRegion(Addr start_addr, Addr length, int prot);
+
     /**
      * Change the end of a process' program break. This represents the end
      * of the heap segment of a process.
@@ -197,9 +241,9 @@ class MemState : public Serializable
         paramOut(cp, "mmapEnd", _mmapEnd);
 
         ScopedCheckpointSection sec(cp, "vmalist");
-        paramOut(cp, "size", _vmaList.size());
+        paramOut(cp, "size", _vmas.size());
         int count = 0;
-        for (auto vma : _vmaList) {
+        for (const auto &[start, vma] : _vmas) {
             ScopedCheckpointSection sec(cp, csprintf("Vma%d", count++));
             paramOut(cp, "name", vma.getName());
             if (vma.hasHostBuf()) {
@@ -240,8 +284,8 @@ class MemState : public Serializable
             }
             paramIn(cp, "addrRangeStart", start);
             paramIn(cp, "addrRangeEnd", end);
-            _vmaList.emplace_back(AddrRange(start, end), _pageBytes, name,
-                                  host_fd, offset);
+            insertVMA(VMA(AddrRange(start, end), _pageBytes, name,
+                          host_fd, offset));
             close(host_fd);
         }
     }
@@ -252,6 +296,24 @@ class MemState : public Serializable
     std::string printVmaList();
 
   private:
+    using VMAMap = std::map<Addr, VMA>;
+
+    /**
+     * Add a VMA, which must not overlap any other.
+     */
+    void insertVMA(VMA &&vma);
+
+    /**
+     * Find the VMA containing vaddr, or _vmas.end() if there isn't one.
+     */
+    VMAMap::iterator findVMA(Addr vaddr);
+
+    /**
+     * Find the first VMA that ends after start_addr. The VMAs that
+     * intersect a range starting at start_addr follow on from it.
+     */
+    VMAMap::iterator firstVMAEndingAfter(Addr start_addr);
+
     /**
      * @param
      */
@@ -278,39 +340,27 @@ class MemState : public Serializable
     Addr _mmapEnd;
 
     /**
-     * The _vmaList member is a list of virtual memory areas in the target
+     * The _vmas member holds the virtual memory areas in the target
      * application space that have been allocated by the target. In most
      * operating systems, lazy allocation is used and these structures (or
      * equivalent ones) are used to track the valid address ranges.
      *
-     * This could use a more efficient data structure like an interval
-     * tree, but it is unclear whether the vmas will be modified often enough
-     * for the improvement in lookup time to matter. Unmapping VMAs currently
-     * modifies the list while iterating so the STL container must either
-     * support this or the unmapping method must be changed.
+     * VMAs never overlap, so they are indexed by start address: finding the
+     * one containing an address, or those intersecting a range, takes a
+     * logarithmic search. Processes that make many mappings (e.g., JITs
+     * and allocators that mmap each arena) would otherwise make every
+     * fault and mmap walk all of them.
      */
-    std::list<VMA> _vmaList;
+    VMAMap _vmas;
 
-  public:
-    // HACK: PinCPU:
-    // We need to know when pages change.
-    // So we need to track which pages have been unmapped.
-    // Don't need to track which pages have been mapped,
-    // since we lazily handle that with segfaults in Pin.
-    std::vector<Addr> unmapped;
+    std::vector<Listener *> _listeners;
 
+  public:
     VMA *
     getVMA(Addr vaddr)
     {
-        auto vma_it = std::find_if(_vmaList.begin(), _vmaList.end(),
-                                   [vaddr] (const VMA& vma) -> bool {
-                                       return vma.contains(vaddr);
-                                   });
-        if (vma_it == _vmaList.end()) {
-            return nullptr;
-        } else {
-            return &*vma_it;
-        }
+        auto vma_it = findVMA(vaddr);
+        return vma_it == _vmas.end() ? nullptr : &vma_it->second;
     }
 };
 
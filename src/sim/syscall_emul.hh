@@ -3155,6 +3155,25 @@ munmapFunc(SyscallDesc *desc, ThreadContext *tc, VPtr<> start,
     return 0;
 }
 
+/// Target mprotect() handler. Protection isn't enforced, but the change is
+/// passed on to anything listening to the address space.
+template <typename OS>
+SyscallReturn
+mprotectFunc(SyscallDesc *desc, ThreadContext *tc, VPtr<> start,
+             typename OS::size_t length, int prot)
+{
+    auto p = tc->getProcessPtr();
+
+    if (p->pTable->pageOffset(start))
+        return -EINVAL;
+
+    length = roundUp(length, p->pTable->pageSize());
+
+    p->memState->protectRegion(start, length, prot);
+
+    return 0;
+}
+
 // Target fallocate() handler.
 template <typename OS>
 SyscallReturn
@@ -174,7 +174,9 @@ System::System(const Params &p)
       workload(p.workload),
       physmem(name() + ".physmem", p.memories, p.mmap_using_noreserve,
               p.shared_backstore, p.auto_unlink_shared_backstore,
-              p.anonymous_shared_backstore, p.use_pagelist),
+              p.anonymous_shared_backstore, p.use_pagelist,
+              p.pagelist_threads, p.pagelist_cache,
+              p.pagelist_dirty_tracking),
       ShadowRomRanges(p.shadow_rom_ranges.begin(),
                       p.shadow_rom_ranges.end()),
       memoryMode(p.mem_mode),
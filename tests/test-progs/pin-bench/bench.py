@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Compare Pin CPU instruction counting overheads on small kernels.
+
+Runs each kernel of src/pin-bench (build it with make -C src) natively,
+then under configs/pin.py with no instruction counting, with the
+instcount plugin's per-block callbacks, and with its inlined register
+counting, and reports wall-clock times and slowdowns over native. The vma
+kernel mostly measures the simulator's handling of mmap-heavy programs.
+
+    ./bench.py --gem5 build/X86/gem5.opt [--iters 4] [--kernels mcf,xz]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+here = os.path.dirname(os.path.abspath(__file__))
+gem5_root = os.path.dirname(os.path.dirname(os.path.dirname(here)))
+
+modes = {
+    "pin": [],
+    "pin-count": ["--instcount"],
+    "pin-count-inline": ["--instcount", "--pin-inline-instcount"],
+}
+
+
+def timed(cmd, **kwargs) -> float:
+    start = time.monotonic()
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL, **kwargs)
+    return time.monotonic() - start
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--gem5", required=True, help="gem5 binary")
+    parser.add_argument("--config", default=os.path.join(gem5_root, "configs", "pin.py"))
+    parser.add_argument("--bench", default=os.path.join(here, "src", "pin-bench"))
+    parser.add_argument("--kernels", default="mcf,lbm,gcc,xz,vma")
+    parser.add_argument("--iters", type=int, default=1, help="Kernel iterations")
+    parser.add_argument("--repeat", type=int, default=3, help="Runs per measurement (the fastest is kept)")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.bench):
+        sys.exit(f"{args.bench}: not found (run make -C {os.path.dirname(args.bench)})")
+
+    print(f"{'kernel':8} {'native':>9}" +
+          "".join(f" {mode:>22}" for mode in modes))
+    for kernel in args.kernels.split(","):
+        workload = [args.bench, kernel, str(args.iters)]
+        native = min(timed(workload) for _ in range(args.repeat))
+        row = f"{kernel:8} {native:8.2f}s"
+        for mode, options in modes.items():
+            with tempfile.TemporaryDirectory() as outdir:
+                cmd = [args.gem5, "-re", "-d", outdir, args.config, *options,
+                       "--stdout", os.path.join(outdir, "stdout.txt"),
+                       "--stderr", os.path.join(outdir, "stderr.txt"),
+                       *workload]
+                t = min(timed(cmd) for _ in range(args.repeat))
+            row += f" {t:8.2f}s ({t / native:8.1f}x)"
+        print(row, flush=True)
+
+
+if __name__ == "__main__":
+    main()
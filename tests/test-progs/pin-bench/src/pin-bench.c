@@ -0,0 +1,236 @@
+/*
+ * Small kernels in the style of a few SPEC CPU benchmarks, for measuring
+ * Pin CPU overheads (see ../bench.py):
+ *
+ *   mcf:  pointer chasing through a randomly linked list
+ *   lbm:  a 3D seven-point stencil over doubles
+ *   gcc:  a bytecode interpreter (many small, unpredictable blocks)
+ *   xz:   hash-chain match finding over a byte stream
+ *   vma:  tens of thousands of small mmaps, touched, remapped and unmapped
+ *         (stresses the simulator's VMA bookkeeping rather than the CPU)
+ *
+ * Usage: pin-bench <kernel> [iterations]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static uint64_t rng = 88172645463325252ull;
+
+static uint64_t
+next_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static uint64_t
+mcf(long iters)
+{
+    enum { N = 1 << 20 };
+    uint32_t *next = malloc(N * sizeof *next);
+    uint32_t *perm = malloc(N * sizeof *perm);
+    for (uint32_t i = 0; i < N; ++i)
+        perm[i] = i;
+    for (uint32_t i = N - 1; i > 0; --i) {
+        const uint32_t j = next_rand() % (i + 1);
+        const uint32_t t = perm[i];
+        perm[i] = perm[j];
+        perm[j] = t;
+    }
+    for (uint32_t i = 0; i < N; ++i)
+        next[perm[i]] = perm[(i + 1) % N];
+
+    uint64_t sum = 0;
+    uint32_t p = perm[0];
+    for (long i = 0; i < iters * N; ++i) {
+        p = next[p];
+        sum += p;
+    }
+    free(next);
+    free(perm);
+    return sum;
+}
+
+static uint64_t
+lbm(long iters)
+{
+    enum { D = 64 };
+    double *a = malloc(D * D * D * sizeof *a);
+    double *b = malloc(D * D * D * sizeof *b);
+    for (int i = 0; i < D * D * D; ++i)
+        a[i] = (double) (next_rand() % 1000) / 1000;
+
+#define AT(x, y, z) ((x) * D * D + (y) * D + (z))
+    for (long it = 0; it < iters * 16; ++it) {
+        for (int x = 1; x < D - 1; ++x)
+            for (int y = 1; y < D - 1; ++y)
+                for (int z = 1; z < D - 1; ++z)
+                    b[AT(x, y, z)] = 0.4 * a[AT(x, y, z)] +
+                        0.1 * (a[AT(x - 1, y, z)] + a[AT(x + 1, y, z)] +
+                               a[AT(x, y - 1, z)] + a[AT(x, y + 1, z)] +
+                               a[AT(x, y, z - 1)] + a[AT(x, y, z + 1)]);
+        double *t = a;
+        a = b;
+        b = t;
+    }
+#undef AT
+
+    uint64_t sum = 0;
+    for (int i = 0; i < D * D * D; ++i)
+        sum += (uint64_t) (a[i] * 1000);
+    free(a);
+    free(b);
+    return sum;
+}
+
+static uint64_t
+gcc(long iters)
+{
+    enum { N = 4096, OPS = 8 };
+    uint8_t *code = malloc(N);
+    for (int i = 0; i < N; ++i)
+        code[i] = next_rand() % OPS;
+
+    uint64_t acc = 1, x = 3;
+    for (long it = 0; it < iters * 256; ++it) {
+        for (int pc = 0; pc < N; ++pc) {
+            switch (code[pc]) {
+              case 0: acc += x; break;
+              case 1: acc ^= x << 3; break;
+              case 2: x = acc >> 5; break;
+              case 3: acc *= 3; break;
+              case 4: if (acc & 1) ++x; break;
+              case 5: x ^= pc; break;
+              case 6: acc -= x; break;
+              default: acc = (acc << 1) | (acc >> 63); break;
+            }
+        }
+    }
+    free(code);
+    return acc + x;
+}
+
+static uint64_t
+xz(long iters)
+{
+    enum { N = 1 << 20, HASH = 1 << 16, WINDOW = 1 << 15, CHAIN = 16 };
+    uint8_t *data = malloc(N);
+    int32_t *head = malloc(HASH * sizeof *head);
+    int32_t *prev = malloc(N * sizeof *prev);
+    // Compressible: random runs copied from earlier in the stream.
+    for (int i = 0; i < N; ) {
+        const int len = 4 + next_rand() % 60;
+        const int from = i > WINDOW ? i - 1 - next_rand() % WINDOW : -1;
+        for (int j = 0; j < len && i < N; ++j, ++i)
+            data[i] = from >= 0 ? data[from + j] : next_rand();
+    }
+
+    uint64_t total = 0;
+    for (long it = 0; it < iters; ++it) {
+        memset(head, -1, HASH * sizeof *head);
+        for (int i = 0; i + 3 < N; ++i) {
+            const uint32_t h = ((data[i] << 8) ^ (data[i + 1] << 4) ^
+                                data[i + 2]) & (HASH - 1);
+            int best = 0;
+            int cand = head[h];
+            for (int c = 0; c < CHAIN && cand >= 0 && i - cand < WINDOW; ++c) {
+                int len = 0;
+                while (i + len < N && len < 258 && data[cand + len] == data[i + len])
+                    ++len;
+                if (len > best)
+                    best = len;
+                cand = prev[cand];
+            }
+            prev[i] = head[h];
+            head[h] = i;
+            total += best;
+        }
+    }
+    free(data);
+    free(head);
+    free(prev);
+    return total;
+}
+
+static uint64_t
+vma(long iters)
+{
+    enum { N = 20000, PAGE = 4096 };
+    uint8_t **maps = malloc(N * sizeof *maps);
+    uint64_t sum = 0;
+    for (long it = 0; it < iters; ++it) {
+        // Alternate protections so that neighbouring mappings stay
+        // separate areas.
+        for (int i = 0; i < N; ++i) {
+            const int prot = i % 2 ? PROT_READ | PROT_WRITE :
+                PROT_READ | PROT_WRITE | PROT_EXEC;
+            maps[i] = mmap(NULL, 2 * PAGE, prot,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (maps[i] == MAP_FAILED) {
+                perror("mmap");
+                exit(1);
+            }
+        }
+        // Fault each one in, in random order.
+        for (int i = 0; i < N; ++i) {
+            const int j = next_rand() % N;
+            maps[j][next_rand() % (2 * PAGE)] += i;
+        }
+        // Punch holes, move some, and read everything back.
+        for (int i = 0; i < N; i += 3)
+            munmap(maps[i] + PAGE, PAGE);
+        for (int i = 1; i < N; i += 7) {
+            if (i % 3 == 0)
+                continue;
+            uint8_t *moved = mremap(maps[i], 2 * PAGE, 4 * PAGE,
+                                    MREMAP_MAYMOVE);
+            if (moved == MAP_FAILED) {
+                perror("mremap");
+                exit(1);
+            }
+            maps[i] = moved;
+        }
+        for (int i = 0; i < N; ++i)
+            sum += maps[i][0];
+        for (int i = 0; i < N; ++i)
+            munmap(maps[i], i % 7 == 1 && i % 3 ? 4 * PAGE : 2 * PAGE);
+    }
+    free(maps);
+    return sum;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s mcf|lbm|gcc|xz|vma [iterations]\n", argv[0]);
+        return 1;
+    }
+    const long iters = argc > 2 ? atol(argv[2]) : 1;
+
+    uint64_t result;
+    if (!strcmp(argv[1], "mcf"))
+        result = mcf(iters);
+    else if (!strcmp(argv[1], "lbm"))
+        result = lbm(iters);
+    else if (!strcmp(argv[1], "gcc"))
+        result = gcc(iters);
+    else if (!strcmp(argv[1], "xz"))
+        result = xz(iters);
+    else if (!strcmp(argv[1], "vma"))
+        result = vma(iters);
+    else {
+        fprintf(stderr, "%s: unknown kernel: %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    printf("%s %lu\n", argv[1], (unsigned long) result);
+    return 0;
+}
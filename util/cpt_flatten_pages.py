@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Flatten paged memory checkpoints out of their chain.
+
+Successive paged checkpoints of a run share one page file: each is a
+hardlink to the last one's, with the new pages appended (see
+PhysicalMemory::serializeStorePaged). Any one checkpoint therefore carries
+the pages of every checkpoint before it, and deleting the others frees
+nothing. This rewrites each given checkpoint's page and id files to hold
+only the pages it uses, in a file of its own.
+
+    python3 util/cpt_flatten_pages.py m5out/cpt.*
+"""
+
+import argparse
+import array
+import gzip
+import os
+import sys
+from configparser import ConfigParser
+
+
+def flatten_store(cpt_dir: str, filename_pages: str, filename_ids: str,
+                  range_size: int) -> tuple:
+    path_pages = os.path.join(cpt_dir, filename_pages)
+    path_ids = os.path.join(cpt_dir, filename_ids)
+
+    ids = array.array("I")
+    with open(path_ids, "rb") as f:
+        ids.frombytes(f.read())
+    if sys.byteorder != "little":
+        ids.byteswap()
+    page_size = range_size // len(ids)
+
+    # Keep the pages that are used, in their order in the page file, so
+    # that the file can be streamed.
+    used = set(ids)
+    renumber = {}
+    tmp_pages = path_pages + ".flat"
+    with gzip.open(path_pages, "rb") as src, gzip.open(tmp_pages, "wb") as dst:
+        old_id = 0
+        while True:
+            page = src.read(page_size)
+            if not page:
+                break
+            if len(page) != page_size:
+                raise ValueError(f"{path_pages}: truncated page {old_id}")
+            if old_id in used:
+                renumber[old_id] = len(renumber)
+                dst.write(page)
+            old_id += 1
+    missing = used - renumber.keys()
+    if missing:
+        os.unlink(tmp_pages)
+        raise ValueError(f"{path_ids}: {len(missing)} ids not in {path_pages}")
+
+    flat_ids = array.array("I", (renumber[id] for id in ids))
+    if sys.byteorder != "little":
+        flat_ids.byteswap()
+    tmp_ids = path_ids + ".flat"
+    with open(tmp_ids, "wb") as f:
+        flat_ids.tofile(f)
+
+    # Renaming replaces the hardlink, leaving the other checkpoints alone.
+    os.replace(tmp_pages, path_pages)
+    os.replace(tmp_ids, path_ids)
+    return old_id, len(renumber)
+
+
+def flatten(cpt_dir: str) -> None:
+    cpt = ConfigParser()
+    cpt.optionxform = str
+    cpt.read(os.path.join(cpt_dir, "m5.cpt"))
+    for section in cpt.sections():
+        if not cpt.has_option(section, "filename_pages"):
+            continue
+        before, after = flatten_store(
+            cpt_dir,
+            cpt.get(section, "filename_pages"),
+            cpt.get(section, "filename_ids"),
+            cpt.getint(section, "range_size"),
+        )
+        print(f"{cpt_dir}: {section}: {before} pages -> {after}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Give paged checkpoints their own page files, holding "
+        "only the pages they use"
+    )
+    parser.add_argument("checkpoints", nargs="+", help="Checkpoint directories")
+    args = parser.parse_args()
+    for cpt_dir in args.checkpoints:
+        flatten(cpt_dir)